@@ -0,0 +1,644 @@
+/*
+    HTTP压力测试工具，只连接本机(127.0.0.1)上的服务器。
+    每个线程用自己的epoll驱动一组连接，支持：
+        闭环(默认)：每个连接上始终有 -p 个请求在途，收到一个响应就发下一个，测的是服务器能跑多快；
+        开环(-r)：按固定速率安排请求，不管前面的响应回来没有，测的是给定负载下的延迟。
+    开环模式下延迟从请求"应该发出"的时间算起，连接忙或者服务器卡住时排队等待的时间也算在内，
+    不会因为客户端跟着服务器一起变慢而漏掉慢请求(coordinated omission)。闭环模式没有计划发送时间，只能从实际发出时算起。
+    默认使用keep-alive，-C 改为每个请求一个新连接(Connection: close)。
+    URL默认是/index.html，-u 从文件读取URL和权重(每行"url 权重"，权重默认1)，-R 把目录下的所有文件都加入(权重1)。
+
+    编译： g++ -O2 -I.. loadgen.cpp -o loadgen -pthread
+    运行： ./loadgen [-t 线程数] [-c 连接数] [-d 秒数] [-r 每秒请求数] [-p 流水线深度] [-C] [-T 超时秒数] [-u url文件] [-R 目录] 端口
+    例如： ./loadgen -t 4 -c 64 -d 10 -R ../resources 10000
+          ./loadgen -t 2 -c 32 -d 10 -r 20000 -p 4 10000
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <ftw.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <vector>
+#include <string>
+#include "stats.h"
+
+#define MAX_DEPTH 64            //流水线深度的上限
+#define IN_SIZE 65536           //每个连接的接收缓冲区，只需要放下响应头，响应体只计数不保存
+#define OUT_SIZE 32768
+#define BACKLOG_SIZE (1 << 20)  //开环模式下还没发出去的请求最多这么多，再多说明客户端跟不上
+#define RETRY_MS 100            //连接失败后等这么久再重连
+
+enum ERROR_KIND { ERR_CONNECT = 0, ERR_RESET, ERR_TIMEOUT, ERR_PARSE, ERR_OVERFLOW, ERR_COUNT };
+static const char* error_names[ERR_COUNT] = { "connect", "reset", "timeout", "parse", "overflow" };
+
+// 一个还没完成的请求：计划(或实际)发送的时间和URL的编号
+struct pending
+{
+    long long m_start;
+    int m_url;
+};
+
+struct client_conn
+{
+    int m_fd;
+    bool m_connecting;
+    long long m_retry_at;           //连接失败以后在这个时间之前不重连
+    long long m_active_at;          //最近一次发出请求或者收到数据的时间，用来判断超时
+    int m_sent;                     //这个连接上已经发出的请求数，Connection: close模式下只发一个
+    char m_out[OUT_SIZE];
+    int m_out_len;
+    int m_out_sent;
+    char m_in[IN_SIZE];
+    int m_in_len;
+    pending m_queue[MAX_DEPTH];     //已经发出、还没收到响应的请求，按发送顺序
+    int m_head;
+    int m_count;
+    bool m_in_body;                 //正在接收当前响应的响应体
+    long long m_body_left;
+    int m_status;
+    bool m_close_after;             //当前响应带有Connection: close
+};
+
+struct worker_stats
+{
+    histogram m_latency;            //纳秒
+    unsigned long long m_completed;
+    unsigned long long m_bytes;
+    unsigned long long m_errors[ERR_COUNT];
+    unsigned long long m_status[600];
+    unsigned long long m_unfinished;
+};
+
+struct worker
+{
+    int m_id;
+    pthread_t m_thread;
+    int m_conn_count;
+    client_conn* m_conns;
+    int m_epollfd;
+    pending* m_backlog;             //等待分配到连接上的请求，开环模式下由发送计划产生，连接断开时没完成的请求也放回这里
+    unsigned m_backlog_head;
+    unsigned m_backlog_tail;
+    unsigned m_seed;
+    worker_stats* m_stats;
+};
+
+// 命令行参数，线程启动前设置好，之后只读
+static int port = 0;
+static int thread_number = 1;
+static int conn_number = 16;
+static int duration = 10;
+static double rate = 0;
+static int depth = 1;
+static bool close_mode = false;
+static int timeout_ms = 5000;
+static std::vector<std::string> keepalive_requests;
+static std::vector<std::string> close_requests;
+static std::vector<unsigned> url_weights;      //累加的权重，按随机数二分查找
+static std::vector<std::string> urls;
+static long long start_time;
+static long long end_time;
+
+static void add_url(const char* url, unsigned weight){
+    if(weight == 0){
+        return;
+    }
+    urls.push_back(url);
+    std::string req = std::string("GET ") + url + " HTTP/1.1\r\nHost: 127.0.0.1\r\nUser-Agent: loadgen\r\n";
+    keepalive_requests.push_back(req + "\r\n");
+    close_requests.push_back(req + "Connection: close\r\n\r\n");
+    url_weights.push_back((url_weights.empty() ? 0 : url_weights.back()) + weight);
+}
+
+static bool load_url_file(const char* path){
+    FILE* fp = fopen(path, "r");
+    if(!fp){
+        return false;
+    }
+    char line[1024];
+    while(fgets(line, sizeof(line), fp)){
+        char url[1024];
+        unsigned weight = 1;
+        if(line[0] == '#' || sscanf(line, "%1023s %u", url, &weight) < 1){
+            continue;
+        }
+        add_url(url, weight);
+    }
+    fclose(fp);
+    return true;
+}
+
+static int resource_root_len = 0;
+
+static int add_resource(const char* path, const struct stat* st, int type, struct FTW* ftw){
+    if(type == FTW_F && strlen(path) > (size_t)resource_root_len){
+        add_url(path + resource_root_len, 1);
+    }
+    return 0;
+}
+
+static unsigned next_random(unsigned& seed){
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    return seed;
+}
+
+static int pick_url(worker* w){
+    unsigned r = next_random(w->m_seed) % url_weights.back();
+    int lo = 0;
+    int hi = url_weights.size() - 1;
+    while(lo < hi){
+        int mid = (lo + hi) / 2;
+        if(url_weights[mid] > r){
+            hi = mid;
+        }else{
+            lo = mid + 1;
+        }
+    }
+    return lo;
+}
+
+static bool backlog_push(worker* w, long long start, int url){
+    if(w->m_backlog_tail - w->m_backlog_head >= BACKLOG_SIZE){
+        w->m_stats->m_errors[ERR_OVERFLOW]++;
+        return false;
+    }
+    pending& p = w->m_backlog[w->m_backlog_tail++ & (BACKLOG_SIZE - 1)];
+    p.m_start = start;
+    p.m_url = url;
+    return true;
+}
+
+static void open_conn(worker* w, client_conn* c, long long now){
+    c->m_fd = -1;
+    c->m_connecting = false;
+    c->m_sent = 0;
+    c->m_out_len = c->m_out_sent = 0;
+    c->m_in_len = 0;
+    c->m_head = c->m_count = 0;
+    c->m_in_body = false;
+    c->m_body_left = 0;
+    c->m_close_after = false;
+    if(now < c->m_retry_at){
+        return;
+    }
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if(fd < 0){
+        w->m_stats->m_errors[ERR_CONNECT]++;
+        c->m_retry_at = now + RETRY_MS * 1000000LL;
+        return;
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if(connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 && errno != EINPROGRESS){
+        close(fd);
+        w->m_stats->m_errors[ERR_CONNECT]++;
+        c->m_retry_at = now + RETRY_MS * 1000000LL;
+        return;
+    }
+    c->m_fd = fd;
+    c->m_connecting = true;
+    //边沿触发，读和写都要做到EAGAIN
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    ev.data.ptr = c;
+    epoll_ctl(w->m_epollfd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+// 关闭连接并重新连接，没收到响应的请求放回backlog，保留原来的开始时间
+static void reset_conn(worker* w, client_conn* c, long long now, int error){
+    if(error >= 0){
+        w->m_stats->m_errors[error]++;
+    }
+    if(c->m_fd >= 0){
+        close(c->m_fd);
+    }
+    for(int i = 0; i < c->m_count; i++){
+        pending& p = c->m_queue[(c->m_head + i) % MAX_DEPTH];
+        backlog_push(w, p.m_start, p.m_url);
+    }
+    if(error == ERR_CONNECT || error == ERR_RESET){
+        c->m_retry_at = now + RETRY_MS * 1000000LL;
+    }
+    open_conn(w, c, now);
+}
+
+static bool flush_out(client_conn* c){
+    while(!c->m_connecting && c->m_out_sent < c->m_out_len){
+        int n = send(c->m_fd, c->m_out + c->m_out_sent, c->m_out_len - c->m_out_sent, MSG_NOSIGNAL);
+        if(n < 0){
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+        c->m_out_sent += n;
+    }
+    if(c->m_out_sent == c->m_out_len){
+        c->m_out_sent = c->m_out_len = 0;
+    }
+    return true;
+}
+
+// 在连接上排一个请求，放不下返回false
+static bool enqueue(client_conn* c, long long start, int url){
+    const std::string& req = close_mode ? close_requests[url] : keepalive_requests[url];
+    if(c->m_out_len + (int)req.size() > OUT_SIZE){
+        return false;
+    }
+    memcpy(c->m_out + c->m_out_len, req.data(), req.size());
+    c->m_out_len += req.size();
+    pending& p = c->m_queue[(c->m_head + c->m_count) % MAX_DEPTH];
+    p.m_start = start;
+    p.m_url = url;
+    c->m_count++;
+    c->m_sent++;
+    return true;
+}
+
+// 把请求分配到有空位的连接上：先分配backlog中的，闭环模式再给每个连接补满
+static void dispatch(worker* w, long long now){
+    for(int i = 0; i < w->m_conn_count; i++){
+        client_conn* c = &w->m_conns[i];
+        if(c->m_fd < 0){
+            if(now < c->m_retry_at){
+                continue;
+            }
+            open_conn(w, c, now);
+            if(c->m_fd < 0){
+                continue;
+            }
+        }
+        int limit = close_mode ? 1 : depth;
+        bool queued = false;
+        while(c->m_count < limit && !(close_mode && c->m_sent > 0)){
+            if(w->m_backlog_head != w->m_backlog_tail){
+                pending& p = w->m_backlog[w->m_backlog_head & (BACKLOG_SIZE - 1)];
+                if(!enqueue(c, p.m_start, p.m_url)){
+                    break;
+                }
+                w->m_backlog_head++;
+            }else if(rate <= 0){
+                if(!enqueue(c, now, pick_url(w))){
+                    break;
+                }
+            }else{
+                break;
+            }
+            queued = true;
+        }
+        if(queued){
+            c->m_active_at = now;
+        }
+        if(queued && !flush_out(c)){
+            reset_conn(w, c, now, ERR_RESET);
+        }
+    }
+}
+
+// 解析收到的数据，返回false表示连接要重建
+static bool parse_responses(worker* w, client_conn* c, long long now){
+    int pos = 0;
+    while(pos < c->m_in_len){
+        if(c->m_in_body){
+            long long take = c->m_in_len - pos;
+            if(take > c->m_body_left){
+                take = c->m_body_left;
+            }
+            c->m_body_left -= take;
+            pos += take;
+            if(c->m_body_left > 0){
+                break;
+            }
+        }else{
+            char* start = c->m_in + pos;
+            char* end = (char*)memmem(start, c->m_in_len - pos, "\r\n\r\n", 4);
+            if(!end){
+                if(pos == 0 && c->m_in_len == IN_SIZE){
+                    reset_conn(w, c, now, ERR_PARSE);
+                    return false;
+                }
+                break;
+            }
+            if(c->m_count == 0 || end - start < 12 || strncmp(start, "HTTP/1.", 7) != 0){
+                reset_conn(w, c, now, ERR_PARSE);
+                return false;
+            }
+            c->m_status = atoi(start + 9);
+            c->m_body_left = 0;
+            c->m_close_after = false;
+            //逐行找Content-Length和Connection
+            for(char* line = (char*)memchr(start, '\n', end - start); line && line < end; line = (char*)memchr(line, '\n', end + 2 - line)){
+                ++line;
+                if(strncasecmp(line, "Content-Length:", 15) == 0){
+                    c->m_body_left = atoll(line + 15);
+                }else if(strncasecmp(line, "Connection:", 11) == 0){
+                    char* value = line + 11;
+                    value += strspn(value, " \t");
+                    c->m_close_after = strncasecmp(value, "close", 5) == 0;
+                }
+            }
+            if(c->m_status == 304 || c->m_status < 200){
+                c->m_body_left = 0;
+            }
+            w->m_stats->m_bytes += end + 4 - start;
+            pos = end + 4 - c->m_in;
+            c->m_in_body = true;
+            w->m_stats->m_bytes += c->m_body_left;
+            if(c->m_body_left > 0){
+                continue;
+            }
+        }
+        //一个响应收完了
+        pending& p = c->m_queue[c->m_head];
+        c->m_head = (c->m_head + 1) % MAX_DEPTH;
+        c->m_count--;
+        c->m_in_body = false;
+        w->m_stats->m_latency.record(now - p.m_start);
+        w->m_stats->m_completed++;
+        if(c->m_status >= 100 && c->m_status < 600){
+            w->m_stats->m_status[c->m_status]++;
+        }
+        if(c->m_close_after || close_mode){
+            reset_conn(w, c, now, -1);
+            return false;
+        }
+    }
+    memmove(c->m_in, c->m_in + pos, c->m_in_len - pos);
+    c->m_in_len -= pos;
+    return true;
+}
+
+static void handle_event(worker* w, client_conn* c, unsigned events, long long now){
+    if(c->m_connecting){
+        int err = 0;
+        socklen_t len = sizeof(err);
+        getsockopt(c->m_fd, SOL_SOCKET, SO_ERROR, &err, &len);
+        if(err != 0 || (events & EPOLLERR)){
+            reset_conn(w, c, now, ERR_CONNECT);
+            return;
+        }
+        if(!(events & EPOLLOUT)){
+            return;
+        }
+        c->m_connecting = false;
+    }
+    if((events & EPOLLOUT) && !flush_out(c)){
+        reset_conn(w, c, now, ERR_RESET);
+        return;
+    }
+    if(events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)){
+        while(true){
+            int n = recv(c->m_fd, c->m_in + c->m_in_len, IN_SIZE - c->m_in_len, 0);
+            if(n < 0){
+                if(errno == EAGAIN || errno == EWOULDBLOCK){
+                    break;
+                }
+                reset_conn(w, c, now, ERR_RESET);
+                return;
+            }
+            if(n == 0){
+                //服务器关闭了连接，还有请求没收到响应就算是出错
+                reset_conn(w, c, now, c->m_count > 0 ? ERR_RESET : -1);
+                return;
+            }
+            c->m_in_len += n;
+            c->m_active_at = now;
+            if(!parse_responses(w, c, now)){
+                return;
+            }
+        }
+    }
+}
+
+static void check_timeouts(worker* w, long long now){
+    for(int i = 0; i < w->m_conn_count; i++){
+        client_conn* c = &w->m_conns[i];
+        //开环模式下请求的开始时间可能早就过了，超时按连接上最后一次有进展的时间算
+        if(c->m_fd >= 0 && c->m_count > 0 && now - c->m_active_at > timeout_ms * 1000000LL){
+            //超时的请求不再等待，后面的请求放回backlog
+            c->m_head = (c->m_head + 1) % MAX_DEPTH;
+            c->m_count--;
+            reset_conn(w, c, now, ERR_TIMEOUT);
+        }
+    }
+}
+
+static void* run_worker(void* arg){
+    worker* w = (worker*)arg;
+    w->m_epollfd = epoll_create1(EPOLL_CLOEXEC);
+    struct epoll_event events[256];
+
+    //开环模式下每个线程承担总速率的一份，各线程的发送时刻错开
+    double interval = rate > 0 ? 1e9 * thread_number / rate : 0;
+    double phase = interval * w->m_id / thread_number;
+    long long scheduled = 0;
+    long long next_send = start_time + (long long)phase;
+    long long last_check = start_time;
+
+    for(int i = 0; i < w->m_conn_count; i++){
+        w->m_conns[i].m_retry_at = 0;
+        open_conn(w, &w->m_conns[i], start_time);
+    }
+    while(true){
+        long long now = get_ns_time();
+        if(now >= end_time){
+            break;
+        }
+        if(rate > 0){
+            //按计划时间而不是当前时间入队，客户端自己落后了也不会推迟计划
+            while(next_send <= now){
+                backlog_push(w, next_send, pick_url(w));
+                next_send = start_time + (long long)(phase + interval * ++scheduled);
+            }
+        }
+        dispatch(w, now);
+        if(now - last_check > 100000000LL){
+            check_timeouts(w, now);
+            last_check = now;
+        }
+
+        int wait_ms = 10;
+        if(rate > 0){
+            long long delta = next_send - get_ns_time();
+            wait_ms = delta > 0 ? (int)(delta / 1000000) : 0;
+        }
+        int n = epoll_wait(w->m_epollfd, events, 256, wait_ms);
+        now = get_ns_time();
+        for(int i = 0; i < n; i++){
+            client_conn* c = (client_conn*)events[i].data.ptr;
+            if(c->m_fd >= 0){
+                handle_event(w, c, events[i].events, now);
+            }
+        }
+    }
+
+    w->m_stats->m_unfinished = w->m_backlog_tail - w->m_backlog_head;
+    for(int i = 0; i < w->m_conn_count; i++){
+        w->m_stats->m_unfinished += w->m_conns[i].m_count;
+        if(w->m_conns[i].m_fd >= 0){
+            close(w->m_conns[i].m_fd);
+        }
+    }
+    close(w->m_epollfd);
+    return NULL;
+}
+
+// 合并以后的直方图中第q分位数所在的桶的中点
+static double percentile(const std::vector<unsigned long long>& counts, unsigned long long total, double q){
+    if(total == 0){
+        return 0;
+    }
+    unsigned long long rank = (unsigned long long)(q * total);
+    if(rank >= total){
+        rank = total - 1;
+    }
+    unsigned long long seen = 0;
+    for(int i = 0; i < histogram::BUCKETS; i++){
+        seen += counts[i];
+        if(seen > rank){
+            return histogram::lower(i) + (histogram::width(i) - 1) / 2.0;
+        }
+    }
+    return 0;
+}
+
+static void usage(const char* name){
+    printf("按照如下格式运行： %s [-t threads] [-c connections] [-d seconds] [-r requests_per_second] [-p pipeline_depth] [-C] [-T timeout_seconds] [-u url_file] [-R resource_dir] port\n", name);
+}
+
+int main(int argc, char* argv[]){
+    int opt;
+    while((opt = getopt(argc, argv, "t:c:d:r:p:CT:u:R:")) != -1){
+        switch(opt){
+            case 't':
+                thread_number = atoi(optarg);
+                break;
+            case 'c':
+                conn_number = atoi(optarg);
+                break;
+            case 'd':
+                duration = atoi(optarg);
+                break;
+            case 'r':
+                rate = atof(optarg);
+                break;
+            case 'p':
+                depth = atoi(optarg);
+                break;
+            case 'C':
+                close_mode = true;
+                break;
+            case 'T':
+                timeout_ms = atoi(optarg) * 1000;
+                break;
+            case 'u':
+                if(!load_url_file(optarg)){
+                    printf("无法读取URL文件：%s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'R':
+                resource_root_len = strlen(optarg);
+                while(resource_root_len > 1 && optarg[resource_root_len - 1] == '/'){
+                    resource_root_len--;
+                }
+                if(nftw(optarg, add_resource, 16, FTW_PHYS) != 0){
+                    printf("无法遍历目录：%s\n", optarg);
+                    return 1;
+                }
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+    if(optind >= argc || thread_number <= 0 || conn_number < thread_number || duration <= 0
+        || depth <= 0 || depth > MAX_DEPTH || timeout_ms <= 0){
+        usage(argv[0]);
+        return 1;
+    }
+    port = atoi(argv[optind]);
+    if(urls.empty()){
+        add_url("/index.html", 1);
+    }
+
+    worker* workers = new worker[thread_number];
+    start_time = get_ns_time();
+    end_time = start_time + duration * 1000000000LL;
+    for(int i = 0; i < thread_number; i++){
+        worker* w = &workers[i];
+        w->m_id = i;
+        w->m_conn_count = conn_number / thread_number + (i < conn_number % thread_number ? 1 : 0);
+        w->m_conns = new client_conn[w->m_conn_count];
+        w->m_backlog = new pending[BACKLOG_SIZE];
+        w->m_backlog_head = w->m_backlog_tail = 0;
+        w->m_seed = 2463534242u + i * 2654435761u;
+        w->m_stats = new worker_stats();
+        pthread_create(&w->m_thread, NULL, run_worker, w);
+    }
+
+    std::vector<unsigned long long> counts(histogram::BUCKETS, 0);
+    unsigned long long completed = 0, bytes = 0, unfinished = 0, total = 0;
+    unsigned long long errors[ERR_COUNT] = { 0 };
+    unsigned long long status[600] = { 0 };
+    uint64_t max_latency = 0;
+    for(int i = 0; i < thread_number; i++){
+        pthread_join(workers[i].m_thread, NULL);
+        worker_stats* s = workers[i].m_stats;
+        for(int b = 0; b < histogram::BUCKETS; b++){
+            unsigned long long n = s->m_latency.m_counts[b].load();
+            counts[b] += n;
+            total += n;
+            if(n && histogram::lower(b) + histogram::width(b) - 1 > max_latency){
+                max_latency = histogram::lower(b) + histogram::width(b) - 1;
+            }
+        }
+        completed += s->m_completed;
+        bytes += s->m_bytes;
+        unfinished += s->m_unfinished;
+        for(int e = 0; e < ERR_COUNT; e++){
+            errors[e] += s->m_errors[e];
+        }
+        for(int code = 0; code < 600; code++){
+            status[code] += s->m_status[code];
+        }
+    }
+    double seconds = (get_ns_time() - start_time) / 1e9;
+
+    printf("%s, %d threads, %d connections, %s, pipeline %d, %d urls, %.1fs\n",
+           rate > 0 ? "open loop" : "closed loop", thread_number, conn_number,
+           close_mode ? "Connection: close" : "keep-alive", close_mode ? 1 : depth, (int)urls.size(), seconds);
+    if(rate > 0){
+        printf("target rate: %.0f req/s\n", rate);
+    }
+    printf("requests: %llu completed, %.1f req/s, %.2f MB/s\n", completed, completed / seconds, bytes / seconds / 1048576);
+    printf("latency %s:\n", rate > 0 ? "(from scheduled send time, corrected for coordinated omission)" : "(from actual send time)");
+    printf("  p50 %.1fus  p90 %.1fus  p99 %.1fus  p99.9 %.1fus  max %.1fus\n",
+           percentile(counts, total, 0.5) / 1000, percentile(counts, total, 0.9) / 1000,
+           percentile(counts, total, 0.99) / 1000, percentile(counts, total, 0.999) / 1000, max_latency / 1000.0);
+    printf("status:");
+    for(int code = 0; code < 600; code++){
+        if(status[code]){
+            printf(" %d=%llu", code, status[code]);
+        }
+    }
+    printf("\nerrors:");
+    for(int e = 0; e < ERR_COUNT; e++){
+        printf(" %s=%llu", error_names[e], errors[e]);
+    }
+    printf(" unfinished=%llu\n", unfinished);
+    return 0;
+}
@@ -0,0 +1,483 @@
+/*
+    组件级的微基准测试，用来比较修改前后的性能，覆盖三部分：
+        timer：时间轮在1k~1M个定时器时add_timer、adjust_timer和tick(批量到期)的开销；
+        parse：http_conn解析几类典型的请求(短请求、头部很多的浏览器请求、流水线上的8个请求、分成小片到达的请求)，
+               数据通过feed()放入读缓冲区，再调用process()和finish_write()，不经过socket。
+               响应来自热点响应缓存，除了总时间还单独给出解析的时间(来自统计模块的parse阶段)；
+        pool：线程池从append()到工作线程执行任务的交接，一次只有一个任务在途时的延迟，以及任务不断时的吞吐量和排队延迟。
+    每项测试重复 -n 次，输出中位数、最小值和最大值。结果以JSON输出到标准输出，进度输出到标准错误，
+    不同版本的结果可以直接diff或者用脚本对比。随机数使用固定的种子，每次运行的输入都一样。
+
+    编译(需要服务器中除main.cpp以外的所有源文件)：
+          g++ -O2 -I.. microbench.cpp ../buffer_pool.cpp ../compressor.cpp ../file_cache.cpp ../http_cache.cpp ../http_conn.cpp \
+              ../http_response.cpp ../log.cpp ../object_cache.cpp ../reactor.cpp ../stats.cpp ../tokenizer.cpp ../upgrade.cpp -o microbench -pthread -lz
+    运行： ./microbench [-n 重复次数] [-f 名字中包含的字符串] [-R 网站根目录] > result.json
+    例如： ./microbench -f timer/ -n 9
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <algorithm>
+#include <atomic>
+#include <vector>
+#include <string>
+#include "lst_timer.h"
+#include "http_conn.h"
+#include "threadpool.h"
+#include "stats.h"
+#include "log.h"
+
+extern const char* doc_root;
+
+#define MAX_METRICS 4
+
+// 一项测试的结果：每次重复得到一个主要的值(samples)，另外可以附带几个指标(取最后一次重复的值)
+struct bench_result
+{
+    std::string m_name;
+    std::string m_params;       //JSON对象的内容，比如 "\"timers\": 1000"
+    const char* m_unit;
+    std::vector<double> m_samples;
+    const char* m_metric_names[MAX_METRICS];
+    double m_metrics[MAX_METRICS];
+    int m_metric_count;
+};
+
+static std::vector<bench_result> g_results;
+static int g_repeat = 5;
+static const char* g_filter = NULL;
+
+static bool selected(const char* name){
+    return !g_filter || strstr(name, g_filter) != NULL;
+}
+
+static bench_result& new_result(const char* name, const char* unit, const char* params_fmt, long long param){
+    bench_result r;
+    char params[128];
+    snprintf(params, sizeof(params), params_fmt, param);
+    r.m_name = name;
+    r.m_params = params;
+    r.m_unit = unit;
+    r.m_metric_count = 0;
+    g_results.push_back(r);
+    fprintf(stderr, "%s (%s)\n", name, params);
+    return g_results.back();
+}
+
+static void set_metric(bench_result& r, const char* name, double value){
+    for(int i = 0; i < r.m_metric_count; i++){
+        if(strcmp(r.m_metric_names[i], name) == 0){
+            r.m_metrics[i] = value;
+            return;
+        }
+    }
+    if(r.m_metric_count < MAX_METRICS){
+        r.m_metric_names[r.m_metric_count] = name;
+        r.m_metrics[r.m_metric_count] = value;
+        r.m_metric_count++;
+    }
+}
+
+// 固定种子的xorshift，每次运行产生同样的序列
+static unsigned long long g_seed;
+static unsigned rnd(){
+    g_seed ^= g_seed << 13;
+    g_seed ^= g_seed >> 7;
+    g_seed ^= g_seed << 17;
+    return (unsigned)g_seed;
+}
+
+// 直方图中第q分位数所在桶的中点
+static double quantile(const histogram& h, double q){
+    uint64_t total = h.m_count.load();
+    if(total == 0){
+        return 0;
+    }
+    uint64_t rank = (uint64_t)(q * total);
+    if(rank >= total){
+        rank = total - 1;
+    }
+    uint64_t seen = 0;
+    for(int i = 0; i < histogram::BUCKETS; i++){
+        seen += h.m_counts[i].load();
+        if(seen > rank){
+            return histogram::lower(i) + (histogram::width(i) - 1) / 2.0;
+        }
+    }
+    return 0;
+}
+
+/* ---------------------------------- 定时器 ---------------------------------- */
+
+#define TIMER_TIMEOUT 15000     //和reactor一样，连接的超时时间是3 * TIMESLOT
+#define TIMER_WINDOW 200        //tick测试中定时器分散到期的时间范围(毫秒)
+
+static long g_expired = 0;
+static void count_expired(client_data*){
+    g_expired++;
+}
+
+static util_timer** make_timers(int n, long long now){
+    util_timer** timers = new util_timer*[n];
+    for(int i = 0; i < n; i++){
+        timers[i] = new util_timer;
+        //连接活跃时间不同，超时时间在一个超时周期内分散
+        timers[i]->expire = now + TIMER_TIMEOUT + rnd() % TIMER_TIMEOUT;
+        timers[i]->cb_func = count_expired;
+        timers[i]->user_date = NULL;
+    }
+    return timers;
+}
+
+static void bench_timers(){
+    static const int sizes[] = { 1000, 10000, 100000, 1000000 };
+    for(size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++){
+        int n = sizes[s];
+        if(selected("timer/add")){
+            bench_result& r = new_result("timer/add", "ns/op", "\"timers\": %lld", n);
+            for(int rep = 0; rep < g_repeat; rep++){
+                g_seed = 88172645463325252ULL;
+                time_wheel* wheel = new time_wheel;
+                util_timer** timers = make_timers(n, get_ms_time());
+                long long begin = get_ns_time();
+                for(int i = 0; i < n; i++){
+                    wheel->add_timer(timers[i]);
+                }
+                r.m_samples.push_back((double)(get_ns_time() - begin) / n);
+                delete wheel;   //同时删除其中的定时器
+                delete []timers;
+            }
+        }
+        if(selected("timer/adjust")){
+            //连接收到数据时把定时器往后推，被推的连接是随机的；次数至少10万次，小的时间轮也能测得准
+            int ops = n < 100000 ? 100000 : n;
+            bench_result& r = new_result("timer/adjust", "ns/op", "\"timers\": %lld", n);
+            for(int rep = 0; rep < g_repeat; rep++){
+                g_seed = 88172645463325252ULL;
+                time_wheel* wheel = new time_wheel;
+                long long now = get_ms_time();
+                util_timer** timers = make_timers(n, now);
+                for(int i = 0; i < n; i++){
+                    wheel->add_timer(timers[i]);
+                }
+                unsigned* picks = new unsigned[ops];
+                for(int i = 0; i < ops; i++){
+                    picks[i] = rnd() % n;
+                }
+                long long begin = get_ns_time();
+                for(int i = 0; i < ops; i++){
+                    util_timer* timer = timers[picks[i]];
+                    timer->expire = now + TIMER_TIMEOUT + (i & 1023);
+                    wheel->adjust_timer(timer);
+                }
+                r.m_samples.push_back((double)(get_ns_time() - begin) / ops);
+                delete []picks;
+                delete wheel;
+                delete []timers;
+            }
+        }
+        if(selected("timer/tick")){
+            //定时器在接下来的TIMER_WINDOW毫秒内分散到期，等它们全部到期以后调用一次tick()，
+            //这一次要走过TIMER_WINDOW个槽、分散上层的槽、执行并删除所有定时器，按每个定时器平均
+            bench_result& r = new_result("timer/tick", "ns/timer", "\"timers\": %lld", n);
+            for(int rep = 0; rep < g_repeat; rep++){
+                g_seed = 88172645463325252ULL;
+                time_wheel* wheel = new time_wheel;
+                long long now = get_ms_time();
+                for(int i = 0; i < n; i++){
+                    util_timer* timer = new util_timer;
+                    timer->expire = now + 1 + rnd() % TIMER_WINDOW;
+                    timer->cb_func = count_expired;
+                    timer->user_date = NULL;
+                    wheel->add_timer(timer);
+                }
+                usleep((TIMER_WINDOW + 2) * 1000);
+                g_expired = 0;
+                long long begin = get_ns_time();
+                wheel->tick();
+                r.m_samples.push_back((double)(get_ns_time() - begin) / n);
+                set_metric(r, "expired", g_expired);
+                delete wheel;
+            }
+        }
+    }
+}
+
+/* ---------------------------------- 请求解析 ---------------------------------- */
+
+#define PARSE_REQUESTS 200000   //每次重复处理的请求数
+#define SPLIT_SIZE 16           //分片到达的请求每次送进来的字节数
+
+static const char small_request[] =
+    "GET /index.html HTTP/1.1\r\n"
+    "Host: localhost\r\n"
+    "\r\n";
+
+// 浏览器发出的典型请求，头部字段多，Cookie和User-Agent比较长
+static const char heavy_request[] =
+    "GET /index.html HTTP/1.1\r\n"
+    "Host: www.example.com\r\n"
+    "Connection: keep-alive\r\n"
+    "Cache-Control: max-age=0\r\n"
+    "sec-ch-ua: \"Chromium\";v=\"118\", \"Google Chrome\";v=\"118\", \"Not=A?Brand\";v=\"99\"\r\n"
+    "sec-ch-ua-mobile: ?0\r\n"
+    "sec-ch-ua-platform: \"Linux\"\r\n"
+    "Upgrade-Insecure-Requests: 1\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/118.0.0.0 Safari/537.36\r\n"
+    "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,image/webp,image/apng,*/*;q=0.8\r\n"
+    "Sec-Fetch-Site: none\r\n"
+    "Sec-Fetch-Mode: navigate\r\n"
+    "Sec-Fetch-User: ?1\r\n"
+    "Sec-Fetch-Dest: document\r\n"
+    "Accept-Language: zh-CN,zh;q=0.9,en;q=0.8\r\n"
+    "Cookie: session=8f14e45fceea167a5a36dedd4bea2543; theme=dark; _ga=GA1.1.1234567890.1697000000; "
+    "_gid=GA1.1.987654321.1697100000; csrftoken=Yt3kQz9vLmN2pR8sTu4wXy6zAb1cDe5f; lang=zh-CN\r\n"
+    "\r\n";
+
+struct parse_corpus
+{
+    const char* m_name;
+    std::string m_data;     //一次送进来的全部数据
+    int m_requests;         //其中包含的请求数
+    int m_chunk;            //每次feed()的字节数，0表示一次全部送入
+};
+
+static void bench_parse(const char* root){
+    char path[PATH_MAX];
+    if(!realpath(root, path)){
+        fprintf(stderr, "找不到网站根目录：%s，跳过解析测试\n", root);
+        return;
+    }
+    doc_root = strdup(path);
+    http_conn::m_file_cache.init(doc_root);
+    http_conn::m_object_cache.init(64LL * 1024 * 1024);
+    http_conn::m_compressor.init(0);
+    http_conn::m_max_requests = 0;
+
+    std::vector<parse_corpus> corpora;
+    parse_corpus c;
+    c.m_name = "parse/small"; c.m_data = small_request; c.m_requests = 1; c.m_chunk = 0;
+    corpora.push_back(c);
+    c.m_name = "parse/header_heavy"; c.m_data = heavy_request; c.m_requests = 1; c.m_chunk = 0;
+    corpora.push_back(c);
+    c.m_name = "parse/pipelined"; c.m_data = ""; c.m_requests = http_conn::MAX_PIPELINE; c.m_chunk = 0;
+    for(int i = 0; i < c.m_requests; i++){
+        c.m_data += small_request;
+    }
+    corpora.push_back(c);
+    c.m_name = "parse/split"; c.m_data = heavy_request; c.m_requests = 1; c.m_chunk = SPLIT_SIZE;
+    corpora.push_back(c);
+
+    http_conn* conn = new http_conn;
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    thread_stats* st = stats::local();
+    for(size_t k = 0; k < corpora.size(); k++){
+        const parse_corpus& corpus = corpora[k];
+        if(!selected(corpus.m_name)){
+            continue;
+        }
+        bench_result& r = new_result(corpus.m_name, "ns/request", "\"bytes\": %lld", corpus.m_data.size());
+        const char* data = corpus.m_data.data();
+        int len = corpus.m_data.size();
+        int chunk = corpus.m_chunk ? corpus.m_chunk : len;
+        int rounds = PARSE_REQUESTS / corpus.m_requests;
+        for(int rep = 0; rep < g_repeat + 1; rep++){
+            //没有socket也没有epoll，process()中的modfd()直接返回
+            conn->init(-1, addr, -1);
+            uint64_t parse_sum = st->m_stages[STAGE_PARSE].m_sum.load();
+            uint64_t bytes_out = st->m_counters[COUNTER_BYTES_OUT].load();
+            long long begin = get_ns_time();
+            for(int i = 0; i < rounds; i++){
+                for(int off = 0; off < len; off += chunk){
+                    int n = len - off < chunk ? len - off : chunk;
+                    conn->feed(data + off, n);
+                    if(conn->process()){
+                        conn->finish_write();
+                    }
+                }
+            }
+            long long elapsed = get_ns_time() - begin;
+            conn->unmap();
+            http_conn::m_user_count--;
+            if(rep == 0){
+                //第一次重复用来填充文件缓存和热点响应缓存，不计入结果
+                continue;
+            }
+            int requests = rounds * corpus.m_requests;
+            r.m_samples.push_back((double)elapsed / requests);
+            //parse阶段的计时包含两次读时钟的开销。分片到达时process()在请求不完整时不计时，只有最后一片算在里面，不输出
+            if(!corpus.m_chunk){
+                set_metric(r, "parse_ns", (double)(st->m_stages[STAGE_PARSE].m_sum.load() - parse_sum) / requests);
+            }
+            //每个请求的响应字节数，用来确认请求都得到了预期的响应
+            set_metric(r, "response_bytes", (double)(st->m_counters[COUNTER_BYTES_OUT].load() - bytes_out) / requests);
+        }
+    }
+    delete conn;
+}
+
+/* ---------------------------------- 线程池 ---------------------------------- */
+
+#define POOL_TASKS 1000000      //吞吐量测试每次重复的任务数
+#define PING_TASKS 20000        //延迟测试每次重复的任务数
+#define POOL_INFLIGHT 4096      //吞吐量测试中在途任务的上限，不超过线程池的队列上限
+#define POOL_SLOTS 8192
+
+static std::atomic<long> g_done(0);
+static std::atomic<int> g_hist_count(0);
+static histogram* g_hists[256];
+static __thread histogram* t_hist = NULL;
+
+// 空任务，只记录从append()到开始执行的时间，测的是线程池本身的交接开销
+struct handoff_task
+{
+    long long m_sent;
+    void process(){
+        if(!t_hist){
+            t_hist = new histogram();
+            g_hists[g_hist_count.fetch_add(1) & 255] = t_hist;
+        }
+        t_hist->record(get_ns_time() - m_sent);
+        g_done.fetch_add(1, std::memory_order_release);
+    }
+    //测试中不开启按排队延迟丢弃
+    void shed(){
+        process();
+    }
+};
+
+// 合并各工作线程的直方图并清零
+static void collect_latency(histogram& total){
+    memset((void*)&total, 0, sizeof(total));
+    int n = g_hist_count.load();
+    for(int t = 0; t < n && t < 256; t++){
+        histogram* h = g_hists[t];
+        for(int i = 0; i < histogram::BUCKETS; i++){
+            total.m_counts[i].store(total.m_counts[i].load() + h->m_counts[i].load());
+            h->m_counts[i].store(0);
+        }
+        total.m_count.store(total.m_count.load() + h->m_count.load());
+        h->m_count.store(0);
+        h->m_sum.store(0);
+    }
+}
+
+static void bench_pool(){
+    static const int threads[] = { 1, 2, 4, 8, 16 };
+    handoff_task* tasks = new handoff_task[POOL_SLOTS];
+    histogram* latency = new histogram();
+    for(size_t t = 0; t < sizeof(threads) / sizeof(threads[0]); t++){
+        //工作线程是线程池创建的，每个线程池的线程第一次执行任务时登记自己的直方图
+        threadpool<handoff_task>* pool = new threadpool<handoff_task>(threads[t], 10000, OVERFLOW_PAUSE);
+        if(selected("pool/handoff")){
+            //一次只有一个任务在途：工作线程通常已经睡眠，测的是唤醒的延迟
+            bench_result& r = new_result("pool/handoff", "ns/task", "\"threads\": %lld", threads[t]);
+            for(int rep = 0; rep < g_repeat; rep++){
+                g_done = 0;
+                collect_latency(*latency);
+                for(long i = 0; i < PING_TASKS; i++){
+                    tasks[0].m_sent = get_ns_time();
+                    pool->append(&tasks[0]);
+                    while(g_done.load(std::memory_order_acquire) <= i){
+                    }
+                }
+                collect_latency(*latency);
+                r.m_samples.push_back(quantile(*latency, 0.5));
+                set_metric(r, "p99_ns", quantile(*latency, 0.99));
+            }
+        }
+        if(selected("pool/throughput")){
+            //生产者像reactor一样不停地提交，在途任务达到上限时等待
+            bench_result& r = new_result("pool/throughput", "tasks/s", "\"threads\": %lld", threads[t]);
+            for(int rep = 0; rep < g_repeat; rep++){
+                g_done = 0;
+                collect_latency(*latency);
+                long long begin = get_ns_time();
+                for(long i = 0; i < POOL_TASKS; i++){
+                    while(i - g_done.load(std::memory_order_relaxed) >= POOL_INFLIGHT){
+                        sched_yield();
+                    }
+                    handoff_task* task = &tasks[i % POOL_SLOTS];
+                    task->m_sent = get_ns_time();
+                    while(pool->append(task) != APPEND_OK){
+                        sched_yield();
+                    }
+                }
+                while(g_done.load() < POOL_TASKS){
+                    sched_yield();
+                }
+                long long elapsed = get_ns_time() - begin;
+                collect_latency(*latency);
+                r.m_samples.push_back(POOL_TASKS * 1e9 / elapsed);
+                set_metric(r, "queue_p50_ns", quantile(*latency, 0.5));
+                set_metric(r, "queue_p99_ns", quantile(*latency, 0.99));
+            }
+        }
+        delete pool;
+    }
+    delete latency;
+    delete []tasks;
+}
+
+/* ---------------------------------- 输出 ---------------------------------- */
+
+static void print_json(){
+    char host[256] = "unknown";
+    gethostname(host, sizeof(host) - 1);
+    printf("{\n  \"host\": \"%s\",\n  \"cpus\": %ld,\n  \"repeat\": %d,\n  \"results\": [\n",
+           host, sysconf(_SC_NPROCESSORS_ONLN), g_repeat);
+    for(size_t i = 0; i < g_results.size(); i++){
+        bench_result& r = g_results[i];
+        std::vector<double> sorted = r.m_samples;
+        std::sort(sorted.begin(), sorted.end());
+        double median = 0, lo = 0, hi = 0;
+        if(!sorted.empty()){
+            median = sorted[sorted.size() / 2];
+            lo = sorted.front();
+            hi = sorted.back();
+        }
+        printf("    {\"name\": \"%s\", \"params\": {%s}, \"unit\": \"%s\", \"median\": %.2f, \"min\": %.2f, \"max\": %.2f",
+               r.m_name.c_str(), r.m_params.c_str(), r.m_unit, median, lo, hi);
+        for(int m = 0; m < r.m_metric_count; m++){
+            printf(", \"%s\": %.2f", r.m_metric_names[m], r.m_metrics[m]);
+        }
+        printf("}%s\n", i + 1 < g_results.size() ? "," : "");
+    }
+    printf("  ]\n}\n");
+}
+
+int main(int argc, char* argv[]){
+    const char* root = "../resources";
+    int opt;
+    while((opt = getopt(argc, argv, "n:f:R:")) != -1){
+        switch(opt){
+            case 'n':
+                g_repeat = atoi(optarg) > 0 ? atoi(optarg) : 1;
+                break;
+            case 'f':
+                g_filter = optarg;
+                break;
+            case 'R':
+                root = optarg;
+                break;
+            default:
+                fprintf(stderr, "按照如下格式运行： %s [-n 重复次数] [-f 名字中包含的字符串] [-R 网站根目录]\n", argv[0]);
+                return 1;
+        }
+    }
+    //服务器代码中的日志写到标准错误，不混进JSON
+    logger::init("/dev/stderr", LOG_LEVEL_WARN);
+
+    bench_timers();
+    bench_parse(root);
+    bench_pool();
+    print_json();
+
+    logger::shutdown();
+    return 0;
+}
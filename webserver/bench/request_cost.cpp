@@ -0,0 +1,338 @@
+/*
+    测量每个请求在服务器内部的CPU开销，不经过网络。
+    用socketpair代替TCP连接，客户端一端写入准备好的请求，服务器一端的http_conn按reactor中的顺序
+    执行 read() -> process() -> write()，只统计这三步的时间(纳秒)，以及用perf_event_open统计的指令数和周期数。
+    场景：
+        cached_keepalive：保持连接，反复请求同一个小文件，响应来自热点响应缓存；
+        not_found：保持连接，请求不存在的文件，回复404；
+        cached_close：每个请求一个新连接(Connection: close)，包括初始化连接和关闭连接。
+    perf计数器不可用时(没有权限、虚拟机不支持)只输出时间，指令数为null。内核允许时指令数包含系统调用在内核中的部分，
+    否则只统计用户态，输出中的"counting"说明是哪一种。计数器在三步前后开关，开关的ioctl本身会带进来几百条指令。
+    结果以JSON输出到标准输出，和microbench的格式相同。
+
+    编译(需要服务器中除main.cpp以外的所有源文件)：
+          g++ -O2 -I.. request_cost.cpp ../buffer_pool.cpp ../compressor.cpp ../file_cache.cpp ../http_cache.cpp ../http_conn.cpp \
+              ../http_response.cpp ../log.cpp ../object_cache.cpp ../reactor.cpp ../stats.cpp ../tokenizer.cpp ../upgrade.cpp -o request_cost -pthread -lz
+    运行： ./request_cost [-n 每次重复的请求数] [-r 重复次数] [-R 网站根目录] > result.json
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <limits.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include <algorithm>
+#include <vector>
+#include "http_conn.h"
+#include "lst_timer.h"
+#include "reactor.h"    //TIMESLOT和MAX_FD，定时器的超时时间和服务器相同，走的是同一条时间轮路径
+#include "stats.h"
+#include "log.h"
+
+extern const char* doc_root;
+
+// 一组计数器：指令数为组长，周期数是组员，一起开关
+class perf_counters
+{
+public:
+    perf_counters(): m_leader(-1), m_cycles(-1), m_kernel(false){}
+    ~perf_counters(){
+        if(m_cycles != -1){
+            close(m_cycles);
+        }
+        if(m_leader != -1){
+            close(m_leader);
+        }
+    }
+
+    // 先尝试同时统计内核态，没有权限时退回只统计用户态
+    bool open(){
+        for(int user_only = 0; user_only <= 1; user_only++){
+            m_leader = open_counter(PERF_COUNT_HW_INSTRUCTIONS, user_only, -1);
+            if(m_leader == -1){
+                continue;
+            }
+            m_cycles = open_counter(PERF_COUNT_HW_CPU_CYCLES, user_only, m_leader);
+            m_kernel = !user_only;
+            return true;
+        }
+        return false;
+    }
+
+    bool available() const { return m_leader != -1; }
+    bool with_kernel() const { return m_kernel; }
+
+    void enable(){
+        if(m_leader != -1){
+            ioctl(m_leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+        }
+    }
+    void disable(){
+        if(m_leader != -1){
+            ioctl(m_leader, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+        }
+    }
+    void reset(){
+        if(m_leader != -1){
+            ioctl(m_leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+        }
+    }
+
+    // 读出累计的指令数和周期数，周期计数器没打开时为0
+    void read_values(unsigned long long& instructions, unsigned long long& cycles){
+        instructions = 0;
+        cycles = 0;
+        if(m_leader == -1){
+            return;
+        }
+        unsigned long long values[3] = { 0, 0, 0 };   //PERF_FORMAT_GROUP：个数，然后依次是各计数器的值
+        if(::read(m_leader, values, sizeof(values)) > 0){
+            instructions = values[1];
+            cycles = values[0] > 1 ? values[2] : 0;
+        }
+    }
+
+private:
+    static int open_counter(unsigned long long config, bool user_only, int group){
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = config;
+        attr.disabled = group == -1;
+        attr.exclude_hv = 1;
+        attr.exclude_kernel = user_only;
+        attr.read_format = PERF_FORMAT_GROUP;
+        return syscall(__NR_perf_event_open, &attr, 0, -1, group, 0);
+    }
+
+    int m_leader;
+    int m_cycles;
+    bool m_kernel;
+};
+
+struct scenario
+{
+    const char* m_name;
+    const char* m_request;
+    bool m_keep_alive;
+};
+
+static const scenario scenarios[] = {
+    { "cached_keepalive", "GET /index.html HTTP/1.1\r\nHost: localhost\r\nUser-Agent: request_cost\r\nAccept: */*\r\n\r\n", true },
+    { "not_found", "GET /no/such/file.html HTTP/1.1\r\nHost: localhost\r\nUser-Agent: request_cost\r\nAccept: */*\r\n\r\n", true },
+    { "cached_close", "GET /index.html HTTP/1.1\r\nHost: localhost\r\nUser-Agent: request_cost\r\nAccept: */*\r\nConnection: close\r\n\r\n", false },
+};
+
+struct cost_sample
+{
+    double m_ns;
+    double m_instructions;
+    double m_cycles;
+};
+
+static client_data* users;
+static time_wheel* timers;
+static perf_counters counters;
+
+// 建立一个socketpair，服务器一端交给conn，同时像reactor一样为它挂一个定时器
+static bool open_conn(http_conn* conn, int& sockfd, int& client){
+    int sv[2];
+    if(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, sv) == -1 || sv[0] >= MAX_FD){
+        return false;
+    }
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    conn->init(sv[0], addr, -1);
+    util_timer* timer = new util_timer;
+    timer->user_date = &users[sv[0]];
+    timer->cb_func = NULL;
+    timer->expire = get_ms_time() + 3 * TIMESLOT;
+    timers->add_timer(timer);
+    users[sv[0]].sockfd = sv[0];
+    users[sv[0]].timer = timer;
+    users[sv[0]].conn = conn;
+    sockfd = sv[0];
+    client = sv[1];
+    return true;
+}
+
+static void close_conn(http_conn* conn, int sockfd){
+    if(users[sockfd].timer){
+        timers->del_timer(users[sockfd].timer);
+        users[sockfd].timer = NULL;
+    }
+    conn->close_conn();
+}
+
+// 读走客户端一端收到的全部响应，返回字节数
+static long drain(int client){
+    static char buf[65536];
+    long total = 0;
+    int n;
+    while((n = recv(client, buf, sizeof(buf), 0)) > 0){
+        total += n;
+    }
+    return total;
+}
+
+// 处理一个请求的三步：读、解析并生成响应、写。返回连接是否保持
+static bool serve(http_conn* conn, int sockfd){
+    if(!conn->read(users, sockfd, *timers, TIMESLOT)){
+        return false;
+    }
+    if(!conn->process()){
+        return true;
+    }
+    return conn->write();
+}
+
+// 处理requests个请求，返回平均每个请求的开销
+static bool run_scenario(const scenario& sc, long requests, cost_sample& result){
+    http_conn* conn = new http_conn;
+    int len = strlen(sc.m_request);
+    int client = -1;
+    int sockfd = -1;
+    long long ns = 0;
+    long bytes = 0;
+    bool ok = true;
+    counters.reset();
+    for(long i = 0; i < requests && ok; i++){
+        if(client == -1){
+            if(!open_conn(conn, sockfd, client)){
+                ok = false;
+                break;
+            }
+        }
+        if(send(client, sc.m_request, len, 0) != len){
+            ok = false;
+            break;
+        }
+        counters.enable();
+        long long begin = get_ns_time();
+        bool keep = serve(conn, sockfd);
+        if(!keep){
+            close_conn(conn, sockfd);
+        }
+        ns += get_ns_time() - begin;
+        counters.disable();
+        long n = drain(client);
+        if(n <= 0){
+            fprintf(stderr, "%s: 第%ld个请求没有收到响应\n", sc.m_name, i);
+            ok = false;
+        }
+        bytes += n;
+        if(!keep){
+            users[sockfd].conn = NULL;
+            close(client);
+            client = -1;
+        }
+    }
+    if(client != -1){
+        close_conn(conn, sockfd);
+        users[sockfd].conn = NULL;
+        close(client);
+    }
+    delete conn;
+    if(!ok){
+        return false;
+    }
+    unsigned long long instructions, cycles;
+    counters.read_values(instructions, cycles);
+    result.m_ns = (double)ns / requests;
+    result.m_instructions = (double)instructions / requests;
+    result.m_cycles = (double)cycles / requests;
+    fprintf(stderr, "%s: %.0f ns", sc.m_name, result.m_ns);
+    if(counters.available()){
+        fprintf(stderr, ", %.0f instructions", result.m_instructions);
+    }
+    fprintf(stderr, ", %ld response bytes per request\n", bytes / requests);
+    return true;
+}
+
+static bool by_ns(const cost_sample& a, const cost_sample& b){
+    return a.m_ns < b.m_ns;
+}
+
+int main(int argc, char* argv[]){
+    long requests = 100000;
+    int repeat = 5;
+    const char* root = "../resources";
+    int opt;
+    while((opt = getopt(argc, argv, "n:r:R:")) != -1){
+        switch(opt){
+            case 'n':
+                requests = atol(optarg) > 0 ? atol(optarg) : 1;
+                break;
+            case 'r':
+                repeat = atoi(optarg) > 0 ? atoi(optarg) : 1;
+                break;
+            case 'R':
+                root = optarg;
+                break;
+            default:
+                fprintf(stderr, "按照如下格式运行： %s [-n 每次重复的请求数] [-r 重复次数] [-R 网站根目录]\n", argv[0]);
+                return 1;
+        }
+    }
+    char path[PATH_MAX];
+    if(!realpath(root, path)){
+        fprintf(stderr, "找不到网站根目录：%s\n", root);
+        return 1;
+    }
+    logger::init("/dev/stderr", LOG_LEVEL_WARN);
+    doc_root = path;
+    http_conn::m_file_cache.init(doc_root);
+    http_conn::m_object_cache.init(64LL * 1024 * 1024);
+    http_conn::m_compressor.init(0);
+    http_conn::m_max_requests = 0;
+    users = new client_data[MAX_FD];
+    memset(users, 0, sizeof(client_data) * MAX_FD);
+    timers = new time_wheel;
+    if(!counters.open()){
+        fprintf(stderr, "perf_event_open不可用(%s)，只统计时间\n", strerror(errno));
+    }
+
+    int count = sizeof(scenarios) / sizeof(scenarios[0]);
+    std::vector< std::vector<cost_sample> > results(count);
+    for(int i = 0; i < count; i++){
+        //先跑一遍填充文件缓存和热点响应缓存
+        cost_sample warm;
+        if(!run_scenario(scenarios[i], requests / 10 + 1, warm)){
+            return 1;
+        }
+        for(int rep = 0; rep < repeat; rep++){
+            cost_sample s;
+            if(!run_scenario(scenarios[i], requests, s)){
+                return 1;
+            }
+            results[i].push_back(s);
+        }
+    }
+
+    //每个场景取耗时的中位数那一次，连同它的指令数和周期数
+    printf("{\n  \"requests\": %ld,\n  \"repeat\": %d,\n  \"counting\": \"%s\",\n  \"results\": [\n", requests, repeat,
+           !counters.available() ? "none" : counters.with_kernel() ? "user+kernel" : "user");
+    for(int i = 0; i < count; i++){
+        std::vector<cost_sample>& v = results[i];
+        std::sort(v.begin(), v.end(), by_ns);
+        const cost_sample& median = v[v.size() / 2];
+        printf("    {\"name\": \"request/%s\", \"unit\": \"ns/request\", \"median\": %.2f, \"min\": %.2f, \"max\": %.2f",
+               scenarios[i].m_name, median.m_ns, v.front().m_ns, v.back().m_ns);
+        if(counters.available()){
+            printf(", \"instructions\": %.1f, \"cycles\": %.1f", median.m_instructions, median.m_cycles);
+        }else{
+            printf(", \"instructions\": null, \"cycles\": null");
+        }
+        printf("}%s\n", i + 1 < count ? "," : "");
+    }
+    printf("  ]\n}\n");
+
+    delete timers;
+    logger::shutdown();
+    return 0;
+}
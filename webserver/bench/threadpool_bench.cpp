@@ -0,0 +1,194 @@
+/*
+    线程池吞吐量对比测试：同样的任务分别交给原来的 std::list + 单把锁的线程池(list_threadpool)
+    和现在的工作窃取线程池(threadpool)，线程数从1增加到64，输出每秒完成的任务数。
+    生产者线程模拟reactor，不停调用append()，同时限制在途任务数，避免超过队列上限。
+
+    编译： g++ -O2 -I.. threadpool_bench.cpp ../stats.cpp -o threadpool_bench -pthread
+    运行： ./threadpool_bench [任务数] [每个任务的计算量] [生产者数]
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+#include <list>
+#include <atomic>
+#include "threadpool.h"
+
+// 原来的线程池：所有线程共享一个 std::list 队列，由一把互斥锁和一个信号量保护。
+// 只增加了可以等待线程退出的析构函数，方便在一个进程里重复创建
+template <typename T>
+class list_threadpool
+{
+public:
+    list_threadpool(int thread_number, int max_requests):
+        m_thread_number(thread_number), m_max_requests(max_requests), m_stop(false){
+        m_threads = new pthread_t[m_thread_number];
+        for(int i = 0; i < m_thread_number; i++){
+            pthread_create(m_threads + i, NULL, worker, this);
+        }
+    }
+
+    ~list_threadpool(){
+        m_stop = true;
+        for(int i = 0; i < m_thread_number; i++){
+            m_queuestat.post();
+        }
+        for(int i = 0; i < m_thread_number; i++){
+            pthread_join(m_threads[i], NULL);
+        }
+        delete []m_threads;
+    }
+
+    bool append(T* request){
+        m_queuelocker.lock();
+        if((int)m_workqueue.size() > m_max_requests){
+            m_queuelocker.unlock();
+            return false;
+        }
+        m_workqueue.push_back(request);
+        m_queuestat.post();
+        m_queuelocker.unlock();
+        return true;
+    }
+
+private:
+    static void * worker(void * arg){
+        ((list_threadpool *)arg)->run();
+        return arg;
+    }
+
+    void run(){
+        while(!m_stop){
+            m_queuestat.wait();
+            m_queuelocker.lock();
+            if(m_workqueue.empty()){
+                m_queuelocker.unlock();
+                continue;
+            }
+            T* request = m_workqueue.front();
+            m_workqueue.pop_front();
+            m_queuelocker.unlock();
+            if(!request){
+                continue;
+            }
+            request->process();
+        }
+    }
+
+private:
+    int m_thread_number;
+    pthread_t * m_threads;
+    int m_max_requests;
+    std::list<T*> m_workqueue;
+    locker m_queuelocker;
+    sem m_queuestat;
+    std::atomic<bool> m_stop;
+};
+
+#define MAX_REQUESTS 10000
+#define MAX_INFLIGHT 4096   // 生产者允许的在途任务数
+
+static std::atomic<long> g_done(0);
+static int g_work = 200;
+
+struct bench_task
+{
+    unsigned m_value;
+    void process(){
+        //模拟解析请求的计算量
+        unsigned x = m_value;
+        for(int i = 0; i < g_work; i++){
+            x = x * 1103515245u + 12345u;
+        }
+        m_value = x;
+        g_done.fetch_add(1, std::memory_order_relaxed);
+    }
+    //测试中不开启按排队延迟丢弃，线程池要求任务有这个接口
+    void shed(){
+        g_done.fetch_add(1, std::memory_order_relaxed);
+    }
+};
+
+static double now_sec(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+template <typename POOL>
+struct producer_arg
+{
+    POOL* m_pool;
+    bench_task* m_tasks;
+    long m_count;
+    std::atomic<long>* m_sent;
+};
+
+//两个线程池append()的返回值不同，统一成是否已加入队列
+static bool appended(bool ret){ return ret; }
+static bool appended(APPEND_RESULT ret){ return ret == APPEND_OK; }
+
+template <typename POOL>
+static void* producer(void* arg){
+    producer_arg<POOL>* parg = (producer_arg<POOL>*)arg;
+    for(long i = 0; i < parg->m_count; i++){
+        //在途任务太多时等待工作线程消化
+        while(parg->m_sent->load(std::memory_order_relaxed) - g_done.load(std::memory_order_relaxed) >= MAX_INFLIGHT){
+            sched_yield();
+        }
+        parg->m_sent->fetch_add(1, std::memory_order_relaxed);
+        while(!appended(parg->m_pool->append(&parg->m_tasks[i % 1024]))){
+            sched_yield();
+        }
+    }
+    return NULL;
+}
+
+//返回每秒完成的任务数
+template <typename POOL>
+static double run_once(int threads, int producers, long tasks){
+    POOL* pool = new POOL(threads, MAX_REQUESTS);
+    bench_task* task_buf = new bench_task[1024 * producers];
+    std::atomic<long> sent(0);
+    g_done = 0;
+
+    pthread_t* tids = new pthread_t[producers];
+    producer_arg<POOL>* args = new producer_arg<POOL>[producers];
+    double start = now_sec();
+    for(int i = 0; i < producers; i++){
+        args[i].m_pool = pool;
+        args[i].m_tasks = task_buf + 1024 * i;
+        args[i].m_count = tasks / producers;
+        args[i].m_sent = &sent;
+        pthread_create(tids + i, NULL, producer<POOL>, args + i);
+    }
+    for(int i = 0; i < producers; i++){
+        pthread_join(tids[i], NULL);
+    }
+    long total = (tasks / producers) * producers;
+    while(g_done.load() < total){
+        sched_yield();
+    }
+    double elapsed = now_sec() - start;
+
+    delete pool;
+    delete []args;
+    delete []tids;
+    delete []task_buf;
+    return total / elapsed;
+}
+
+int main(int argc, char* argv[]){
+    long tasks = argc > 1 ? atol(argv[1]) : 2000000;
+    g_work = argc > 2 ? atoi(argv[2]) : 200;
+    int producers = argc > 3 ? atoi(argv[3]) : 1;
+
+    printf("tasks=%ld work=%d producers=%d\n", tasks, g_work, producers);
+    printf("%8s %16s %16s %8s\n", "threads", "list(ops/s)", "stealing(ops/s)", "speedup");
+    for(int threads = 1; threads <= 64; threads *= 2){
+        double legacy = run_once< list_threadpool<bench_task> >(threads, producers, tasks);
+        double stealing = run_once< threadpool<bench_task> >(threads, producers, tasks);
+        printf("%8d %16.0f %16.0f %8.2f\n", threads, legacy, stealing, stealing / legacy);
+    }
+    return 0;
+}
@@ -0,0 +1,50 @@
+#include <stdlib.h>
+#include "buffer_pool.h"
+
+buffer_pool::buffer_pool(){
+    for(int i = 0; i < CLASSES; i++){
+        m_free[i] = new mpmc_queue<char*>(CACHE_BYTES / (MIN_SIZE << i));
+    }
+}
+
+buffer_pool::~buffer_pool(){
+    for(int i = 0; i < CLASSES; i++){
+        char* buf;
+        while(m_free[i]->pop(buf)){
+            free(buf);
+        }
+        delete m_free[i];
+    }
+}
+
+int buffer_pool::class_of(int size){
+    int cls = 0;
+    while(cls < CLASSES && (MIN_SIZE << cls) < size){
+        cls++;
+    }
+    return cls < CLASSES ? cls : -1;
+}
+
+char* buffer_pool::acquire(int size, int& cap){
+    int cls = class_of(size);
+    if(cls < 0){
+        return NULL;
+    }
+    cap = MIN_SIZE << cls;
+    char* buf;
+    if(m_free[cls]->pop(buf)){
+        return buf;
+    }
+    return (char*)malloc(cap);
+}
+
+void buffer_pool::release(char* buf, int cap){
+    if(!buf){
+        return;
+    }
+    int cls = class_of(cap);
+    if(cls < 0 || !m_free[cls]->push(buf)){
+        //缓存的空闲缓冲区已经够多了
+        free(buf);
+    }
+}
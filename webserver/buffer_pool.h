@@ -0,0 +1,38 @@
+#ifndef BUFFER_POOL_H
+#define BUFFER_POOL_H
+
+#include "mpmc_queue.h"
+
+/*
+    所有线程共享的I/O缓冲区池。缓冲区按大小分成几级，从MIN_SIZE开始每级翻一倍，直到MAX_SIZE。
+    连接只在有请求正在处理时才持有缓冲区，空闲的keep-alive连接把缓冲区还回来，
+    所以占用的内存随正在处理的请求数变化，而不是随连接数或最大文件描述符数变化。
+    每一级的空闲缓冲区放在一个无锁队列中，reactor线程和工作线程都可以直接取用和归还；
+    队列满时多余的缓冲区直接还给系统，每一级缓存的空闲缓冲区最多占用CACHE_BYTES字节。
+*/
+class buffer_pool
+{
+public:
+    buffer_pool();
+    ~buffer_pool();
+
+    //取一个至少size字节的缓冲区，实际大小由cap返回。size超过MAX_SIZE或内存不足时返回NULL
+    char* acquire(int size, int& cap);
+
+    //归还acquire()得到的缓冲区，cap是当时返回的大小
+    void release(char* buf, int cap);
+
+    static const int MIN_SIZE = 1024;
+    static const int MAX_SIZE = 64 * 1024;
+    static const int CACHE_BYTES = 4 * 1024 * 1024;
+
+private:
+    static const int CLASSES = 7;   //1K、2K、...、64K
+
+    static int class_of(int size);  //能放下size字节的最小一级，放不下返回-1
+
+private:
+    mpmc_queue<char*>* m_free[CLASSES];
+};
+
+#endif
@@ -0,0 +1,87 @@
+#ifndef CODEL_H
+#define CODEL_H
+
+#include <math.h>
+
+/*
+    按排队延迟丢弃请求的CoDel算法(RFC 8289)，用在线程池的请求队列上。
+    队列长短不说明问题，请求在队列中等待的时间(sojourn)才说明服务器是不是过载了：
+    如果在一个interval内，取出的请求的等待时间一直没有低于target，就进入丢弃状态，丢掉一个请求；
+    之后每隔 interval / sqrt(丢弃次数) 再丢一个，丢得越来越快，直到等待时间回到target以下。
+    短暂的突发会在一个interval内被消化，不会触发丢弃；持续的过载则很快把队列延迟压回target附近。
+    每个工作线程有自己的一份状态，只在本线程中使用，不需要同步。时间单位都是纳秒。
+*/
+class codel
+{
+public:
+    codel(): m_target(0), m_interval(0), m_first_above(0), m_drop_next(0), m_count(0), m_last_count(0), m_dropping(false){}
+
+    //target为0表示不丢弃
+    void init(long long target, long long interval){
+        m_target = target;
+        m_interval = interval;
+    }
+
+    bool enabled() const { return m_target > 0; }
+
+    //取出一个在队列中等了sojourn的请求，返回是否应该丢弃它。backlog表示队列中还有没有其他请求，队列空了说明已经消化完，不丢弃
+    bool should_drop(long long now, long long sojourn, bool backlog){
+        bool ok_to_drop = above(now, sojourn, backlog);
+        if(m_dropping){
+            if(!ok_to_drop){
+                //等待时间回到target以下，退出丢弃状态
+                m_dropping = false;
+                return false;
+            }
+            if(now >= m_drop_next){
+                m_count++;
+                m_drop_next = control_law(m_drop_next);
+                return true;
+            }
+            return false;
+        }
+        if(!ok_to_drop){
+            return false;
+        }
+        //进入丢弃状态。如果刚退出不久，说明过载还在持续，从上次的丢弃频率附近继续
+        m_dropping = true;
+        int delta = m_count - m_last_count;
+        if(delta > 1 && now - m_drop_next < 16 * m_interval){
+            m_count = delta;
+        }else{
+            m_count = 1;
+        }
+        m_last_count = m_count;
+        m_drop_next = control_law(now);
+        return true;
+    }
+
+private:
+    //等待时间是否已经持续超过target一个interval
+    bool above(long long now, long long sojourn, bool backlog){
+        if(sojourn < m_target || !backlog){
+            m_first_above = 0;
+            return false;
+        }
+        if(m_first_above == 0){
+            m_first_above = now + m_interval;
+            return false;
+        }
+        return now >= m_first_above;
+    }
+
+    long long control_law(long long t) const{
+        return t + (long long)(m_interval / sqrt((double)m_count));
+    }
+
+private:
+    long long m_target;
+    long long m_interval;
+    long long m_first_above;    //等待时间第一次超过target以后再过一个interval的时间，0表示没有超过
+    long long m_drop_next;      //丢弃状态下下一次丢弃的时间
+    int m_count;                //本次丢弃状态中丢弃的个数
+    int m_last_count;
+    bool m_dropping;
+};
+
+#endif
@@ -0,0 +1,305 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <new>
+#include <zlib.h>
+#ifdef USE_BROTLI
+#include <brotli/encode.h>
+#endif
+#include "compressor.h"
+
+#define GZIP_LEVEL 9        //压缩结果会被缓存下来反复使用，所以用较高的压缩级别
+#define BROTLI_QUALITY 9    //11太慢，9的压缩率已经明显好于gzip
+
+compressor::compressor(): m_enabled(false), m_stop(false), m_head(NULL), m_tail(NULL), m_bytes(0), m_budget(0){
+}
+
+compressor::~compressor(){
+    if(m_enabled){
+        m_lock.lock();
+        m_stop = true;
+        m_cond.signal(m_lock.get());
+        m_lock.unlock();
+        pthread_join(m_thread, NULL);
+    }
+    for(size_t i = 0; i < m_jobs.size(); i++){
+        file_cache::release(m_jobs[i].m_file);
+    }
+    while(m_head){
+        evict(m_head);
+    }
+}
+
+bool compressor::init(long long budget){
+    if(budget <= 0){
+        return false;
+    }
+    m_budget = budget;
+    if(pthread_create(&m_thread, NULL, worker, this) != 0){
+        return false;
+    }
+    m_enabled = true;
+    return true;
+}
+
+const char* compressor::encoding_name(CONTENT_ENCODING encoding){
+    switch(encoding){
+        case ENCODING_GZIP:
+            return "gzip";
+        case ENCODING_BR:
+            return "br";
+        default:
+            return "identity";
+    }
+}
+
+CONTENT_ENCODING compressor::preferred(int accepted){
+#ifdef USE_BROTLI
+    if(accepted & ACCEPT_BR){
+        return ENCODING_BR;
+    }
+#endif
+    if(accepted & ACCEPT_GZIP){
+        return ENCODING_GZIP;
+    }
+    return ENCODING_IDENTITY;
+}
+
+std::string compressor::make_key(const char* url, CONTENT_ENCODING encoding){
+    std::string key(url);
+    key += '\n';
+    key += encoding_name(encoding);
+    return key;
+}
+
+void compressor::unlink(object_entry* entry){
+    if(entry->m_prev){
+        entry->m_prev->m_next = entry->m_next;
+    }else{
+        m_head = entry->m_next;
+    }
+    if(entry->m_next){
+        entry->m_next->m_prev = entry->m_prev;
+    }else{
+        m_tail = entry->m_prev;
+    }
+    entry->m_prev = entry->m_next = NULL;
+}
+
+//从压缩缓存中删除，正在发送它的响应还持有引用
+void compressor::evict(object_entry* entry){
+    unlink(entry);
+    m_bytes -= entry->m_len;
+    m_entries.erase(entry->m_key);
+    object_cache::release(entry);
+}
+
+object_entry* compressor::acquire(const char* url, int accepted, CONTENT_ENCODING& encoding){
+    if(!m_enabled){
+        return NULL;
+    }
+    //brotli优先，其次gzip
+    static const CONTENT_ENCODING order[2] = { ENCODING_BR, ENCODING_GZIP };
+    static const int masks[2] = { ACCEPT_BR, ACCEPT_GZIP };
+    object_entry* result = NULL;
+    m_lock.lock();
+    for(int i = 0; i < 2 && !result; i++){
+        if(!(accepted & masks[i])){
+            continue;
+        }
+        std::unordered_map<std::string, object_entry*>::iterator it = m_entries.find(make_key(url, order[i]));
+        if(it == m_entries.end()){
+            continue;
+        }
+        object_entry* entry = it->second;
+        if(!entry->m_file->m_valid){
+            //原始文件已经变了
+            evict(entry);
+            continue;
+        }
+        if(!entry->m_data){
+            //压缩后没有变小
+            continue;
+        }
+        //移到LRU链表的头部
+        unlink(entry);
+        entry->m_next = m_head;
+        if(m_head){
+            m_head->m_prev = entry;
+        }else{
+            m_tail = entry;
+        }
+        m_head = entry;
+        entry->m_ref++;
+        encoding = order[i];
+        result = entry;
+    }
+    m_lock.unlock();
+    return result;
+}
+
+void compressor::submit(const char* url, file_entry* file, int accepted){
+    CONTENT_ENCODING encoding = preferred(accepted);
+    if(!m_enabled || encoding == ENCODING_IDENTITY || !file->m_valid
+        || file->m_stat.st_size < MIN_SIZE || file->m_stat.st_size > MAX_SIZE){
+        return;
+    }
+    std::string key = make_key(url, encoding);
+    m_lock.lock();
+    std::unordered_map<std::string, object_entry*>::iterator it = m_entries.find(key);
+    bool known = it != m_entries.end() && it->second->m_file->m_valid;
+    if(known || m_pending.count(key) || (int)m_jobs.size() >= MAX_PENDING){
+        m_lock.unlock();
+        return;
+    }
+    job j;
+    j.m_key = key;
+    j.m_file = file;
+    j.m_encoding = encoding;
+    file->m_ref++;
+    m_jobs.push_back(j);
+    m_pending.insert(key);
+    m_cond.signal(m_lock.get());
+    m_lock.unlock();
+}
+
+void* compressor::worker(void* arg){
+    compressor* c = (compressor*)arg;
+    c->run();
+    return c;
+}
+
+void compressor::run(){
+    m_lock.lock();
+    while(!m_stop){
+        if(m_jobs.empty()){
+            m_cond.wait(m_lock.get());
+            continue;
+        }
+        job j = m_jobs.front();
+        m_jobs.pop_front();
+        m_lock.unlock();
+
+        //大文件在文件缓存中没有映射，先读到内存中
+        file_entry* file = j.m_file;
+        long long len = file->m_stat.st_size;
+        const char* data = file->m_addr;
+        char* copy = NULL;
+        if(!data && file->m_fd != -1){
+            copy = (char*)malloc(len);
+            if(copy && pread(file->m_fd, copy, len, 0) == len){
+                data = copy;
+            }
+        }
+        char* out = NULL;
+        long long out_len = 0;
+        bool ok = data && compress(data, len, j.m_encoding, out, out_len);
+        free(copy);
+        if(ok && out_len >= len){
+            //压缩后没有变小，只记录下来，以后不再压缩
+            free(out);
+            out = NULL;
+            out_len = 0;
+        }
+
+        m_lock.lock();
+        m_pending.erase(j.m_key);
+        if(ok && file->m_valid){
+            store(j.m_key, file, out, out_len);
+        }else{
+            free(out);
+            file_cache::release(file);
+        }
+    }
+    m_lock.unlock();
+}
+
+//在持有锁的情况下调用，file的引用转交给缓存的对象
+void compressor::store(const std::string& key, file_entry* file, char* data, long long len){
+    if(len > m_budget){
+        free(data);
+        file_cache::release(file);
+        return;
+    }
+    std::unordered_map<std::string, object_entry*>::iterator it = m_entries.find(key);
+    if(it != m_entries.end()){
+        evict(it->second);
+    }
+    object_entry* entry = new (std::nothrow) object_entry;
+    if(!entry){
+        free(data);
+        file_cache::release(file);
+        return;
+    }
+    entry->m_ref = 1;
+    entry->m_key = key;
+    entry->m_hash = 0;
+    entry->m_file = file;
+    entry->m_data = data;
+    entry->m_len = len;
+    entry->m_header_len = 0;
+    entry->m_segment = SEG_NONE;
+    entry->m_prev = NULL;
+    entry->m_next = m_head;
+    if(m_head){
+        m_head->m_prev = entry;
+    }else{
+        m_tail = entry;
+    }
+    m_head = entry;
+    m_entries[key] = entry;
+    m_bytes += len;
+    //超出预算，淘汰最久没用的压缩结果
+    while(m_bytes > m_budget && m_tail != entry){
+        evict(m_tail);
+    }
+}
+
+bool compressor::compress(const char* data, long long len, CONTENT_ENCODING encoding, char*& out, long long& out_len){
+    if(encoding == ENCODING_GZIP){
+        z_stream zs;
+        memset(&zs, 0, sizeof(zs));
+        //windowBits加16表示输出gzip格式，而不是zlib格式
+        if(deflateInit2(&zs, GZIP_LEVEL, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK){
+            return false;
+        }
+        uLong bound = deflateBound(&zs, len);
+        out = (char*)malloc(bound);
+        if(!out){
+            deflateEnd(&zs);
+            return false;
+        }
+        zs.next_in = (Bytef*)data;
+        zs.avail_in = len;
+        zs.next_out = (Bytef*)out;
+        zs.avail_out = bound;
+        int ret = deflate(&zs, Z_FINISH);
+        out_len = zs.total_out;
+        deflateEnd(&zs);
+        if(ret != Z_STREAM_END){
+            free(out);
+            out = NULL;
+            return false;
+        }
+        return true;
+    }
+#ifdef USE_BROTLI
+    if(encoding == ENCODING_BR){
+        size_t size = BrotliEncoderMaxCompressedSize(len);
+        out = (char*)malloc(size);
+        if(!out){
+            return false;
+        }
+        if(!BrotliEncoderCompress(BROTLI_QUALITY, BROTLI_DEFAULT_WINDOW, BROTLI_MODE_TEXT,
+            len, (const uint8_t*)data, &size, (uint8_t*)out)){
+            free(out);
+            out = NULL;
+            return false;
+        }
+        out_len = size;
+        return true;
+    }
+#endif
+    return false;
+}
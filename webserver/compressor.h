@@ -0,0 +1,87 @@
+#ifndef COMPRESSOR_H
+#define COMPRESSOR_H
+
+#include <pthread.h>
+#include <deque>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include "locker.h"
+#include "file_cache.h"
+#include "object_cache.h"
+
+/*
+    编译时需要链接zlib：g++ *.cpp -o server -pthread -lz
+    定义USE_BROTLI并链接libbrotlienc后，动态压缩也可以生成brotli：g++ -DUSE_BROTLI *.cpp -o server -pthread -lz -lbrotlienc
+    预先压缩好的.br文件不依赖这个选项，总是可以直接发送。
+*/
+
+// 客户端可以接受的编码，Accept-Encoding解析后的位掩码
+#define ACCEPT_GZIP 1
+#define ACCEPT_BR 2
+
+// 响应使用的编码
+enum CONTENT_ENCODING { ENCODING_IDENTITY = 0, ENCODING_GZIP, ENCODING_BR };
+
+/*
+    动态压缩。没有预先压缩好的.gz/.br文件时，请求只是提交一个压缩任务，本次仍然发送原始内容，
+    后台线程压缩完成后把结果放入压缩缓存，之后的请求直接发送压缩后的内容。
+    压缩只在后台线程中进行，不会占用reactor线程或处理请求的工作线程。
+    压缩缓存按字节数限制大小，超出时淘汰最久没用的压缩结果；每个压缩结果引用原始文件在文件缓存中的条目，
+    文件变化后条目失效，压缩结果随之作废。压缩后没有变小的文件也会记录下来，不再重复压缩。
+*/
+class compressor
+{
+public:
+    compressor();
+    ~compressor();
+
+    //设置压缩缓存的大小(字节)并启动后台线程，0表示不做动态压缩
+    bool init(long long budget);
+
+    //查找url按accepted中最合适的编码压缩好的内容，命中时返回加了一个引用的对象(只有内容，没有响应头)，encoding返回使用的编码
+    object_entry* acquire(const char* url, int accepted, CONTENT_ENCODING& encoding);
+
+    //为file提交一个压缩任务，相同的任务已经在队列中或者已经有结果时什么也不做
+    void submit(const char* url, file_entry* file, int accepted);
+
+    static const char* encoding_name(CONTENT_ENCODING encoding);
+
+    static const long long MIN_SIZE = 256;                  //太小的文件压缩后省不了多少，不压缩
+    static const long long MAX_SIZE = 8 * 1024 * 1024;      //太大的文件在内存中压缩代价太高，不压缩
+    static const int MAX_PENDING = 1024;                    //排队的压缩任务的上限，超过时丢弃新任务
+
+private:
+    struct job
+    {
+        std::string m_key;
+        file_entry* m_file;
+        CONTENT_ENCODING m_encoding;
+    };
+
+    static CONTENT_ENCODING preferred(int accepted);    //accepted中动态压缩能生成的最好的编码
+    static std::string make_key(const char* url, CONTENT_ENCODING encoding);
+    static void* worker(void* arg);
+    void run();
+    bool compress(const char* data, long long len, CONTENT_ENCODING encoding, char*& out, long long& out_len);
+    void store(const std::string& key, file_entry* file, char* data, long long len);
+    void unlink(object_entry* entry);
+    void evict(object_entry* entry);
+
+private:
+    bool m_enabled;
+    bool m_stop;
+    pthread_t m_thread;
+
+    locker m_lock;              //保护下面所有的成员
+    cond m_cond;
+    std::deque<job> m_jobs;
+    std::unordered_map<std::string, object_entry*> m_entries;  //压缩结果，m_data为NULL表示压缩后没有变小
+    std::unordered_set<std::string> m_pending;                  //已经在队列中的任务
+    object_entry* m_head;       //LRU链表，最近使用的在前面
+    object_entry* m_tail;
+    long long m_bytes;
+    long long m_budget;
+};
+
+#endif
@@ -0,0 +1,377 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <new>
+#include <dirent.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/inotify.h>
+#include <sys/eventfd.h>
+#include "file_cache.h"
+#include "log.h"
+
+// 小文件mmap之后和响应头一起writev只需要一次系统调用；大文件mmap的代价(建立和撤销映射、
+// 多线程下的TLB shootdown、占用地址空间)随文件变大，改为从文件描述符直接sendfile
+long long file_cache::m_map_limit = 64 * 1024;
+
+//会让缓存的内容过时的事件
+#define WATCH_MASK (IN_CLOSE_WRITE | IN_MODIFY | IN_ATTRIB | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO \
+    | IN_DELETE_SELF | IN_MOVE_SELF)
+
+file_cache::file_cache(): m_inotify_fd(-1), m_stop_fd(-1), m_enabled(false){
+    m_root[0] = '\0';
+}
+
+file_cache::~file_cache(){
+    if(m_enabled){
+        uint64_t one = 1;
+        ::write(m_stop_fd, &one, sizeof(one));
+        pthread_join(m_thread, NULL);
+    }
+    if(m_inotify_fd != -1){
+        close(m_inotify_fd);
+    }
+    if(m_stop_fd != -1){
+        close(m_stop_fd);
+    }
+    clear();
+}
+
+bool file_cache::init(const char* root){
+    strncpy(m_root, root, PATH_LEN - 1);
+    m_root[PATH_LEN - 1] = '\0';
+
+    m_inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    m_stop_fd = eventfd(0, EFD_CLOEXEC);
+    if(m_inotify_fd < 0 || m_stop_fd < 0){
+        LOG_WARN("inotify is not available, errno is: %d, file cache disabled", errno);
+        return false;
+    }
+    add_watch("");
+    if(m_watches.empty()){
+        LOG_WARN("cannot watch %s, file cache disabled", m_root);
+        return false;
+    }
+    if(pthread_create(&m_thread, NULL, watcher, this) != 0){
+        return false;
+    }
+    m_enabled = true;
+    return true;
+}
+
+void file_cache::add_watch(const std::string& dir){
+    std::string path = std::string(m_root) + dir;
+    int wd = inotify_add_watch(m_inotify_fd, path.c_str(), WATCH_MASK | IN_ONLYDIR);
+    if(wd < 0){
+        return;
+    }
+    m_watches[wd] = dir;
+
+    //inotify不会递归监视，子目录要一个一个加
+    DIR* d = opendir(path.c_str());
+    if(!d){
+        return;
+    }
+    struct dirent* ent;
+    while((ent = readdir(d)) != NULL){
+        if(ent->d_type != DT_DIR || strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0){
+            continue;
+        }
+        add_watch(dir + "/" + ent->d_name);
+    }
+    closedir(d);
+}
+
+void* file_cache::watcher(void* arg){
+    file_cache* cache = (file_cache*)arg;
+    struct pollfd fds[2];
+    fds[0].fd = cache->m_inotify_fd;
+    fds[0].events = POLLIN;
+    fds[1].fd = cache->m_stop_fd;
+    fds[1].events = POLLIN;
+    while(true){
+        if(poll(fds, 2, -1) < 0){
+            if(errno == EINTR){
+                continue;
+            }
+            break;
+        }
+        if(fds[1].revents){
+            break;
+        }
+        if(fds[0].revents){
+            cache->handle_events();
+        }
+    }
+    return cache;
+}
+
+void file_cache::handle_events(){
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    while(true){
+        ssize_t len = ::read(m_inotify_fd, buf, sizeof(buf));
+        if(len <= 0){
+            return;
+        }
+        for(char* p = buf; p < buf + len; p += sizeof(struct inotify_event) + ((struct inotify_event*)p)->len){
+            struct inotify_event* ev = (struct inotify_event*)p;
+            if(ev->mask & IN_Q_OVERFLOW){
+                //丢失了事件，不知道哪些条目过时了
+                clear();
+                continue;
+            }
+            if(ev->mask & IN_IGNORED){
+                //目录被删除或移走，监视已经自动解除
+                m_watches.erase(ev->wd);
+                continue;
+            }
+            std::unordered_map<int, std::string>::iterator it = m_watches.find(ev->wd);
+            if(it == m_watches.end()){
+                continue;
+            }
+            if(ev->mask & (IN_DELETE_SELF | IN_MOVE_SELF)){
+                clear();
+                continue;
+            }
+            std::string key = it->second + "/" + (ev->len ? ev->name : "");
+            if(ev->mask & IN_ISDIR){
+                //目录变化影响它下面所有的路径(包括缓存的404)，直接清空
+                if(ev->mask & (IN_CREATE | IN_MOVED_TO)){
+                    add_watch(key);
+                }
+                clear();
+                continue;
+            }
+            invalidate(key);
+        }
+    }
+}
+
+bool file_cache::cacheable(const char* url){
+    if(url[0] != '/' || strlen(url) >= PATH_LEN){
+        return false;
+    }
+    //带有"//"、"/./"、"/../"的路径和inotify报告的路径不一致，不放入缓存
+    for(const char* p = url; *p; p++){
+        if(p[0] == '/' && (p[1] == '/' || (p[1] == '.' && (p[2] == '/' || p[2] == '\0' || (p[2] == '.' && (p[3] == '/' || p[3] == '\0')))))){
+            return false;
+        }
+    }
+    return true;
+}
+
+file_cache::shard& file_cache::shard_of(const std::string& key){
+    return m_shards[std::hash<std::string>()(key) % SHARDS];
+}
+
+file_entry* file_cache::acquire(const char* url){
+    if(!m_enabled || !cacheable(url)){
+        return resolve(url);
+    }
+    std::string key(url);
+    shard& s = shard_of(key);
+
+    s.m_lock.lock();
+    std::unordered_map<std::string, file_entry*>::iterator it = s.m_entries.find(key);
+    if(it != s.m_entries.end()){
+        file_entry* entry = it->second;
+        entry->m_ref++;
+        entry->m_referenced = true;
+        s.m_lock.unlock();
+        return entry;
+    }
+    unsigned version = s.m_version;
+    s.m_lock.unlock();
+
+    //在锁外查找文件，其他线程可能同时查找同一个url，先放入缓存的那个胜出
+    file_entry* entry = resolve(url);
+    if(!entry){
+        return NULL;
+    }
+    s.m_lock.lock();
+    it = s.m_entries.find(key);
+    if(it != s.m_entries.end()){
+        file_entry* winner = it->second;
+        winner->m_ref++;
+        winner->m_referenced = true;
+        s.m_lock.unlock();
+        release(entry);
+        return winner;
+    }
+    file_entry* victim = NULL;
+    if(s.m_version == version){
+        clock_ring& ring = ring_of(s, entry);
+        if(ring.m_size >= ring.m_cap){
+            victim = evict(s, ring);
+        }
+        //所有条目都有响应正在使用时淘汰不了，这次不放入缓存
+        if(ring.m_size < ring.m_cap){
+            entry->m_ref++;     //缓存持有的引用
+            entry->m_valid = true;
+            entry->m_key = key;
+            entry->m_referenced = false;
+            s.m_entries[key] = entry;
+            ring_insert(ring, entry);
+        }
+    }
+    s.m_lock.unlock();
+    release(victim);
+    return entry;
+}
+
+file_cache::clock_ring& file_cache::ring_of(shard& s, file_entry* entry){
+    return entry->m_status == FILE_MISSING ? s.m_missing : s.m_files;
+}
+
+void file_cache::ring_insert(clock_ring& ring, file_entry* entry){
+    if(!ring.m_hand){
+        entry->m_prev = entry;
+        entry->m_next = entry;
+        ring.m_hand = entry;
+    }else{
+        entry->m_next = ring.m_hand;
+        entry->m_prev = ring.m_hand->m_prev;
+        ring.m_hand->m_prev->m_next = entry;
+        ring.m_hand->m_prev = entry;
+    }
+    ring.m_size++;
+}
+
+void file_cache::ring_unlink(clock_ring& ring, file_entry* entry){
+    if(--ring.m_size == 0){
+        ring.m_hand = NULL;
+        return;
+    }
+    if(ring.m_hand == entry){
+        ring.m_hand = entry->m_next;
+    }
+    entry->m_prev->m_next = entry->m_next;
+    entry->m_next->m_prev = entry->m_prev;
+}
+
+// 转动时钟指针：访问位置位的条目清除访问位后跳过，有响应正在使用的条目(引用不只缓存自己的一个)也跳过。
+// 转两圈还找不到，说明所有条目都在使用中
+file_entry* file_cache::evict(shard& s, clock_ring& ring){
+    for(int i = 2 * ring.m_size; i > 0; i--){
+        file_entry* entry = ring.m_hand;
+        ring.m_hand = entry->m_next;
+        if(entry->m_referenced){
+            entry->m_referenced = false;
+            continue;
+        }
+        //只有在分片的锁内命中，或者已经持有引用，才能增加引用，所以只剩缓存的引用时不会有人在淘汰的同时拿到它
+        if(entry->m_ref > 1){
+            continue;
+        }
+        ring_unlink(ring, entry);
+        s.m_entries.erase(entry->m_key);
+        entry->m_valid = false;
+        return entry;
+    }
+    return NULL;
+}
+
+void file_cache::release(file_entry* entry){
+    if(!entry || --entry->m_ref > 0){
+        return;
+    }
+    if(entry->m_addr){
+        munmap(entry->m_addr, entry->m_stat.st_size);
+    }
+    if(entry->m_fd != -1){
+        close(entry->m_fd);
+    }
+    delete entry;
+}
+
+file_entry* file_cache::resolve(const char* url){
+    file_entry* entry = new (std::nothrow) file_entry;
+    if(!entry){
+        return NULL;
+    }
+    entry->m_ref = 1;
+    entry->m_valid = false;
+    entry->m_status = FILE_OK;
+    entry->m_fd = -1;
+    entry->m_addr = NULL;
+    entry->m_referenced = false;
+    entry->m_prev = NULL;
+    entry->m_next = NULL;
+    memset(&entry->m_stat, 0, sizeof(entry->m_stat));
+
+    // "/home/nowcoder/webserver1/resources" + "/index.html"
+    char path[PATH_LEN * 2];
+    snprintf(path, sizeof(path), "%s%s", m_root, url);
+
+    //获取文件的相关的状态信息，-1失败，0成功
+    if(stat(path, &entry->m_stat) < 0){
+        entry->m_status = FILE_MISSING;
+        return entry;
+    }
+    //判断访问权限
+    if(!(entry->m_stat.st_mode & S_IROTH)){
+        entry->m_status = FILE_FORBIDDEN;
+        return entry;
+    }
+    if(S_ISDIR(entry->m_stat.st_mode)){
+        entry->m_status = FILE_DIRECTORY;
+        return entry;
+    }
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if(fd < 0){
+        entry->m_status = FILE_MISSING;
+        return entry;
+    }
+    if(m_map_limit >= 0 && entry->m_stat.st_size >= m_map_limit){
+        entry->m_fd = fd;
+        return entry;
+    }
+    if(entry->m_stat.st_size > 0){
+        //映射建立以后文件描述符就不需要了，不让缓存的条目占用文件描述符
+        void* addr = mmap(0, entry->m_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(addr == MAP_FAILED){
+            entry->m_status = FILE_ERROR;
+        }else{
+            entry->m_addr = (char*)addr;
+        }
+    }
+    close(fd);
+    return entry;
+}
+
+void file_cache::invalidate(const std::string& key){
+    shard& s = shard_of(key);
+    file_entry* entry = NULL;
+    s.m_lock.lock();
+    s.m_version++;
+    std::unordered_map<std::string, file_entry*>::iterator it = s.m_entries.find(key);
+    if(it != s.m_entries.end()){
+        entry = it->second;
+        entry->m_valid = false;
+        ring_unlink(ring_of(s, entry), entry);
+        s.m_entries.erase(it);
+    }
+    s.m_lock.unlock();
+    release(entry);
+}
+
+void file_cache::clear(){
+    for(int i = 0; i < SHARDS; i++){
+        std::unordered_map<std::string, file_entry*> entries;
+        m_shards[i].m_lock.lock();
+        m_shards[i].m_version++;
+        entries.swap(m_shards[i].m_entries);
+        m_shards[i].m_files.m_hand = NULL;
+        m_shards[i].m_files.m_size = 0;
+        m_shards[i].m_missing.m_hand = NULL;
+        m_shards[i].m_missing.m_size = 0;
+        m_shards[i].m_lock.unlock();
+        for(std::unordered_map<std::string, file_entry*>::iterator it = entries.begin(); it != entries.end(); ++it){
+            it->second->m_valid = false;
+            release(it->second);
+        }
+    }
+}
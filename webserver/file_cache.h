@@ -0,0 +1,113 @@
+#ifndef FILE_CACHE_H
+#define FILE_CACHE_H
+
+#include <sys/stat.h>
+#include <pthread.h>
+#include <atomic>
+#include <string>
+#include <unordered_map>
+#include "locker.h"
+
+// 按URL查找文件的结果
+enum FILE_STATUS { FILE_OK = 0, FILE_MISSING, FILE_FORBIDDEN, FILE_DIRECTORY, FILE_ERROR };
+
+/*
+    缓存中的一个文件：打开的文件描述符、文件的状态信息，小文件还有一份一直保留的只读映射。
+    带引用计数，缓存本身持有一个引用，每个正在发送它的响应各持有一个引用，
+    所以文件被修改或删除、条目从缓存中失效或被淘汰以后，还没发完的响应仍然可以安全地用它，最后一个引用释放时才关闭和解除映射。
+    找不到的文件也会缓存一个状态为FILE_MISSING的条目，重复请求不存在的URL时不需要再stat。
+*/
+struct file_entry
+{
+    std::atomic<int> m_ref;
+    std::atomic<bool> m_valid;  // 条目还在缓存中，文件没有变化。失效后由inotify线程置为false，依赖它的上层缓存据此丢弃自己的副本
+    FILE_STATUS m_status;
+    struct stat m_stat;
+    int m_fd;           // 只有不做映射的大文件才保持打开，用于sendfile，否则为-1
+    char* m_addr;       // 小文件的映射，没有映射时为NULL
+
+    // 以下只在所属分片的锁内使用
+    std::string m_key;
+    bool m_referenced;  // CLOCK的访问位：命中时置位，时钟指针经过时清除
+    file_entry* m_prev; // 同一个时钟环上的条目连成环形链表
+    file_entry* m_next;
+};
+
+/*
+    以URL路径为键的文件缓存，所有reactor和工作线程共享，按哈希分成多个分片，每个分片一把锁。
+    命中时不需要拼接路径，也不需要stat、open、mmap和close。
+    缓存的正确性不依赖每次请求的stat：后台线程用inotify监视网站根目录及其所有子目录，
+    文件被修改、删除、创建或移动时让对应的条目失效，目录本身变化或事件队列溢出时清空整个缓存。
+    inotify不可用时缓存不启用，每次请求都重新查找文件。
+    分片满了以后用CLOCK算法淘汰：命中只置一个访问位，时钟指针转过时清除它，转到访问位已经清除、
+    也没有响应正在使用的条目就把它淘汰。不存在的URL放在另一个小得多的时钟环里，
+    扫描大量不存在的URL只会挤掉其他的404，不会占满缓存，让真正的文件再也放不进来。
+*/
+class file_cache
+{
+public:
+    file_cache();
+    ~file_cache();
+
+    //设置网站根目录并开始监视，失败时返回false，之后的acquire()都不使用缓存
+    bool init(const char* root);
+
+    //查找url对应的文件，返回的条目已经加了一个引用，用完后调用release()。只有内存不足时才返回NULL
+    file_entry* acquire(const char* url);
+    static void release(file_entry* entry);
+
+    //小于这个大小的文件在缓存时就建立映射，用writev发送；否则保持文件打开，用sendfile发送。-1表示总是映射
+    static long long m_map_limit;
+
+private:
+    static const int SHARDS = 16;
+    static const int MAX_ENTRIES_PER_SHARD = 256;   //每个分片最多缓存的文件数，也限制了缓存占用的文件描述符
+    static const int MAX_MISSING_PER_SHARD = 32;    //每个分片最多缓存的不存在的URL
+    static const int PATH_LEN = 256;
+
+    //一个时钟环：条目连成环形链表，新条目插在指针前面，指针转一圈后才会检查到它
+    struct clock_ring
+    {
+        file_entry* m_hand;
+        int m_size;
+        int m_cap;
+        clock_ring(int cap): m_hand(NULL), m_size(0), m_cap(cap){}
+    };
+
+    struct shard
+    {
+        locker m_lock;
+        std::unordered_map<std::string, file_entry*> m_entries;
+        clock_ring m_files;     //找到的文件，以及目录和没有权限的文件
+        clock_ring m_missing;   //不存在的URL
+        unsigned m_version;     //每次有条目失效就加1，查找期间版本变了说明查到的结果可能已经过时，不放入缓存
+        shard(): m_files(MAX_ENTRIES_PER_SHARD), m_missing(MAX_MISSING_PER_SHARD), m_version(0){}
+    };
+
+    file_entry* resolve(const char* url);       //在文件系统中查找url，返回引用计数为1的新条目
+    shard& shard_of(const std::string& key);
+    static clock_ring& ring_of(shard& s, file_entry* entry);
+    static void ring_insert(clock_ring& ring, file_entry* entry);
+    static void ring_unlink(clock_ring& ring, file_entry* entry);
+    static file_entry* evict(shard& s, clock_ring& ring);  //从分片中淘汰一个条目，返回它，由调用者在锁外释放。都在使用中时返回NULL
+    void invalidate(const std::string& key);
+    void clear();
+    void add_watch(const std::string& dir);     //监视目录dir(相对根目录，以'/'开头或为空)及其所有子目录
+    void handle_events();
+
+    static bool cacheable(const char* url);     //只缓存规范的路径，否则inotify报告的路径和键对不上
+    static void* watcher(void* arg);
+
+private:
+    char m_root[PATH_LEN];
+    int m_inotify_fd;
+    int m_stop_fd;          //析构时通过它通知监视线程退出
+    pthread_t m_thread;
+    bool m_enabled;
+    shard m_shards[SHARDS];
+
+    //inotify的监视描述符到目录的映射，只在监视线程(和启动时的init)中使用
+    std::unordered_map<int, std::string> m_watches;
+};
+
+#endif
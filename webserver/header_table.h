@@ -0,0 +1,199 @@
+#ifndef HEADER_TABLE_H
+#define HEADER_TABLE_H
+
+#include <string.h>
+#include <strings.h>
+
+/*
+    请求头部字段表。解析时每个字段只记录名字和值在读缓冲区中的位置(视图)，不复制、不分配内存。
+    认识的字段名通过完美哈希映射到HEADER_ID，处理请求时可以直接按编号取到字段的值，不需要再遍历。
+    完美哈希的种子在编译期搜索：从0开始尝试，直到所有认识的字段名落在哈希表的不同槽位中，
+    所以增加新的字段名只需要加到下面的枚举和名字表里，编译时会重新找到一个不冲突的种子。
+*/
+
+// 认识的头部字段，顺序和header_hash::names中的名字一致
+enum HEADER_ID
+{
+    HDR_CONNECTION = 0,
+    HDR_CONTENT_LENGTH,
+    HDR_HOST,
+    HDR_ACCEPT_ENCODING,
+    HDR_IF_NONE_MATCH,
+    HDR_IF_MODIFIED_SINCE,
+    HDR_RANGE,
+    HDR_IF_RANGE,
+    HDR_USER_AGENT,
+    HDR_COUNT,
+    HDR_UNKNOWN = HDR_COUNT
+};
+
+// 缓冲区中的一段字符，不以'\0'结尾也可以使用
+struct str_view
+{
+    const char* m_ptr;
+    int m_len;
+};
+
+struct header_field
+{
+    str_view m_name;
+    str_view m_value;
+    HEADER_ID m_id;
+};
+
+namespace header_hash
+{
+    struct name_entry
+    {
+        const char* m_name;
+        int m_len;
+    };
+
+    //按HEADER_ID的顺序排列，全部小写
+    static constexpr name_entry names[HDR_COUNT] = {
+        { "connection", 10 },
+        { "content-length", 14 },
+        { "host", 4 },
+        { "accept-encoding", 15 },
+        { "if-none-match", 13 },
+        { "if-modified-since", 17 },
+        { "range", 5 },
+        { "if-range", 8 },
+        { "user-agent", 10 },
+    };
+
+    static const int SLOTS = 32;    //哈希表的槽位数，2的幂，比名字的个数大一些种子容易找
+
+    //不区分大小写的哈希。字段名中的字母或上0x20就是小写，'-'和数字不受影响；其他字符只是哈希值不同，最后还要逐字节比较
+    static constexpr unsigned name_hash(const char* name, int len, unsigned seed){
+        unsigned h = seed ^ (unsigned)len;
+        for(int i = 0; i < len; i++){
+            h = (h ^ ((unsigned char)name[i] | 0x20)) * 16777619u;
+        }
+        return (h ^ (h >> 15)) & (SLOTS - 1);
+    }
+
+    static constexpr bool collides(unsigned seed){
+        for(int i = 0; i < HDR_COUNT; i++){
+            for(int j = i + 1; j < HDR_COUNT; j++){
+                if(name_hash(names[i].m_name, names[i].m_len, seed) == name_hash(names[j].m_name, names[j].m_len, seed)){
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
+    static constexpr unsigned find_seed(){
+        unsigned seed = 0;
+        while(collides(seed)){
+            seed++;
+        }
+        return seed;
+    }
+
+    static constexpr unsigned SEED = find_seed();
+
+    //槽位到HEADER_ID的映射，空槽位是HDR_UNKNOWN
+    struct slot_table
+    {
+        unsigned char m_slots[SLOTS];
+        constexpr slot_table(): m_slots(){
+            for(int i = 0; i < SLOTS; i++){
+                m_slots[i] = HDR_UNKNOWN;
+            }
+            for(int i = 0; i < HDR_COUNT; i++){
+                m_slots[name_hash(names[i].m_name, names[i].m_len, SEED)] = i;
+            }
+        }
+    };
+
+    static constexpr slot_table table = slot_table();
+
+    //查找字段名的编号，不认识时返回HDR_UNKNOWN
+    static inline HEADER_ID lookup(const char* name, int len){
+        int id = table.m_slots[name_hash(name, len, SEED)];
+        if(id == HDR_UNKNOWN || names[id].m_len != len || strncasecmp(name, names[id].m_name, len) != 0){
+            return HDR_UNKNOWN;
+        }
+        return (HEADER_ID)id;
+    }
+}
+
+/*
+    一个请求的头部字段，容量固定，放在连接对象中，处理每个请求之前clear()。
+    视图指向读缓冲区，缓冲区扩大换了位置后要调用rebase()。
+*/
+class header_table
+{
+public:
+    static const int MAX_HEADERS = 64;  //超过时请求按错误处理
+
+    header_table(){
+        clear();
+    }
+
+    void clear(){
+        m_count = 0;
+        for(int i = 0; i < HDR_COUNT; i++){
+            m_index[i] = -1;
+        }
+    }
+
+    //加入一个字段，返回它的编号；表满时返回false。同名字段出现多次时，按编号查找得到第一个
+    bool add(const char* name, int name_len, const char* value, int value_len, HEADER_ID& id){
+        if(m_count >= MAX_HEADERS){
+            return false;
+        }
+        id = header_hash::lookup(name, name_len);
+        header_field& field = m_fields[m_count];
+        field.m_name.m_ptr = name;
+        field.m_name.m_len = name_len;
+        field.m_value.m_ptr = value;
+        field.m_value.m_len = value_len;
+        field.m_id = id;
+        if(id != HDR_UNKNOWN && m_index[id] == -1){
+            m_index[id] = m_count;
+        }
+        m_count++;
+        return true;
+    }
+
+    //按编号查找，没有这个字段时返回NULL
+    const header_field* get(HEADER_ID id) const {
+        return m_index[id] == -1 ? NULL : &m_fields[m_index[id]];
+    }
+
+    //按名字查找不认识的字段，逐个比较
+    const header_field* find(const char* name) const {
+        int len = strlen(name);
+        HEADER_ID id = header_hash::lookup(name, len);
+        if(id != HDR_UNKNOWN){
+            return get(id);
+        }
+        for(int i = 0; i < m_count; i++){
+            if(m_fields[i].m_name.m_len == len && strncasecmp(m_fields[i].m_name.m_ptr, name, len) == 0){
+                return &m_fields[i];
+            }
+        }
+        return NULL;
+    }
+
+    int count() const { return m_count; }
+    const header_field& at(int i) const { return m_fields[i]; }
+
+    //读缓冲区从from移到了to
+    void rebase(const char* from, const char* to){
+        for(int i = 0; i < m_count; i++){
+            m_fields[i].m_name.m_ptr = to + (m_fields[i].m_name.m_ptr - from);
+            m_fields[i].m_value.m_ptr = to + (m_fields[i].m_value.m_ptr - from);
+        }
+    }
+
+private:
+    header_field m_fields[MAX_HEADERS];
+    short m_index[HDR_COUNT];       //每个认识的字段在m_fields中的下标，-1表示没有
+    int m_count;
+};
+
+#endif
@@ -0,0 +1,284 @@
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include "http_cache.h"
+#include "http_response.h"
+
+#define MAX_CACHE_RULES 16
+#define MAX_PREFIX 128
+
+struct cache_rule
+{
+    char m_prefix[MAX_PREFIX];
+    int m_len;
+    int m_max_age;
+};
+
+// 规则在main()中创建线程之前配置好，之后只读
+static cache_rule cache_rules[MAX_CACHE_RULES];
+static int cache_rule_count = 0;
+
+static const char* day_names[7] = { "Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat" };
+static const char* month_names[12] = { "Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec" };
+
+int make_etag(char* buf, const struct stat& st, const char* suffix, bool weak){
+    char* p = buf;
+    if(weak){
+        *p++ = 'W';
+        *p++ = '/';
+    }
+    *p++ = '"';
+    if(!weak){
+        p += format_hex(p, st.st_ino);
+        *p++ = '-';
+    }
+    p += format_hex(p, st.st_size);
+    *p++ = '-';
+    if(weak){
+        p += format_hex(p, st.st_mtim.tv_sec);
+    }else{
+        p += format_hex(p, (unsigned long long)st.st_mtim.tv_sec * 1000000000ULL + st.st_mtim.tv_nsec);
+    }
+    if(suffix){
+        int len = strlen(suffix);
+        memcpy(p, suffix, len);
+        p += len;
+    }
+    *p++ = '"';
+    return p - buf;
+}
+
+// If-None-Match用弱比较：去掉两边的"W/"以后引号里的内容相同就算匹配
+bool etag_matches(const char* list, int list_len, const char* etag, int etag_len){
+    if(etag_len > 2 && etag[0] == 'W' && etag[1] == '/'){
+        etag += 2;
+        etag_len -= 2;
+    }
+    const char* p = list;
+    const char* end = list + list_len;
+    while(p < end){
+        if(*p == ' ' || *p == '\t' || *p == ','){
+            ++p;
+            continue;
+        }
+        if(*p == '*'){
+            return true;
+        }
+        if(end - p > 2 && p[0] == 'W' && p[1] == '/'){
+            p += 2;
+        }
+        if(*p != '"'){
+            //格式不对，后面的都不看了
+            return false;
+        }
+        const char* close = (const char*)memchr(p + 1, '"', end - p - 1);
+        if(!close){
+            return false;
+        }
+        if(close + 1 - p == etag_len && memcmp(p, etag, etag_len) == 0){
+            return true;
+        }
+        p = close + 1;
+    }
+    return false;
+}
+
+static inline char* put2(char* p, int v){
+    *p++ = '0' + v / 10;
+    *p++ = '0' + v % 10;
+    return p;
+}
+
+// 不用strftime，避免受locale的影响，也不经过printf
+int format_http_date(char* buf, time_t t){
+    struct tm tm;
+    gmtime_r(&t, &tm);
+    char* p = buf;
+    memcpy(p, day_names[tm.tm_wday], 3);
+    p += 3;
+    *p++ = ',';
+    *p++ = ' ';
+    p = put2(p, tm.tm_mday);
+    *p++ = ' ';
+    memcpy(p, month_names[tm.tm_mon], 3);
+    p += 3;
+    *p++ = ' ';
+    int year = tm.tm_year + 1900;
+    p = put2(p, year / 100 % 100);
+    p = put2(p, year % 100);
+    *p++ = ' ';
+    p = put2(p, tm.tm_hour);
+    *p++ = ':';
+    p = put2(p, tm.tm_min);
+    *p++ = ':';
+    p = put2(p, tm.tm_sec);
+    memcpy(p, " GMT", 4);
+    p += 4;
+    *p = '\0';
+    return p - buf;
+}
+
+static int parse_digits(const char* p, int n){
+    int v = 0;
+    for(int i = 0; i < n; i++){
+        if(p[i] < '0' || p[i] > '9'){
+            return -1;
+        }
+        v = v * 10 + p[i] - '0';
+    }
+    return v;
+}
+
+// 只接受浏览器实际发送的IMF-fixdate："Sun, 06 Nov 1994 08:49:37 GMT"，过时的格式按无效处理
+time_t parse_http_date(const char* text, int len){
+    if(len != HTTP_DATE_SIZE - 1 || text[3] != ',' || text[4] != ' ' || text[7] != ' ' || text[11] != ' '
+        || text[16] != ' ' || text[19] != ':' || text[22] != ':' || strncmp(text + 25, " GMT", 4) != 0){
+        return -1;
+    }
+    struct tm tm;
+    memset(&tm, 0, sizeof(tm));
+    tm.tm_mon = -1;
+    for(int i = 0; i < 12; i++){
+        if(strncmp(text + 8, month_names[i], 3) == 0){
+            tm.tm_mon = i;
+            break;
+        }
+    }
+    tm.tm_mday = parse_digits(text + 5, 2);
+    int year = parse_digits(text + 12, 4);
+    tm.tm_hour = parse_digits(text + 17, 2);
+    tm.tm_min = parse_digits(text + 20, 2);
+    tm.tm_sec = parse_digits(text + 23, 2);
+    if(tm.tm_mon < 0 || tm.tm_mday < 1 || year < 1970 || tm.tm_hour < 0 || tm.tm_min < 0 || tm.tm_sec < 0){
+        return -1;
+    }
+    tm.tm_year = year - 1900;
+    return timegm(&tm);
+}
+
+// 读一个非负整数，没有数字时返回-1
+static long long parse_number(const char*& p, const char* end){
+    if(p >= end || *p < '0' || *p > '9'){
+        return -1;
+    }
+    long long v = 0;
+    while(p < end && *p >= '0' && *p <= '9'){
+        if(v > (1LL << 50)){
+            //不可能是合法的文件偏移
+            return -1;
+        }
+        v = v * 10 + *p++ - '0';
+    }
+    return v;
+}
+
+int parse_ranges(const char* text, int len, long long size, byte_range* ranges, int max){
+    const char* p = text;
+    const char* end = text + len;
+    if(len < 6 || strncasecmp(p, "bytes=", 6) != 0){
+        return 0;
+    }
+    p += 6;
+    int count = 0;
+    bool any = false;
+    long long total = 0;
+    while(p < end){
+        if(*p == ' ' || *p == '\t' || *p == ','){
+            ++p;
+            continue;
+        }
+        long long first = -1;
+        long long last = -1;
+        if(*p != '-'){
+            first = parse_number(p, end);
+            if(first < 0 || p >= end || *p != '-'){
+                return 0;
+            }
+            ++p;
+            if(p < end && *p >= '0' && *p <= '9'){
+                last = parse_number(p, end);
+                if(last < first){
+                    return 0;
+                }
+            }
+        }else{
+            //"-n"表示最后n个字节
+            ++p;
+            last = parse_number(p, end);
+            if(last < 0){
+                return 0;
+            }
+        }
+        if(p < end && *p != ',' && *p != ' ' && *p != '\t'){
+            return 0;
+        }
+        any = true;
+        byte_range r;
+        if(first < 0){
+            if(last == 0 || size == 0){
+                continue;
+            }
+            r.m_start = last >= size ? 0 : size - last;
+            r.m_end = size - 1;
+        }else{
+            if(first >= size){
+                //从文件末尾之后开始的段无法满足
+                continue;
+            }
+            r.m_start = first;
+            r.m_end = (last < 0 || last >= size) ? size - 1 : last;
+        }
+        if(count >= max){
+            return 0;
+        }
+        total += r.m_end - r.m_start + 1;
+        if(total > size){
+            //重叠的段加起来比整个文件还大，直接发送整个文件
+            return 0;
+        }
+        ranges[count++] = r;
+    }
+    if(!any){
+        return 0;
+    }
+    return count > 0 ? count : -1;
+}
+
+bool if_range_matches(const char* text, int len, const char* etag, int etag_len, time_t last_modified){
+    //日期也可能以'W'开头("Wed, ...")，弱ETag要看"W/"
+    if((len > 0 && text[0] == '"') || (len > 1 && text[0] == 'W' && text[1] == '/')){
+        //强比较，弱ETag永远不匹配
+        return etag[0] == '"' && len == etag_len && memcmp(text, etag, len) == 0;
+    }
+    return parse_http_date(text, len) == last_modified;
+}
+
+bool add_cache_rule(const char* spec){
+    const char* eq = strrchr(spec, '=');
+    if(!eq || eq == spec || eq - spec >= MAX_PREFIX || cache_rule_count >= MAX_CACHE_RULES){
+        return false;
+    }
+    int max_age = atoi(eq + 1);
+    if(max_age < 0){
+        return false;
+    }
+    cache_rule& rule = cache_rules[cache_rule_count++];
+    rule.m_len = eq - spec;
+    memcpy(rule.m_prefix, spec, rule.m_len);
+    rule.m_prefix[rule.m_len] = '\0';
+    rule.m_max_age = max_age;
+    return true;
+}
+
+int cache_max_age(const char* url){
+    int best = -1;
+    int best_len = -1;
+    for(int i = 0; i < cache_rule_count; i++){
+        const cache_rule& rule = cache_rules[i];
+        if(rule.m_len > best_len && strncmp(url, rule.m_prefix, rule.m_len) == 0){
+            best = rule.m_max_age;
+            best_len = rule.m_len;
+        }
+    }
+    return best;
+}
@@ -0,0 +1,51 @@
+#ifndef HTTP_CACHE_H
+#define HTTP_CACHE_H
+
+#include <time.h>
+#include <sys/stat.h>
+
+/*
+    条件请求和缓存控制用到的工具函数。
+    ETag和Last-Modified都从文件的stat信息得到，不需要读文件内容：
+    强ETag由inode、大小和纳秒级的修改时间组成，文件的任何变化都会改变它；
+    弱ETag只用大小和秒级的修改时间，不含inode，内容相同的几台服务器会给出相同的ETag。
+    Cache-Control的max-age按URL前缀配置，匹配最长的前缀。
+    Range请求在这里解析成文件中的几段，If-Range用同样的验证器判断客户端手里的部分是否还有效。
+*/
+
+#define ETAG_SIZE 64        // ETag(包括引号和编码后缀)的最大长度
+#define HTTP_DATE_SIZE 30   // "Sun, 06 Nov 1994 08:49:37 GMT"加上'\0'
+
+// 生成文件的ETag，带上引号，suffix区分同一文件的不同编码(可以是NULL)，返回长度
+int make_etag(char* buf, const struct stat& st, const char* suffix, bool weak);
+
+// If-None-Match的值(ETag列表或者"*")中是否有和etag弱匹配的
+bool etag_matches(const char* list, int list_len, const char* etag, int etag_len);
+
+// 按IMF-fixdate格式写出时间，返回长度(29)
+int format_http_date(char* buf, time_t t);
+
+// 解析IMF-fixdate格式的时间，格式不对时返回-1
+time_t parse_http_date(const char* text, int len);
+
+// Range请求中的一段，闭区间[m_start, m_end]
+struct byte_range
+{
+    long long m_start;
+    long long m_end;
+};
+
+// 解析Range的值，比如"bytes=0-99, 200-, -50"，size是文件大小。
+// 返回满足的段数(最多max段)；0表示忽略Range发送整个文件(格式不对、段太多或者总长度超过文件)；-1表示没有可以满足的段
+int parse_ranges(const char* text, int len, long long size, byte_range* ranges, int max);
+
+// If-Range的值是ETag时要求和etag强匹配，是时间时要求和last_modified相同
+bool if_range_matches(const char* text, int len, const char* etag, int etag_len, time_t last_modified);
+
+// 添加一条Cache-Control规则，格式是"前缀=秒数"，比如"/images/=86400"
+bool add_cache_rule(const char* spec);
+
+// url匹配的最长前缀规则的max-age，没有匹配的规则时返回-1
+int cache_max_age(const char* url);
+
+#endif
@@ -1,65 +1,93 @@
+#include <assert.h>
 #include "http_conn.h" 
 
-// 定义HTTP响应的一些状态信息
-const char* ok_200_title = "OK";
-const char* error_400_title = "Bad Request";
-const char* error_400_form = "Your request has bad syntax or is inherently impossible to satisfy.\n";
-const char* error_403_title = "Forbidden";
-const char* error_403_form = "You do not have permission to get file from this server.\n";
-const char* error_404_title = "Not Found";
-const char* error_404_form = "The requested file was not found on this server.\n";
-const char* error_500_title = "Internal Error";
-const char* error_500_form = "There was an unusual problem serving the requested file.\n";
+// 状态行、错误页面和503响应在http_response.cpp中
 
-
-int http_conn::m_epollfd = -1;    //所有的socket上的事件都被注册到同一个epollfd；
-int http_conn::m_user_count = 0;  //统计用户的数量
+std::atomic<int> http_conn::m_user_count(0);  //统计用户的数量
+bool http_conn::m_edge_trigger = false;       //默认使用水平触发
+file_cache http_conn::m_file_cache;          //所有连接共享的文件缓存
+object_cache http_conn::m_object_cache;      //所有连接共享的响应缓存，由main()设置预算
+compressor http_conn::m_compressor;          //所有连接共享的动态压缩，由main()启动
+int http_conn::m_max_requests = 1000;        //一个连接处理这么多请求后关闭，让客户端重新连接
+buffer_pool http_conn::m_buffers;            //所有连接共享的读写缓冲区
+std::atomic<unsigned> http_conn::m_next_generation(0);
+bool http_conn::m_weak_etag = false;          //默认生成强ETag
+std::atomic<bool> http_conn::m_draining(false);
 
 //网站的根目录
 const char* doc_root = "/home/nowcoder/webserver1/resources";
 
-//设置文件描述符非阻塞
-int setnonblocking(int fd){
-    int old_flag = fcntl(fd, F_GETFL);
-    int new_flag = old_flag | O_NONBLOCK;
-    fcntl(fd, F_SETFL, new_flag);
-    return old_flag;
+// 解析Accept-Encoding，比如 "gzip, deflate, br;q=0.9"，q=0表示明确不接受
+static int parse_accept_encoding(const char* text){
+    int accepted = 0;
+    while(*text){
+        text += strspn(text, " \t,");
+        size_t len = strcspn(text, ",");
+        size_t name_len = strcspn(text, " \t;,");
+        const char* q = strstr(text, "q=");
+        bool refused = q && q < text + len && atof(q + 2) == 0;
+        if(!refused){
+            if((name_len == 4 && strncasecmp(text, "gzip", 4) == 0) || (name_len == 6 && strncasecmp(text, "x-gzip", 6) == 0)){
+                accepted |= ACCEPT_GZIP;
+            }else if(name_len == 2 && strncasecmp(text, "br", 2) == 0){
+                accepted |= ACCEPT_BR;
+            }else if(name_len == 1 && text[0] == '*'){
+                accepted |= ACCEPT_GZIP | ACCEPT_BR;
+            }
+        }
+        text += len;
+    }
+    return accepted;
 }
 
-
-//添加文件描述符到epoll中
-void addfd(int epollfd, int fd, bool one_shot){
+//添加文件描述符到epoll中。文件描述符在创建时就要设置为非阻塞(SOCK_NONBLOCK、accept4等)，这里不再调用fcntl
+void addfd(int epollfd, int fd, bool one_shot, bool et){
     epoll_event event;
     event.data.fd = fd;
     // 内核2.6.17以后，对端如果异常断开会出现EPOLLIN和EPOLLRDHUP异常，这里直接通过事件去判断
     //event.events = EPOLLIN |  EPOLLRDHUP;
     event.events = EPOLLIN |  EPOLLRDHUP;
+    if(et){
+        // 边沿触发：就绪状态变化时只通知一次，调用者必须一直读(或accept)到EAGAIN
+        event.events |= EPOLLET;
+    }
     if(one_shot){
         // 防止同一个通信被不同的线程处理
         event.events |= EPOLLONESHOT;
     }
     epoll_ctl(epollfd, EPOLL_CTL_ADD, fd, &event);
-    //设置文件描述符非阻塞
-    setnonblocking(fd);
 }
 
 //从epoll中删除文件描述符
 void removefd(int epollfd, int fd){
-    epoll_ctl(epollfd, EPOLL_CTL_DEL, fd, 0);
+    if(epollfd != -1){
+        epoll_ctl(epollfd, EPOLL_CTL_DEL, fd, 0);
+    }else{
+        //io_uring后端：挂起的recv请求持有socket的引用，只close不会让它结束，先shutdown让它立即完成
+        shutdown(fd, SHUT_RDWR);
+    }
     close(fd);
 }
 
 //修改epoll中的文件描述符,重置socket上的EPOLLONESHOT事件，以确保下一次可读时，EPOLLIN事件能被触发
 extern void modfd(int epollfd, int fd, int ev){
+    if(epollfd == -1){
+        //io_uring后端的连接不注册到epoll中，下一步的读写由reactor提交
+        return;
+    }
     epoll_event event;
     event.data.fd = fd;
     event.events = ev | EPOLLONESHOT | EPOLLRDHUP;
+    if(http_conn::m_edge_trigger){
+        event.events |= EPOLLET;
+    }
     epoll_ctl(epollfd, EPOLL_CTL_MOD, fd, &event);
 }
 
 //初始化新接收的连接
-void http_conn::init(int sockfd, const sockaddr_in & addr){
+void http_conn::init(int sockfd, const sockaddr_in & addr, int epollfd){
 
+    m_epollfd = epollfd;
     m_sockfd = sockfd;
     m_address = addr;
 
@@ -68,38 +96,151 @@ void http_conn::init(int sockfd, const sockaddr_in & addr){
     setsockopt(m_sockfd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
 
     //添加到epoll对象中
-    addfd(m_epollfd, m_sockfd, true);
+    if(m_epollfd != -1){
+        addfd(m_epollfd, m_sockfd, true, m_edge_trigger);
+    }
     m_user_count++; //用户数+1
+    m_busy = false; //连接对象是复用的，上一个连接可能在交给线程池以后被拒绝并关闭
+    m_accept_time = get_ns_time();
+    m_generation = ++m_next_generation; //区分复用同一个文件描述符(或同一个连接对象)的前后两个连接
 
     init(); 
 }
 
 void http_conn::init(){
 
-    bytes_to_send = 0;
-    bytes_have_send = 0;
+    m_start_line = 0;
+    m_check_index = 0;
+    m_read_idx = 0;
+    reset_tokens(m_tokens);
+    m_keep_alive = false;
+    m_pipelined = false;
+    m_request_count = 0;
+    m_file = NULL;
+    m_object = NULL;
+    m_response_count = 0;
+    m_file_address = 0;
+    m_file_fd = -1;
+
+    reset_request();
+    reset_response();
+    release_read_buf();
 
+}
+
+void http_conn::reset_request(){
     m_check_state = CHECK_STATE_REQUESTLINE;    // 初始状态为检查请求行
-    m_linger = false;       // 默认不保持链接  Connection : keep-alive保持连接
+    m_linger = false;       // 解析请求行时按HTTP/1.1的默认值改为保持连接
+    m_accept_encoding = 0;  // 默认只接受原始内容
+    m_content_type = "text/html";
+    m_compressible = false;
+    m_encoding = ENCODING_IDENTITY;
+    m_etag_len = 0;
+    m_max_age = -1;
+    m_range_count = 0;
 
     m_method = GET;         // 默认请求方式为GET
     m_url = 0;              
     m_version = 0;
     m_content_length = 0;
-    m_host = 0;
-    m_start_line = 0;
-    m_check_index = 0;
-    m_read_idx = 0;
+    m_headers.clear();
+    m_file_address = 0;
+}
+
+void http_conn::reset_response(){
+    bytes_to_send = 0;
+    bytes_have_send = 0;
     m_write_idx = 0;
+    m_iv_count = 0;
+    m_iv_index = 0;
+    release_write_buf();
+}
 
-    bzero(m_read_buf, READ_BUFFER_SIZE);
-    bzero(m_write_buf, READ_BUFFER_SIZE);
-    bzero(m_real_file, FILENAME_LEN);
+// 请求占用了读缓冲区的前end个字节，流水线上已经收到的后续请求移到开头，下一次解析从它开始，不需要再recv
+void http_conn::next_request(int end){
+    assert(end >= 0 && end <= m_read_idx);
+    memmove(m_read_buf, m_read_buf + end, m_read_idx - end);
+    m_read_idx -= end;
+    m_check_index = 0;
+    m_start_line = 0;
+    reset_tokens(m_tokens);
+    reset_request();
+    if(m_read_idx == 0){
+        //没有流水线上的数据了，等待下一个请求期间不占用读缓冲区
+        release_read_buf();
+    }
+}
 
+// 需要时从缓冲区池取读缓冲区，放不下时换一个更大的，已经解析出的指针指向新缓冲区中的相同位置
+bool http_conn::reserve_read(int len){
+    if(m_read_buf && m_read_idx + len <= m_read_size){
+        return true;
+    }
+    int size = m_read_size ? m_read_size * 2 : READ_BUFFER_SIZE;
+    while(size < m_read_idx + len){
+        size *= 2;
+    }
+    int cap = 0;
+    char* buf = m_buffers.acquire(size, cap);
+    if(!buf){
+        //请求头超过了最大的缓冲区
+        return false;
+    }
+    if(m_read_buf){
+        memcpy(buf, m_read_buf, m_read_idx);
+        if(m_url){
+            m_url = buf + (m_url - m_read_buf);
+        }
+        if(m_version){
+            m_version = buf + (m_version - m_read_buf);
+        }
+        m_headers.rebase(m_read_buf, buf);
+        m_buffers.release(m_read_buf, m_read_size);
+    }
+    m_read_buf = buf;
+    m_read_size = cap;
+    return true;
+}
+
+// 写缓冲区翻倍，已经排队的响应头在iovec中的指针也要指向新缓冲区
+bool http_conn::grow_write(){
+    int cap = 0;
+    char* buf = m_buffers.acquire(m_write_size ? m_write_size * 2 : WRITE_BUFFER_SIZE, cap);
+    if(!buf){
+        return false;
+    }
+    if(m_write_buf){
+        memcpy(buf, m_write_buf, m_write_idx);
+        for(int i = 0; i < m_iv_count; i++){
+            char* base = (char*)m_iv[i].iov_base;
+            if(base >= m_write_buf && base < m_write_buf + m_write_size){
+                m_iv[i].iov_base = buf + (base - m_write_buf);
+            }
+        }
+        m_buffers.release(m_write_buf, m_write_size);
+    }
+    m_write_buf = buf;
+    m_write_size = cap;
+    return true;
+}
+
+void http_conn::release_read_buf(){
+    m_buffers.release(m_read_buf, m_read_size);
+    m_read_buf = NULL;
+    m_read_size = 0;
+}
+
+void http_conn::release_write_buf(){
+    m_buffers.release(m_write_buf, m_write_size);
+    m_write_buf = NULL;
+    m_write_size = 0;
 }
 
 // 关闭连接
 void http_conn::close_conn(){
+    //响应可能没发完，释放它占用的映射或文件，以及读写缓冲区
+    unmap();
+    release_buffers();
     if(m_sockfd != -1){
         removefd(m_epollfd, m_sockfd);
         m_sockfd = -1;
@@ -107,21 +248,21 @@ void http_conn::close_conn(){
     }
 }
 //循环读取客户端数据，直到无数据刻度或者对方关闭连接
-bool http_conn::read(client_data* &users2, int sockfd, sort_timer_lst &timer_lst, void(cb_func)(client_data*), int TIMESLOT ){
-    
-    if(m_read_idx >= READ_BUFFER_SIZE){
-        return false;
-    }
+bool http_conn::read(client_data* &users2, int sockfd, time_wheel &timer_lst, int TIMESLOT ){
 
     //读取到的字节
     int bytes_read = 0;
+    thread_stats* st = stats::local();
+    long long begin = get_ns_time();
     while(true){
 
+        //有数据到来时才取读缓冲区，满了就换一个更大的。请求超过最大的缓冲区时关闭连接
+        if(!reserve_read(1)){
+            return false;
+        }
+        bytes_read = recv(m_sockfd, m_read_buf + m_read_idx, m_read_size - m_read_idx, 0);
 
-        bytes_read = recv(m_sockfd, m_read_buf + m_read_idx, READ_BUFFER_SIZE - m_read_idx, 0);
-
-        memset( users2[sockfd].buf, '\0', BUFFER_SIZE);
-        printf("get %d bytes of client data %s from %d\n",bytes_read, users2[sockfd].buf,sockfd);
+        LOG_DEBUG("get %d bytes of client data from %d", bytes_read, sockfd);
         util_timer* timer = users2[sockfd].timer;
 
         if(bytes_read == -1){
@@ -130,101 +271,193 @@ bool http_conn::read(client_data* &users2, int sockfd, sort_timer_lst &timer_lst
                 break;
             }
             //如果发生了都错误，则关闭连接，并移除其对应的定时器
-            if(errno != EAGAIN){
-                cb_func( &users2[sockfd]);
-                if(timer){
-                    timer_lst.del_timer(timer);
-                }
+            if(timer){
+                timer_lst.del_timer(timer);
+                users2[sockfd].timer = NULL;
             }
+            close_conn();
             return false;
         }else if(bytes_read == 0){
             //对方关闭链接
-            printf("client is closed!\n");
+            LOG_DEBUG("client %d is closed", sockfd);
             //如果对方关闭了连接，我们也关闭连接，并移除对应的定时器
-            cb_func(&users2[sockfd]);
             if(timer){
                 timer_lst.del_timer(timer);
+                users2[sockfd].timer = NULL;
             }
+            close_conn();
 
             return false;
         }else{
             //如果某个客户端有数据可读，则我们要调正该连接对应的定时器，以延迟该连接被关闭的事件。
             if(timer){
-                time_t cur = time(NULL);
+                long long cur = get_ms_time();
                 timer->expire = cur + 3*TIMESLOT;
-                printf("adjust timer once\n");
                 timer_lst.adjust_timer( timer);
             }
         }
         
 
         m_read_idx += bytes_read;
+        st->add(COUNTER_BYTES_IN, bytes_read);
     }
-    printf("读取到了数据：\n");
-    //printf("%s\n", m_read_buf);
+    if(m_read_idx == 0){
+        release_read_buf();
+    }
+    st->record(STAGE_RECV, get_ns_time() - begin);
     return true;
 }
 // 写HTTP响应
 bool http_conn::write(){
-    printf("write+++++++++++++++++++++++++++++++++++++++\n");
-    // printf("一次性写完数据\n");
-
     int temp = 0;
 
     if( bytes_to_send == 0){
         modfd(m_epollfd, m_sockfd, EPOLLIN);
-        init();
+        unmap();
+        reset_response();
         return true;
     }
 
     while(1){
-        //分散写
-        temp = writev(m_sockfd, m_iv, m_iv_count);
+        if(!m_iv[m_iv_index].iov_base){
+            //文件中的一段由内核直接从页缓存发送到socket，m_file_offsets记录这一段发到了哪里
+            temp = sendfile(m_sockfd, m_file_fd, &m_file_offsets[m_iv_index], m_iv[m_iv_index].iov_len);
+        }else{
+            int run = m_iv_index;
+            while(run < m_iv_count && m_iv[run].iov_base){
+                run++;
+            }
+            if(run < m_iv_count){
+                //后面还有sendfile发送的部分，MSG_MORE让内核等它一起组包，响应头不会单独占一个小报文
+                struct msghdr msg;
+                memset(&msg, 0, sizeof(msg));
+                msg.msg_iov = m_iv + m_iv_index;
+                msg.msg_iovlen = run - m_iv_index;
+                temp = sendmsg(m_sockfd, &msg, MSG_MORE | MSG_NOSIGNAL);
+            }else{
+                //分散写，流水线上攒下的所有响应一次发出
+                temp = writev(m_sockfd, m_iv + m_iv_index, m_iv_count - m_iv_index);
+            }
+        }
         if(temp <= -1){
             // 如果TCP写缓冲没有空间，则等待下一轮EPOLLOUT事件，虽然在此期间，
             // 服务器无法立即接收到同一客户的下一个请求，但可以保证连接的完整性。
             if( errno == EAGAIN ){
-                modfd( m_epollfd, m_sockfd, EPOLLIN);
+                modfd( m_epollfd, m_sockfd, EPOLLOUT);
                 return true;
             }
             unmap();
             return false;
         }
-
-        bytes_have_send += temp;
-        bytes_to_send -= temp;
-
-        if(bytes_have_send > m_iv[0].iov_len){
-            m_iv[0].iov_len = 0;
-            m_iv[1].iov_base = m_file_address + (bytes_have_send - m_write_idx);
-            m_iv[1].iov_len = bytes_to_send;
-        }else{
-            m_iv[0].iov_base = m_write_buf + bytes_have_send;
-            m_iv[0].iov_len -= temp;
+        if(temp == 0 && !m_iv[m_iv_index].iov_base){
+            //文件在发送期间被截断了，已经发出的Content-Length无法兑现，只能关闭连接
+            unmap();
+            return false;
         }
 
-        if(bytes_to_send <= 0){
+        if(!consume(temp)){
             //没有数据要发了
-            unmap();
-            modfd(m_epollfd, m_sockfd, EPOLLIN);
-
-            if(m_linger){
-                init();
-                return true;
-            }else{
+            if(!finish_write()){
                 return false;
             }
+            //读缓冲区里还有请求时由reactor直接交给process()，这时不能重新注册读事件
+            if(!m_pipelined){
+                modfd(m_epollfd, m_sockfd, EPOLLIN);
+            }
+            return true;
         }
+    }
+}
 
+// 已经写出n个字节，调整iovec指向剩下的数据，返回是否还有数据要发送。
+// sendfile发送的块由内核推进m_file_offsets，这里只减少剩下的长度
+bool http_conn::consume(long long n){
+    if(m_accept_time && n > 0){
+        stats::local()->record(STAGE_FIRST_BYTE, get_ns_time() - m_accept_time);
+        m_accept_time = 0;
+    }
+    bytes_have_send += n;
+    bytes_to_send -= n;
 
+    while(m_iv_index < m_iv_count && (long long)m_iv[m_iv_index].iov_len <= n){
+        n -= m_iv[m_iv_index].iov_len;
+        m_iv[m_iv_index].iov_len = 0;
+        m_iv_index++;
+    }
+    if(m_iv_index < m_iv_count && n > 0){
+        if(m_iv[m_iv_index].iov_base){
+            m_iv[m_iv_index].iov_base = (char*)m_iv[m_iv_index].iov_base + n;
+        }
+        m_iv[m_iv_index].iov_len -= n;
     }
+    return bytes_to_send > 0;
 }
-//释放内存映射
+
+// 排队的响应都发送完毕，释放内存映射，返回是否保持连接。
+// io_uring后端不经过consume()，已发送的字节数在bytes_to_send里；epoll后端发完时在bytes_have_send里
+bool http_conn::finish_write(){
+    thread_stats* st = stats::local();
+    long long now = get_ns_time();
+    if(m_accept_time){
+        st->record(STAGE_FIRST_BYTE, now - m_accept_time);
+        m_accept_time = 0;
+    }
+    st->record(STAGE_WRITE, now - m_write_time);
+    st->add(COUNTER_BYTES_OUT, bytes_to_send + bytes_have_send);
+    unmap();
+    if(m_keep_alive){
+        reset_response();
+        return true;
+    }
+    return false;
+}
+
+// 把在别处收到的数据(比如io_uring提供的缓冲区)追加到读缓冲区，放不下返回false
+bool http_conn::feed(const char* data, int len){
+    if(!reserve_read(len)){
+        return false;
+    }
+    memcpy(m_read_buf + m_read_idx, data, len);
+    m_read_idx += len;
+    stats::local()->add(COUNTER_BYTES_IN, len);
+    return true;
+}
+
+// 尽力发送预先拼好的503响应，socket是非阻塞的，发不出去也不重试
+void http_conn::reject(){
+    stats::local()->add(COUNTER_REJECTED);
+    send(m_sockfd, error_503_response, error_503_len, MSG_NOSIGNAL);
+}
+
+// 和reject()一样回复503，但是运行在工作线程中，连接只能由所属的reactor关闭，
+// 所以和process()失败时一样只关闭socket的读写，reactor收到EPOLLRDHUP后关闭连接
+void http_conn::shed(){
+    stats::local()->add(COUNTER_SHED);
+    send(m_sockfd, error_503_response, error_503_len, MSG_NOSIGNAL);
+    int epollfd = m_epollfd;
+    int sockfd = m_sockfd;
+    m_busy = false;
+    shutdown(sockfd, SHUT_RDWR);
+    modfd(epollfd, sockfd, EPOLLIN);
+}
+
+//释放对缓存文件和缓存响应的引用，映射和文件描述符由缓存在没有引用时关闭
 void http_conn::unmap(){
-    if(m_file_address){
-        munmap(m_file_address, m_file_stat.st_size);
-        m_file_address = 0;
+    if(m_object){
+        object_cache::release(m_object);
+        m_object = NULL;
+    }
+    if(m_file){
+        file_cache::release(m_file);
+        m_file = NULL;
+    }
+    for(int i = 0; i < m_response_count; i++){
+        object_cache::release(m_objects[i]);
+        file_cache::release(m_files[i]);
     }
+    m_response_count = 0;
+    m_file_address = 0;
+    m_file_fd = -1;
 }
 
 
@@ -283,31 +516,32 @@ http_conn::HTTP_CODE http_conn::process_read(){
 }
 
 // 解析HTTP请求行，获得请求方法，目标URL，HTTP版本
+// 分隔方法、URL和版本的两个空格在parse_line()找行尾时已经找到了
 http_conn::HTTP_CODE http_conn::parse_request_line(char * text){
     
     //  GET /index.html HTTP/1.1
-    m_url = strpbrk(text, " \t");   // 判断第二个参数中的字符哪个在text中最先出现
+    if(m_line.m_space[1] == -1){
+        return BAD_REQUEST;
+    }
+    char * method = text;
+    m_url = m_read_buf + m_line.m_space[0];
+    m_version = m_read_buf + m_line.m_space[1];
     
     // GET\0/index.html HTTP/1.1
     *m_url++ = '\0'; // 置位空字符，\0为字符串结束符
-
-    char * method = text;
     //  strcasecmp方法比较成功了是返回0
-    if( strcasecmp(method, "GET") == 0){    
+    if( m_url - method == 4 && strcasecmp(method, "GET") == 0){    
         m_method = GET;
     }else{
         return BAD_REQUEST;
     }
-    //  /index.html HTTP/1.1
-    m_version = strpbrk(m_url, " \t");
-    if(!m_version){
-        return BAD_REQUEST;
-    }
     //  /index.html\0HTTP/1.1
     *m_version++ = '\0';
     if(strcasecmp(m_version, "HTTP/1.1") != 0){
         return BAD_REQUEST;
     }
+    //HTTP/1.1默认保持连接，除非请求头里有Connection: close
+    m_linger = true;
     //只比较7个字符，因为有的可能是http://192.168.110.129:10000/index.html
     if(strncasecmp(m_url, "http://", 7) == 0){
         m_url += 7;
@@ -322,7 +556,9 @@ http_conn::HTTP_CODE http_conn::parse_request_line(char * text){
 
     return NO_REQUEST;
 }   
+
 // 解析HTTP请求的一个头部信息
+// 字段的名字和值只记录在m_headers中(指向读缓冲区，不复制)，认识的字段按完美哈希得到的编号分派处理
 http_conn::HTTP_CODE http_conn::parse_headers(char * text){
      //遇到空行，表示头部字段解析完毕
      if( text[0] == '\0'){
@@ -334,28 +570,68 @@ http_conn::HTTP_CODE http_conn::parse_headers(char * text){
         }
         //否则就说明我们已经得到了一个完整的HTTP请求
         return GET_REQUEST;
-     }else if( strncasecmp(text, "Connection:", 11) == 0){
-        //处理Connection头部字段， Connection:keep-alive
-        text += 11;
-        //strspn(text, " \t") 表示从text开始有连续多少个字符在" \t"能找到
-        //比如说Connection:keep-alive
-        //在"Connection:" 和 "keep-alive" 可能会有多个空格或者tab，需要跳过这些。
-        text += strspn(text, " \t"); 
-        if( strcasecmp(text, "keep-alive") == 0 ){
-            m_linger = true;
-        }
-     }else if( strncasecmp (text, "Content-Length:", 15) == 0){
-        // 处理Content-Length头部字段
-        text += 15;
-        text += strspn(text, " \t");
-        m_content_length = atol(text);
-     }else if( strncasecmp (text, "Host:", 5) == 0){
-        // 处理Host头部字段
-        text += 5;
-        text += strspn(text, "\t");
-        m_host = text;
-     }else{
-        //printf("oop! unknow header %s\n",text);
+     }
+     //没有冒号的行不是头部字段，忽略
+     if(m_line.m_colon == -1){
+        return NO_REQUEST;
+     }
+     //冒号的位置在扫描这一行时已经找到，这一行结尾的"\r\n"在m_check_index之前
+     char* name = text;
+     int name_len = m_line.m_colon - (text - m_read_buf);
+     char* value = m_read_buf + m_line.m_colon + 1;
+     char* end = m_read_buf + m_check_index - 2;
+     //去掉值前后的空格和tab，结尾处写'\0'，值仍然可以当作字符串使用
+     value += strspn(value, " \t");
+     while(end > value && (end[-1] == ' ' || end[-1] == '\t')){
+        --end;
+     }
+     *end = '\0';
+
+     HEADER_ID id;
+     if(!m_headers.add(name, name_len, value, end - value, id)){
+        //头部字段太多
+        return BAD_REQUEST;
+     }
+     switch(id){
+        case HDR_CONNECTION: {
+            //处理Connection头部字段， Connection:keep-alive
+            //值是逗号分隔的列表，比如 "keep-alive, Upgrade"，只关心close和keep-alive
+            text = value;
+            while(*text){
+                //strspn(text, " \t,") 表示从text开始有连续多少个字符在" \t,"能找到
+                text += strspn(text, " \t,");
+                size_t len = strcspn(text, " \t,");
+                if(len == 5 && strncasecmp(text, "close", 5) == 0){
+                    m_linger = false;
+                }else if(len == 10 && strncasecmp(text, "keep-alive", 10) == 0){
+                    m_linger = true;
+                }
+                text += len;
+            }
+            break;
+        }
+        case HDR_CONTENT_LENGTH: {
+            // 处理Content-Length头部字段。只接受十进制数字，请求体也不能超过最大的读缓冲区，
+            // 负数或者溢出的长度会让请求的结尾落在读缓冲区之外
+            size_t len = end - value;
+            if(len == 0 || len > 9 || strspn(value, "0123456789") != len){
+                return BAD_REQUEST;
+            }
+            m_content_length = atol(value);
+            if(m_content_length > buffer_pool::MAX_SIZE){
+                return BAD_REQUEST;
+            }
+            break;
+        }
+        case HDR_ACCEPT_ENCODING: {
+            // 处理Accept-Encoding头部字段，只关心gzip和br
+            m_accept_encoding = parse_accept_encoding(value);
+            break;
+        }
+        default: {
+            //其他字段(包括Host)只记录在m_headers中，需要时按编号查找
+            break;
+        }
      }
      
      return NO_REQUEST;
@@ -365,208 +641,588 @@ http_conn::HTTP_CODE http_conn::parse_content(char * text){
     //如果 "从读缓冲区中读到的数据" 大于等于 "我请求体的数据" + "我当前已经检查的数据"
     //注意能走到这一步说明 "我当前已经检查的数据" 是包含请求行和请求头的
     //所以如果 >= 成立，说明从缓冲区中读到的数据包含了 请求行，请求头和请求体了
+    //请求体后面可能紧跟着流水线上的下一个请求，不能在它的结尾写'\0'
     if( m_read_idx >= ( m_content_length + m_check_index) ){
-        text[m_content_length] = '\0';
         return GET_REQUEST;
     }
     return NO_REQUEST;
 }
 //解析一行，判断依据是\r\n
+//scan_line()一次扫描找到行尾，同时记下行中的空格和冒号，解析请求行和头部字段时不需要再扫描一遍。
+//数据不完整时m_check_index停在已经扫描过的位置，下次从那里继续
 http_conn::LINE_STATUS http_conn::parse_line(){
 
-    char temp;
     // m_read_idx 在read()函数里读取用户信息以后才会增加，
-    for(; m_check_index < m_read_idx; ++m_check_index){
-        temp = m_read_buf[m_check_index];
-        if( temp == '\r' ){
-            if( m_check_index + 1 == m_read_idx){
-                return LINE_OPEN;
-            }else if(m_read_buf[m_check_index + 1] == '\n'){
-                m_read_buf[m_check_index++] = '\0';
-                m_read_buf[m_check_index++] = '\0';
-                return LINE_OK;
-            }
-            return LINE_BAD;
-        }else if(temp == '\n'){
-            if((m_check_index > 1) && (m_read_buf[m_check_index - 1] == '\r')){
-                m_read_buf[m_check_index - 1] = '\0';
-                m_read_buf[m_check_index ++ ] = '\0';
-                return LINE_OK;
-            }
-            return LINE_BAD;
+    m_check_index = scan_line(m_read_buf, m_check_index, m_read_idx, m_tokens);
+    if(m_check_index == m_read_idx){
+        //前面都未返回，说明数据不完整
+        return LINE_OPEN;
+    }
+    if(m_read_buf[m_check_index] == '\r'){
+        if( m_check_index + 1 == m_read_idx){
+            //'\n'还没有收到，下次从'\r'开始重新判断
+            return LINE_OPEN;
+        }else if(m_read_buf[m_check_index + 1] == '\n'){
+            m_read_buf[m_check_index++] = '\0';
+            m_read_buf[m_check_index++] = '\0';
+            m_line = m_tokens;
+            reset_tokens(m_tokens);
+            return LINE_OK;
         }
     }
-    //前面都未返回，说明数据不完整
-    return LINE_OPEN;
+    //单独的'\r'或者'\n'
+    return LINE_BAD;
 }
-// 当得到一个完整、正确的HTTP请求时，我们就分析目标文件的属性，
-// 如果目标文件存在、对所有用户可读，且不是目录，则使用mmap将其
-// 映射到内存地址m_file_address处，并告诉调用者获取文件成功
+// 当得到一个完整、正确的HTTP请求时，我们就从文件缓存中查找目标文件，
+// 如果目标文件存在、对所有用户可读，且不是目录，小文件使用缓存中的映射m_file_address，
+// 大文件使用缓存中打开的文件描述符，由write()用sendfile发送，并告诉调用者获取文件成功。
+// 文本文件在客户端接受压缩时，依次尝试预先压缩好的.br/.gz文件和后台压缩好的结果，都没有时发送原始内容
 http_conn::HTTP_CODE http_conn::do_request(){
-    // "/home/nowcoder/webserver1/resources"
-    strcpy(m_real_file, doc_root);
-    int len = strlen(doc_root);
-    strncpy(m_real_file + len, m_url, FILENAME_LEN - len - 1);
-    //获取m_real_file文件的相关的状态信息，-1失败，0成功
-    if(stat(m_real_file, &m_file_stat) < 0){
-        return NO_RESOURCE;
+    m_request_time = get_ns_time();
+    if(strcmp(m_url, STATS_URL) == 0){
+        return STATS_REQUEST;
+    }
+    bool compressible = false;
+    const char* type = mime_type(m_url, compressible);
+    //Range请求发送原始内容中的几段，不压缩，也不使用拼好的完整响应
+    bool ranged = m_headers.get(HDR_RANGE) != NULL;
+    bool encode = compressible && m_accept_encoding && !ranged;
+
+    //热点小文件的完整响应已经拼好了，直接使用。响应缓存里只有原始内容，要压缩的请求不查它
+    if(!encode && !ranged){
+        m_object = m_object_cache.acquire(m_url);
+        if(m_object){
+            m_content_type = type;
+            m_compressible = compressible;
+            set_validators(m_object->m_file->m_stat);
+            if(not_modified()){
+                object_cache::release(m_object);
+                m_object = NULL;
+                return NOT_MODIFIED;
+            }
+            m_file_stat.st_size = m_object->m_len - m_object->m_header_len;
+            return FILE_REQUEST;
+        }
     }
 
-    //判断访问权限，如果没有权限就返回FORBIDDEN_REQUEST
-    if( !(m_file_stat.st_mode & S_IROTH) ){
-        return FORBIDDEN_REQUEST;
+    //缓存命中时不需要拼接路径、stat、open和mmap，引用在响应发完后由unmap()释放
+    m_file = m_file_cache.acquire(m_url);
+    if(!m_file){
+        return INTERNAL_ERROR;
+    }
+    switch(m_file->m_status){
+        case FILE_MISSING:
+            return NO_RESOURCE;
+        //没有权限就返回FORBIDDEN_REQUEST
+        case FILE_FORBIDDEN:
+            return FORBIDDEN_REQUEST;
+        //如果是目录则返回BAD_REQUEST
+        case FILE_DIRECTORY:
+            return BAD_REQUEST;
+        case FILE_ERROR:
+            return INTERNAL_ERROR;
+        default:
+            break;
+    }
+    m_content_type = type;
+    m_compressible = compressible;
+
+    //验证器由原始文件决定，换成预先压缩好的文件以后也一样，只是ETag带上编码的后缀
+    struct stat origin = m_file->m_stat;
+    if(encode && !use_sidecar(ACCEPT_BR, ".br", ENCODING_BR) && !use_sidecar(ACCEPT_GZIP, ".gz", ENCODING_GZIP)){
+        m_object = m_compressor.acquire(m_url, m_accept_encoding, m_encoding);
+        if(!m_object){
+            //交给后台线程压缩，这次先发送原始内容
+            m_compressor.submit(m_url, m_file, m_accept_encoding);
+        }
+    }
+    set_validators(origin);
+    if(not_modified()){
+        file_cache::release(m_file);
+        m_file = NULL;
+        object_cache::release(m_object);
+        m_object = NULL;
+        return NOT_MODIFIED;
+    }
+    if(m_object){
+        //压缩结果里只有内容，它自己持有原始文件的引用
+        m_file_stat = m_file->m_stat;
+        m_file_stat.st_size = m_object->m_len;
+        file_cache::release(m_file);
+        m_file = NULL;
+        return FILE_REQUEST;
     }
+    m_file_stat = m_file->m_stat;
+    m_file_address = m_file->m_addr;
+    m_file_fd = m_file->m_fd;
+    //多个响应共用缓存中的文件描述符，sendfile使用各自的偏移(m_file_offsets)，不改变文件本身的读写位置
+    if(ranged){
+        return select_ranges();
+    }
+    return FILE_REQUEST;
 
-    //判断是否是目录，如果是目录则返回BAD_REQUEST
-    if( S_ISDIR( m_file_stat.st_mode ) ){
-        return BAD_REQUEST;
+}
+
+void http_conn::set_validators(const struct stat& st){
+    const char* suffix = NULL;
+    if(m_encoding == ENCODING_GZIP){
+        suffix = "-gz";
+    }else if(m_encoding == ENCODING_BR){
+        suffix = "-br";
     }
+    m_etag_len = make_etag(m_etag, st, suffix, m_weak_etag);
+    m_last_modified = st.st_mtime;
+    m_max_age = cache_max_age(m_url);
+}
 
-    //以只读方式打开文件，这个文件就是浏览器请求的文件
-    int fd = open(m_real_file, O_RDONLY);
-    //创建内存映射，这个内存映射会在process_write()函数和write()函数中会用到，用以写出给浏览器
-    m_file_address = (char *)mmap(0, m_file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
-    close(fd);
-    return FILE_REQUEST;
+// 有If-None-Match时只看它，否则看If-Modified-Since(Last-Modified只精确到秒)
+bool http_conn::not_modified(){
+    const header_field* field = m_headers.get(HDR_IF_NONE_MATCH);
+    if(field){
+        return etag_matches(field->m_value.m_ptr, field->m_value.m_len, m_etag, m_etag_len);
+    }
+    field = m_headers.get(HDR_IF_MODIFIED_SINCE);
+    if(field){
+        time_t since = parse_http_date(field->m_value.m_ptr, field->m_value.m_len);
+        return since != -1 && m_last_modified <= since;
+    }
+    return false;
+}
 
+// If-Range不匹配时文件已经变了，客户端手里的部分没有用，发送整个文件；
+// Range格式不对或者段太多时也发送整个文件；所有段都在文件末尾之后时回复416
+http_conn::HTTP_CODE http_conn::select_ranges(){
+    const header_field* field = m_headers.get(HDR_IF_RANGE);
+    if(field && !if_range_matches(field->m_value.m_ptr, field->m_value.m_len, m_etag, m_etag_len, m_last_modified)){
+        return FILE_REQUEST;
+    }
+    field = m_headers.get(HDR_RANGE);
+    m_range_count = parse_ranges(field->m_value.m_ptr, field->m_value.m_len, m_file_stat.st_size, m_ranges, MAX_RANGES);
+    if(m_range_count == 0){
+        return FILE_REQUEST;
+    }
+    if(m_range_count < 0){
+        m_range_count = 0;
+        file_cache::release(m_file);
+        m_file = NULL;
+        m_file_address = 0;
+        m_file_fd = -1;
+        return RANGE_NOT_SATISFIABLE;
+    }
+    return PARTIAL_CONTENT;
 }
 
+// 如果客户端接受这种编码，并且存在比原始文件新的url+suffix，就改为发送它
+bool http_conn::use_sidecar(int accept, const char* suffix, CONTENT_ENCODING encoding){
+    if(!(m_accept_encoding & accept)){
+        return false;
+    }
+    char path[256];
+    if(snprintf(path, sizeof(path), "%s%s", m_url, suffix) >= (int)sizeof(path)){
+        return false;
+    }
+    //不存在的文件也会缓存下来，所以没有压缩文件时这里不会每次都stat
+    file_entry* sidecar = m_file_cache.acquire(path);
+    if(!sidecar){
+        return false;
+    }
+    if(sidecar->m_status != FILE_OK || sidecar->m_stat.st_mtime < m_file->m_stat.st_mtime){
+        file_cache::release(sidecar);
+        return false;
+    }
+    file_cache::release(m_file);
+    m_file = sidecar;
+    m_encoding = encoding;
+    return true;
+}
 
-// 根据服务器处理HTTP请求的结果，决定返回给客户端的内容
+// 根据服务器处理HTTP请求的结果，决定返回给客户端的内容。
+// 响应追加在已经排队的响应后面：响应头接着写在m_write_buf中，iovec也接在后面
 bool http_conn::process_write(HTTP_CODE ret) {
+    int start = m_write_idx;
     switch (ret)
     {
         case INTERNAL_ERROR:
-            //处理响应请求行，并写会给用户端
-            add_status_line( 500, error_500_title );
-            //处理响应请求头，并写会给用户端
-            add_headers( strlen( error_500_form ) );
-            if ( ! add_content( error_500_form ) ) {
+            //错误页面的状态行和内容都是预先准备好的
+            if ( ! add_error( STATUS_500 ) ) {
                 return false;
             }
             break;
         case BAD_REQUEST:
-            add_status_line( 400, error_400_title );
-            add_headers( strlen( error_400_form ) );
-            if ( ! add_content( error_400_form ) ) {
+            if ( ! add_error( STATUS_400 ) ) {
                 return false;
             }
             break;
         case NO_RESOURCE:
-            add_status_line( 404, error_404_title );
-            add_headers( strlen( error_404_form ) );
-            if ( ! add_content( error_404_form ) ) {
+            if ( ! add_error( STATUS_404 ) ) {
                 return false;
             }
             break;
         case FORBIDDEN_REQUEST:
-            add_status_line( 403, error_403_title );
-            add_headers(strlen( error_403_form));
-            if ( ! add_content( error_403_form ) ) {
+            if ( ! add_error( STATUS_403 ) ) {
                 return false;
             }
             break;
-        case FILE_REQUEST:
-            add_status_line(200, ok_200_title );
-            add_headers(m_file_stat.st_size);
-            m_iv[ 0 ].iov_base = m_write_buf;
-            m_iv[ 0 ].iov_len = m_write_idx;
-            m_iv[ 1 ].iov_base = m_file_address;
-            m_iv[ 1 ].iov_len = m_file_stat.st_size;
-            m_iv_count = 2;
-            //m_write_idx是请求行和请求头的大小，
+        case RANGE_NOT_SATISFIABLE:
+            if ( ! add_status_line( STATUS_416 ) || ! add_literal( "Content-Range: bytes */" )
+                || ! add_number( m_file_stat.st_size ) || ! add_literal( "\r\n" ) || ! add_headers( 0 ) ) {
+                return false;
+            }
+            break;
+        case PARTIAL_CONTENT:
+            return add_partial(start);
+        case STATS_REQUEST:
+            return add_stats();
+        case NOT_MODIFIED:
+            //304没有消息体，也不发送Content-Length和Content-Encoding，只有验证器、缓存控制和Vary
+            m_encoding = ENCODING_IDENTITY;
+            if(!add_status_line(STATUS_304) || !add_validators() || !add_content_encoding()
+                || !add_linger() || !add_blank_line()){
+                return false;
+            }
+            break;
+        case FILE_REQUEST: {
+            //状态行和Date每次都要重新写，后面的头部字段可以来自缓存的响应
+            if(!add_status_line(STATUS_200)){
+                return false;
+            }
+            int fields = m_write_idx;
+            if(m_object && m_object->m_header_len > 0 && m_linger){
+                //缓存的响应就是保持连接版本的头部字段和内容，和状态行一起用两个iovec发出
+                m_iv[ m_iv_count ].iov_base = m_write_buf + start;
+                m_iv[ m_iv_count ].iov_len = m_write_idx - start;
+                m_iv_count++;
+                m_iv[ m_iv_count ].iov_base = m_object->m_data;
+                m_iv[ m_iv_count ].iov_len = m_object->m_len;
+                m_iv_count++;
+                bytes_to_send += m_write_idx - start + m_object->m_len;
+                return true;
+            }
+            if(m_object){
+                //要关闭连接，或者是只有内容的压缩结果，重新生成响应头，文件内容仍然用缓存中的
+                m_file_address = m_object->m_data + m_object->m_header_len;
+            }
+            if(!add_headers(m_file_stat.st_size)){
+                return false;
+            }
+            m_iv[ m_iv_count ].iov_base = m_write_buf + start;
+            m_iv[ m_iv_count ].iov_len = m_write_idx - start;
+            m_iv_count++;
+            add_body(0, m_file_stat.st_size);
+            //m_write_idx - start是请求行和请求头的大小，
             //m_file_stat.st_size是请求的文件内容的的大小,在这里就是index.html的内容大小
-            bytes_to_send = m_write_idx + m_file_stat.st_size;
+            bytes_to_send += m_write_idx - start + m_file_stat.st_size;
 
+            if(!m_object && m_linger && m_file && m_encoding == ENCODING_IDENTITY){
+                //把保持连接版本的头部字段(不含状态行和Date)和内容交给响应缓存，是否留下由它的准入策略决定。压缩过的响应不放进去
+                m_object_cache.insert(m_url, m_file, m_write_buf + fields, m_write_idx - fields);
+            }
             return true;
+        }
         default:
             return false;
     }
 
-    m_iv[ 0 ].iov_base = m_write_buf;
-    m_iv[ 0 ].iov_len = m_write_idx;
-    m_iv_count = 1;
-    bytes_to_send = m_write_idx;
+    m_iv[ m_iv_count ].iov_base = m_write_buf + start;
+    m_iv[ m_iv_count ].iov_len = m_write_idx - start;
+    m_iv_count++;
+    bytes_to_send += m_write_idx - start;
     return true;
 }
 
-bool http_conn::add_status_line( int status, const char* title ) {
-    return add_response( "%s %d %s\r\n", "HTTP/1.1", status, title );
+void http_conn::add_body(long long offset, long long len){
+    if(len == 0){
+        return;
+    }
+    if(m_file_address){
+        m_iv[ m_iv_count ].iov_base = m_file_address + offset;
+    }else{
+        m_iv[ m_iv_count ].iov_base = NULL;
+        m_file_offsets[ m_iv_count ] = offset;
+    }
+    m_iv[ m_iv_count ].iov_len = len;
+    m_iv_count++;
+}
+
+// "bytes 0-99/1000"
+bool http_conn::add_content_range(const byte_range& range, long long size){
+    return add_literal("Content-Range: bytes ") && add_number(range.m_start) && add_literal("-")
+        && add_number(range.m_end) && add_literal("/") && add_number(size) && add_literal("\r\n");
+}
+
+// 只发送请求的几段，不需要的部分既不映射也不读取。
+// 多段时先在写缓冲区中写好每段的分隔行和段头，算出总长度以后再写响应头，iovec按响应头、(段头、内容)*n、结束行的顺序排列
+bool http_conn::add_partial(int start){
+    long long size = m_file_stat.st_size;
+    if(m_range_count == 1){
+        long long len = m_ranges[0].m_end - m_ranges[0].m_start + 1;
+        if(!add_status_line(STATUS_206) || !add_content_range(m_ranges[0], size) || !add_headers(len)){
+            return false;
+        }
+        m_iv[ m_iv_count ].iov_base = m_write_buf + start;
+        m_iv[ m_iv_count ].iov_len = m_write_idx - start;
+        m_iv_count++;
+        add_body(m_ranges[0].m_start, len);
+        bytes_to_send += m_write_idx - start + len;
+        return true;
+    }
+
+    //分隔串由连接的代数和请求序号组成，同一个连接上的响应各不相同
+    char boundary[32];
+    int boundary_len = format_hex(boundary, ((unsigned long long)m_generation << 32) | (unsigned)m_request_count);
+    int parts[MAX_RANGES + 1];
+    long long total = 0;
+    for(int i = 0; i < m_range_count; i++){
+        parts[i] = m_write_idx;
+        if(!add_literal("\r\n--") || !append(boundary, boundary_len) || !add_literal("\r\nContent-Type: ")
+            || !append(m_content_type, strlen(m_content_type)) || !add_literal("\r\n")
+            || !add_content_range(m_ranges[i], size) || !add_literal("\r\n")){
+            return false;
+        }
+        total += m_ranges[i].m_end - m_ranges[i].m_start + 1;
+    }
+    parts[m_range_count] = m_write_idx;
+    if(!add_literal("\r\n--") || !append(boundary, boundary_len) || !add_literal("--\r\n")){
+        return false;
+    }
+    int head = m_write_idx;
+    total += head - start;
+
+    char type[64] = "multipart/byteranges; boundary=";
+    int type_len = strlen(type);
+    memcpy(type + type_len, boundary, boundary_len);
+    type[type_len + boundary_len] = '\0';
+    const char* part_type = m_content_type;
+    m_content_type = type;
+    bool ok = add_status_line(STATUS_206) && add_headers(total);
+    m_content_type = part_type;
+    if(!ok){
+        return false;
+    }
+    m_iv[ m_iv_count ].iov_base = m_write_buf + head;
+    m_iv[ m_iv_count ].iov_len = m_write_idx - head;
+    m_iv_count++;
+    for(int i = 0; i < m_range_count; i++){
+        m_iv[ m_iv_count ].iov_base = m_write_buf + parts[i];
+        m_iv[ m_iv_count ].iov_len = parts[i + 1] - parts[i];
+        m_iv_count++;
+        add_body(m_ranges[i].m_start, m_ranges[i].m_end - m_ranges[i].m_start + 1);
+    }
+    m_iv[ m_iv_count ].iov_base = m_write_buf + parts[m_range_count];
+    m_iv[ m_iv_count ].iov_len = head - parts[m_range_count];
+    m_iv_count++;
+    bytes_to_send += m_write_idx - head + total;
+    return true;
 }
 
-bool http_conn::add_headers(int content_len) {
-    add_content_length(content_len);
-    add_content_type();
-    add_linger();
-    add_blank_line();
+// 统计信息先写在写缓冲区里，知道长度以后再写响应头，iovec中响应头在前
+bool http_conn::add_stats() {
+    int body = m_write_idx;
+    while(true){
+        if(!m_write_buf && !grow_write()){
+            return false;
+        }
+        int room = m_write_size - m_write_idx;
+        int len = stats::render(m_write_buf + m_write_idx, room, m_user_count.load());
+        if(len < room){
+            m_write_idx += len;
+            break;
+        }
+        if(!grow_write()){
+            return false;
+        }
+    }
+    int head = m_write_idx;
+    m_content_type = "text/plain; version=0.0.4";
+    if(!add_status_line(STATUS_200) || !add_literal("Cache-Control: no-store\r\n") || !add_headers(head - body)){
+        return false;
+    }
+    m_iv[ m_iv_count ].iov_base = m_write_buf + head;
+    m_iv[ m_iv_count ].iov_len = m_write_idx - head;
+    m_iv_count++;
+    m_iv[ m_iv_count ].iov_base = m_write_buf + body;
+    m_iv[ m_iv_count ].iov_len = head - body;
+    m_iv_count++;
+    bytes_to_send += m_write_idx - body;
     return true;
 }
 
-bool http_conn::add_content_length(int content_len) {
-    return add_response( "Content-Length: %d\r\n", content_len);
+// 状态行来自预先拼好的表，后面紧跟着本线程缓存的Date
+bool http_conn::add_status_line( HTTP_STATUS status ) {
+    stats::local()->count_status(status);
+    int date_len = 0;
+    const char* date = date_header(date_len);
+    return append( status_table[status].m_line, status_table[status].m_line_len ) && append( date, date_len );
 }
 
-bool http_conn::add_linger()
-{
-    return add_response( "Connection: %s\r\n", ( m_linger == true ) ? "keep-alive" : "close" );
+// 错误页面：状态行、头部字段和预先准备好的内容
+bool http_conn::add_error( HTTP_STATUS status ) {
+    return add_status_line( status ) && add_headers( status_table[status].m_body_len )
+        && append( status_table[status].m_body, status_table[status].m_body_len );
 }
 
-bool http_conn::add_blank_line()
+bool http_conn::add_headers(long long content_len) {
+    return add_content_length(content_len) && add_content_type() && add_content_encoding()
+        && add_validators() && add_linger() && add_blank_line();
+}
+
+bool http_conn::add_content_length(long long content_len) {
+    return add_literal( "Content-Length: " ) && add_number( content_len ) && add_literal( "\r\n" );
+}
+
+bool http_conn::add_linger()
 {
-    return add_response( "%s", "\r\n" );
+    if( m_linger ){
+        return add_literal( "Connection: keep-alive\r\n" );
+    }
+    return add_literal( "Connection: close\r\n" );
 }
 
-bool http_conn::add_content( const char* content )
+bool http_conn::add_blank_line()
 {
-    return add_response( "%s", content );
+    return add_literal( "\r\n" );
 }
 
 bool http_conn::add_content_type() {
-    return add_response("Content-Type:%s\r\n", "text/html");
+    return add_literal( "Content-Type: " ) && append( m_content_type, strlen( m_content_type ) ) && add_literal( "\r\n" );
 }
 
-// 往写缓冲中写入返回的请求行和请求头
-bool http_conn::add_response( const char* format, ... ) {
-    if( m_write_idx >= WRITE_BUFFER_SIZE ) {
+// 内容可能被压缩时告诉缓存，响应随Accept-Encoding变化
+bool http_conn::add_content_encoding() {
+    if(m_encoding == ENCODING_GZIP && !add_literal("Content-Encoding: gzip\r\n")){
+        return false;
+    }
+    if(m_encoding == ENCODING_BR && !add_literal("Content-Encoding: br\r\n")){
         return false;
     }
-    // 定义一具VA_LIST型的变量，这个变量是指向参数的指针；
-    va_list arg_list;
-    //初始化变量刚定义的VA_LIST变量
-    va_start( arg_list, format );
-    //将arg_list指针所指的参数，按照format格式赋值给m_write_buf数组 ，起点偏移m_write_idx，复制长度为WRITE_BUFFER_SIZE - 1 - m_write_idx
-    //如果成功，返回值就是写入缓存区的字节长度
-    int len = vsnprintf( m_write_buf + m_write_idx, WRITE_BUFFER_SIZE - 1 - m_write_idx, format, arg_list );
-    if( len >= ( WRITE_BUFFER_SIZE - 1 - m_write_idx ) ) {
+    if(m_compressible){
+        return add_literal("Vary: Accept-Encoding\r\n");
+    }
+    return true;
+}
+
+// 文件响应的ETag、Last-Modified和Cache-Control，并告诉客户端可以按字节范围请求，错误页面没有
+bool http_conn::add_validators() {
+    if(m_etag_len == 0){
+        return true;
+    }
+    char date[HTTP_DATE_SIZE];
+    int date_len = format_http_date(date, m_last_modified);
+    if(!add_literal("ETag: ") || !append(m_etag, m_etag_len) || !add_literal("\r\nLast-Modified: ")
+        || !append(date, date_len) || !add_literal("\r\nAccept-Ranges: bytes\r\n")){
         return false;
     }
+    if(m_max_age >= 0){
+        return add_literal("Cache-Control: max-age=") && add_number(m_max_age) && add_literal("\r\n");
+    }
+    return true;
+}
+
+bool http_conn::add_number(long long v) {
+    char buf[24];
+    if(v < 0){
+        buf[0] = '-';
+        return append(buf, 1 + format_decimal(buf + 1, -(unsigned long long)v));
+    }
+    return append(buf, format_decimal(buf, v));
+}
+
+// 往写缓冲区追加len个字节，写缓冲区在第一次写入时才从缓冲区池中取，放不下时增长
+bool http_conn::append( const char* data, int len ) {
+    while( !m_write_buf || m_write_idx + len > m_write_size ) {
+        if( !grow_write() ) {
+            return false;
+        }
+    }
+    memcpy( m_write_buf + m_write_idx, data, len );
     m_write_idx += len;
-    //用VA_END宏结束可变参数的获取。
-    va_end( arg_list );
     return true;
 }
 
 
-// 由线程池中的工作线程调用，这是处理HTTP请求的入口函数
-void http_conn::process(){
+// 由线程池中的工作线程调用，这是处理HTTP请求的入口函数。返回是否生成了要发送的响应
+// 读缓冲区中可能有客户端流水线发来的多个请求，依次解析并把响应排在一起，由write()一次writev发出
+bool http_conn::process(){
 
-    //解析HTTP请求
-    HTTP_CODE read_ret = process_read();
-    if(read_ret == NO_REQUEST){
-        //重置该sockfd的EPOLLIN | EPOLLONESHOT 实践，继续监听
-        modfd(m_epollfd, m_sockfd, EPOLLIN);
-        return;
+    m_pipelined = false;
+    thread_stats* st = stats::local();
+    while(true){
+        //解析HTTP请求，到达do_request()之前是解析的时间，之后是查找文件的时间
+        long long begin = get_ns_time();
+        m_request_time = 0;
+        HTTP_CODE read_ret = process_read();
+        if(read_ret == NO_REQUEST){
+            break;
+        }
+        long long done = get_ns_time();
+        if(m_request_time){
+            st->record(STAGE_PARSE, m_request_time - begin);
+            st->record(STAGE_FILE, done - m_request_time);
+        }else{
+            st->record(STAGE_PARSE, done - begin);
+        }
+        //请求在读缓冲区中结束的位置，后面是流水线上的下一个请求
+        int end = m_check_index + (int)(m_check_state == CHECK_STATE_CONTENT ? m_content_length : 0);
+        m_request_count++;
+        if(read_ret == BAD_REQUEST || (m_max_requests > 0 && m_request_count >= m_max_requests)
+            || m_draining.load(std::memory_order_relaxed)){
+            //格式错误的请求之后找不到下一个请求的开头；达到上限的连接回复之后关闭，让客户端重新连接；
+            //旧进程退出前也这样让客户端转到新进程
+            m_linger = false;
+        }
+
+        //printf("parse request, creat response\n");
+
+        // 生成响应信息，这些信息会在调用write()函数时被写给浏览器
+        bool write_ret = process_write( read_ret );
+        //如果没有成功，就关闭连接，因为只有成功了才有后面的写回操作。
+        //process()可能运行在工作线程中，而连接和它的定时器只能由所属的reactor释放，
+        //所以这里只关闭socket的读写，让reactor收到EPOLLRDHUP后去关闭连接
+        if( !write_ret ){
+            unmap();
+            reset_response();
+            int epollfd = m_epollfd;
+            int sockfd = m_sockfd;
+            m_busy = false;
+            shutdown(sockfd, SHUT_RDWR);
+            modfd( epollfd, sockfd, EPOLLIN);
+            return false;
+        }
+        //响应使用的缓存条目要到发送完才能释放
+        m_files[m_response_count] = m_file;
+        m_objects[m_response_count] = m_object;
+        m_response_count++;
+        m_file = NULL;
+        m_object = NULL;
+        m_keep_alive = m_linger;
+
+        next_request(end);
+        if(!m_keep_alive){
+            //要关闭连接，后面的请求不再处理
+            break;
+        }
+        if(m_response_count >= MAX_PIPELINE || m_file_fd != -1 || m_write_idx + HEADER_RESERVE > buffer_pool::MAX_SIZE
+            || m_iv_count + MAX_RANGES * 2 + 2 > MAX_IOV){
+            //攒不下更多响应了，或者最后一个响应要用sendfile发送，剩下的请求等这批响应发完再处理。
+            //写缓冲区会按需增长，只有快到最大的缓冲区时才因为它停下
+            m_pipelined = m_read_idx > 0;
+            break;
+        }
     }
-    
-    //printf("parse request, creat response\n");
 
-    // 生成响应信息，这些信息会在调用write()函数时被写给浏览器
-    bool write_ret = process_write( read_ret );
-    //如果没有成功，那我就直接关闭连接，因为只有成功了才有后面的写回操作
-    if( !write_ret ){
-        close_conn();
+    //清除标记以后连接随时可能被reactor关闭并回收，之后只使用局部变量，不再访问连接对象
+    m_write_time = get_ns_time();
+    int epollfd = m_epollfd;
+    int sockfd = m_sockfd;
+    bool has_response = m_response_count > 0;
+    m_busy = false;
+    if(!has_response){
+        //重置该sockfd的EPOLLIN | EPOLLONESHOT 实践，继续监听
+        modfd(epollfd, sockfd, EPOLLIN);
+        return false;
     }
-    modfd( m_epollfd, m_sockfd, EPOLLOUT);
+    modfd( epollfd, sockfd, EPOLLOUT);
+    return true;
 } 
 
 
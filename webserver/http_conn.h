@@ -13,21 +13,35 @@
 #include <arpa/inet.h>
 #include <sys/stat.h>
 #include <sys/mman.h>
-#include <stdarg.h>
 #include <errno.h>
 #include "locker.h"
 #include <sys/uio.h>
+#include <sys/sendfile.h>
 #include <string.h>
 #include "lst_timer.h"
+#include "file_cache.h"
+#include "object_cache.h"
+#include "compressor.h"
+#include "buffer_pool.h"
+#include "tokenizer.h"
+#include "header_table.h"
+#include "http_cache.h"
+#include "http_response.h"
+#include "log.h"
+#include "stats.h"
+#include <atomic>
 
 
 class http_conn{
 
 public:
 
-    static const int FILENAME_LEN = 200;
-    static const int READ_BUFFER_SIZE = 2048;  //读缓冲区的大小
-    static const int WRITE_BUFFER_SIZE = 1024; //写缓冲区的大小
+    static const int READ_BUFFER_SIZE = 2048;  //读缓冲区开始的大小，请求头更大时翻倍增长，最大到buffer_pool::MAX_SIZE
+    static const int WRITE_BUFFER_SIZE = 1024; //写缓冲区开始的大小，同样可以增长
+    static const int MAX_PIPELINE = 8;         //流水线上最多攒多少个响应一起发送
+    static const int HEADER_RESERVE = 512;     //写缓冲区增长到最大以后剩余空间少于这个值时不再攒下一个响应
+    static const int MAX_RANGES = 8;           //一个Range请求最多满足多少段，更多时发送整个文件
+    static const int MAX_IOV = MAX_PIPELINE * 2 + MAX_RANGES * 2 + 2;  //普通响应占两块，多段响应占2 * 段数 + 2块
 
     // HTTP请求方法，这里只支持GET
     enum METHOD {GET = 0, POST, HEAD, PUT, DELETE, TRACE, OPTIONS, CONNECT};
@@ -52,27 +66,54 @@ public:
         NO_RESOURCE         :   表示服务器没有资源
         FORBIDDEN_REQUEST   :   表示客户对资源没有足够的访问权限
         FILE_REQUEST        :   文件请求,获取文件成功
+        NOT_MODIFIED        :   条件请求，客户端缓存的文件没有变化，只回复响应头
+        PARTIAL_CONTENT     :   Range请求，发送文件中的一段或几段
+        RANGE_NOT_SATISFIABLE : Range请求的段都在文件末尾之后
+        STATS_REQUEST       :   请求的是统计信息，由stats生成，不访问文件
         INTERNAL_ERROR      :   表示服务器内部错误
         CLOSED_CONNECTION   :   表示客户端已经关闭连接了
     */
-    enum HTTP_CODE { NO_REQUEST, GET_REQUEST, BAD_REQUEST, NO_RESOURCE, FORBIDDEN_REQUEST, FILE_REQUEST, INTERNAL_ERROR, CLOSED_CONNECTION };
+    enum HTTP_CODE { NO_REQUEST, GET_REQUEST, BAD_REQUEST, NO_RESOURCE, FORBIDDEN_REQUEST, FILE_REQUEST, NOT_MODIFIED, PARTIAL_CONTENT, RANGE_NOT_SATISFIABLE, STATS_REQUEST, INTERNAL_ERROR, CLOSED_CONNECTION };
     
 public:
-    http_conn(){}
-    ~http_conn(){}
+    http_conn(): m_sockfd(-1), m_generation(0), m_busy(false), m_read_buf(NULL), m_read_size(0), m_write_buf(NULL), m_write_size(0),
+        m_file(NULL), m_object(NULL), m_response_count(0), m_file_address(0), m_file_fd(-1){}
+    ~http_conn(){ release_buffers(); }
 
 public:
     //处理客户端请求
-    void process(); //解析http请求，将响应信息返回由主线程进行写出
-    void init(int sockfd, const sockaddr_in & addr);  //初始化新接收的连接
+    bool process(); //解析http请求，将响应信息返回由主线程进行写出
+    void init(int sockfd, const sockaddr_in & addr, int epollfd);  //初始化新接收的连接
     void close_conn();  //关闭连接
-    bool read(client_data* &users2, int sockfd, sort_timer_lst &timer_lst, void(cb_func)(client_data*), int TIMESLOT );   //非阻塞的读
+    bool read(client_data* &users2, int sockfd, time_wheel &timer_lst, int TIMESLOT );   //非阻塞的读
     bool write();  //非阻塞的写
-    void unmap();  //释放内存映射
+    bool feed(const char* data, int len);   //追加在别处收到的数据
+    bool consume(long long n);    //已经写出n个字节，返回是否还有数据要发送
+    bool finish_write();    //响应发送完毕后的清理，返回是否保持连接
+    void unmap();  //释放对缓存文件和缓存响应的引用
+    void reject(); //服务器过载时直接回复503，调用者随后关闭连接
+    void shed();   //由工作线程调用：请求排队太久，回复503并关闭socket的读写，由reactor关闭连接
+    int get_sockfd() const { return m_sockfd; }
+    unsigned get_generation() const { return m_generation; }
+    const struct iovec* get_iov() const { return m_iv; }
+    int get_iov_count() const { return m_iv_count; }
+    long long get_bytes_to_send() const { return bytes_to_send; }
+    bool is_linger() const { return m_keep_alive; }
+    bool has_pipelined() const { return m_pipelined; }
+    bool is_busy() const { return m_busy; }
+    void set_busy(bool busy){ m_busy = busy; }
 
 
 private:
     void init();   //初始化连接其余的信息
+    void reset_request();   //准备解析下一个请求
+    void reset_response();  //响应发完后清空写的状态
+    void next_request(int end);    //丢掉已经处理的请求，把流水线上后面的数据移到读缓冲区开头
+    bool reserve_read(int len);    //保证读缓冲区至少还能放下len个字节，需要时从缓冲区池取或换一个更大的
+    bool grow_write();             //写缓冲区放不下时换一个两倍大的
+    void release_read_buf();       //把读缓冲区还给缓冲区池
+    void release_write_buf();      //把写缓冲区还给缓冲区池
+    void release_buffers(){ release_read_buf(); release_write_buf(); }
 
     //解析HTTP请求
     HTTP_CODE process_read(); //解析HTTP请求
@@ -82,51 +123,104 @@ private:
 
     //处理并写会HTTP请求
     bool process_write( HTTP_CODE ret );  // 填充HTTP应答
-    bool add_status_line(int status, const char* title);
-    bool add_headers(int content_length);
-    bool add_content_length(int content_length);
+    bool add_status_line(HTTP_STATUS status);
+    bool add_error(HTTP_STATUS status);
+    bool add_headers(long long content_length);
+    bool add_content_length(long long content_length);
     bool add_linger();
     bool add_blank_line();
-    bool add_content(const char* content);
     bool add_content_type();
-    bool add_response(const char* format, ...);
+    bool add_content_encoding();
+    bool add_validators();
+    bool add_content_range(const byte_range& range, long long size);
+    bool add_partial(int start);    //206响应，单段时直接发送这一段，多段时按multipart/byteranges格式发送
+    bool add_stats();               //Prometheus格式的统计信息
+    void add_body(long long offset, long long len);    //响应内容中文件的一段，映射的文件指向内存，否则由sendfile发送
+    bool add_number(long long v);
+    bool append(const char* data, int len);
+    //字符串常量的长度在编译期就知道
+    template<int N>
+    bool add_literal(const char (&text)[N]){ return append(text, N - 1); }
 
     LINE_STATUS parse_line();   //解析一行
     char * get_line(){ return m_read_buf + m_start_line; }
     HTTP_CODE do_request();  //对行的具体的处理
+    bool use_sidecar(int accept, const char* suffix, CONTENT_ENCODING encoding);  //换成预先压缩好的文件
+    void set_validators(const struct stat& st);   //按原始文件的状态和发送的编码生成ETag、Last-Modified和max-age
+    bool not_modified();    //条件请求中客户端缓存的版本是否仍然有效
+    HTTP_CODE select_ranges();  //按Range和If-Range决定发送整个文件还是其中几段
 
 public:
-    static int m_epollfd;    //所有的socket上的事件都被注册到同一个epollfd；
-    static int m_user_count; //统计用户的数量
+    static std::atomic<int> m_user_count; //统计用户的数量，多个reactor会同时修改
+    static bool m_edge_trigger;           //是否以边沿触发模式注册连接，启动时设置
+    static file_cache m_file_cache;       //按URL缓存打开的文件、状态信息和映射，所有线程共享
+    static object_cache m_object_cache;   //热点小文件的完整响应，所有线程共享
+    static compressor m_compressor;       //后台动态压缩和压缩结果的缓存，所有线程共享
+    static int m_max_requests;            //一个连接最多处理多少个请求，0表示不限制
+    static buffer_pool m_buffers;         //读写缓冲区池，所有线程共享
+    static std::atomic<unsigned> m_next_generation;   //连接对象会被复用，代数由所有连接共用的计数器分配
+    static bool m_weak_etag;              //生成弱ETag，启动时设置
+    static std::atomic<bool> m_draining;  //热升级后旧进程正在退出，之后的响应都关闭连接
 
 private:
+    int m_epollfd;          // 连接所属reactor的epollfd，连接上的事件都注册到这里
     int m_sockfd;           // 该HTTP连接的socket和对方的socket地址
+    unsigned m_generation;  // 每接受一个新连接加1，用来丢弃发给同一个fd上旧连接的异步完成事件
+    std::atomic<bool> m_busy;   // 已经交给线程池，工作线程处理完之前reactor不能回收这个连接对象
     sockaddr_in m_address;  // 通信的socket地址，用于保存客户信息
 
-    char m_read_buf[READ_BUFFER_SIZE];  // 读缓冲区
+    char* m_read_buf;                   // 读缓冲区，有数据要解析时才从缓冲区池中取，否则为NULL
+    int m_read_size;                    // 读缓冲区的大小
     int m_read_idx;                     // 标识读缓冲区中已经读入的客户端数据的最后一个字节的下标
     int m_check_index;                  // 当前正在分析的字符在读缓冲区的位置
     int m_start_line;                   // 当前正在解析的行的起始位置
+    line_tokens m_tokens;               // 当前行中已经扫描过的部分里找到的分隔符，数据不完整时下次接着扫描
+    line_tokens m_line;                 // 刚解析完的一行中的分隔符
 
     CHECK_STATE m_check_state;          // 主状态机当前所处的状态
     METHOD m_method;                    // 请求方法
 
-    // 客户请求的目标文件的完整路径，其内容等于doc_root + m_url, doc_root是网站根目录
-    char m_real_file[ FILENAME_LEN ];   
     char * m_url;                       // 请求目标文件的文件名
     char * m_version;                   // 协议版本，只支持HTTP1.1
-    char * m_host;                      // 主机名
-    int m_content_length;               // HTTP请求的的消息总长度
-    bool m_linger;                      // HTTP请求是否要保持连接 
+    header_table m_headers;             // 请求的头部字段，指向读缓冲区
+    long long m_content_length;         // HTTP请求的的消息总长度，不超过buffer_pool::MAX_SIZE
+    bool m_linger;                      // 当前这个HTTP请求是否要保持连接 
+    bool m_keep_alive;                  // 已经排队的响应发完后是否保持连接
+    bool m_pipelined;                   // 读缓冲区中还有没处理的数据，响应发完后不等新数据直接处理
+    int m_request_count;                // 这个连接已经处理的请求数
+    int m_accept_encoding;              // 客户端可以接受的编码，ACCEPT_GZIP | ACCEPT_BR
 
     // 目标文件的状态。通过它我们可以判断文件是否存在、是否为目录、是否可读，并获取文件大小等信息
     struct stat m_file_stat;            
     
-    char m_write_buf[ WRITE_BUFFER_SIZE ];
+    char* m_write_buf;                  // 写缓冲区，生成响应时才从缓冲区池中取，发完后归还
+    int m_write_size;
     int m_write_idx;
-    char* m_file_address;               // 客户请求的目标文件被mmap到内存中的起始位置
-    struct iovec m_iv[2];               // 我们将采用writev来执行写操作，所以定义下面两个成员，
+    file_entry* m_file;                 // 正在生成的响应使用的文件在缓存中的条目，持有一个引用
+    object_entry* m_object;             // 正在生成的响应命中的缓存响应，持有一个引用
+    file_entry* m_files[MAX_PIPELINE];  // 已经排队的响应持有的引用，发完后释放
+    object_entry* m_objects[MAX_PIPELINE];
+    int m_response_count;               // 排队等待发送的响应数
+    char* m_file_address;               // 客户请求的目标文件被mmap到内存中的起始位置(来自缓存条目)
+    int m_file_fd;                      // 用sendfile发送的大文件(缓存条目中的文件描述符)，只能是最后一个响应
+    struct iovec m_iv[MAX_IOV];         // 我们将采用writev来执行写操作，每个响应是响应头和文件内容两块，
+                                        // iov_base为NULL的块是m_file_fd中的一段，由sendfile发送
+    off_t m_file_offsets[MAX_IOV];      // sendfile发送的块在文件中下一次发送的位置，部分发送后从这里继续
     int m_iv_count;                     // 表示被写内存块的数量。
+    int m_iv_index;                     // 第一个还没发完的内存块
+    const char* m_content_type;         // 响应的Content-Type，错误页面是text/html
+    bool m_compressible;                // 内容是文本，响应随Accept-Encoding变化，需要发送Vary
+    CONTENT_ENCODING m_encoding;        // 发送的内容使用的编码
+    char m_etag[ETAG_SIZE];             // 响应的ETag，m_etag_len为0表示没有(错误页面)
+    int m_etag_len;
+    time_t m_last_modified;             // 原始文件的修改时间
+    int m_max_age;                      // Cache-Control的max-age，-1表示不发送
+    byte_range m_ranges[MAX_RANGES];    // Range请求要发送的段
+    int m_range_count;
+
+    long long m_accept_time;    // 接受连接的时间(纳秒)，第一个响应开始发送后清零
+    long long m_request_time;   // do_request()开始的时间，解析和查找文件的用时以它为界
+    long long m_write_time;     // 这批响应生成完的时间，发完时记录发送用时
 
     // struct iovec
     // {
@@ -134,8 +228,8 @@ private:
     //     size_t iov_len;	/* Length of data.  */   //长度
     // };
 
-    int bytes_to_send;     //将要发送的数据的字节数
-    int bytes_have_send;   //已经发送的字节数
+    long long bytes_to_send;     //将要发送的数据的字节数
+    long long bytes_have_send;   //已经发送的字节数
 
 
  };
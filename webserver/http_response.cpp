@@ -0,0 +1,173 @@
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include "http_response.h"
+#include "http_cache.h"
+
+#define STATUS_LINE(code, title) "HTTP/1.1 " #code " " title "\r\n"
+#define STATUS_OK(code, title) { STATUS_LINE(code, title), sizeof(STATUS_LINE(code, title)) - 1, NULL, 0 }
+#define STATUS_ERROR(code, title, body) { STATUS_LINE(code, title), sizeof(STATUS_LINE(code, title)) - 1, body, sizeof(body) - 1 }
+
+// 顺序和HTTP_STATUS一致
+const status_entry status_table[STATUS_COUNT] = {
+    STATUS_OK(200, "OK"),
+    STATUS_OK(206, "Partial Content"),
+    STATUS_OK(304, "Not Modified"),
+    STATUS_ERROR(400, "Bad Request", "Your request has bad syntax or is inherently impossible to satisfy.\n"),
+    STATUS_ERROR(403, "Forbidden", "You do not have permission to get file from this server.\n"),
+    STATUS_ERROR(404, "Not Found", "The requested file was not found on this server.\n"),
+    STATUS_OK(416, "Range Not Satisfiable"),
+    STATUS_ERROR(500, "Internal Error", "There was an unusual problem serving the requested file.\n"),
+};
+
+#define ERROR_503 "HTTP/1.1 503 Service Unavailable\r\nContent-Length: 0\r\nConnection: close\r\nRetry-After: 1\r\n\r\n"
+const char error_503_response[] = ERROR_503;
+const int error_503_len = sizeof(ERROR_503) - 1;
+
+// 00到99的两位数字，每次转换两位
+static const char digit_pairs[201] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+int format_decimal(char* buf, unsigned long long v){
+    //从后往前写到临时缓冲区，再整体复制
+    char tmp[20];
+    char* p = tmp + sizeof(tmp);
+    while(v >= 100){
+        int i = (v % 100) * 2;
+        v /= 100;
+        *--p = digit_pairs[i + 1];
+        *--p = digit_pairs[i];
+    }
+    if(v >= 10){
+        int i = v * 2;
+        *--p = digit_pairs[i + 1];
+        *--p = digit_pairs[i];
+    }else{
+        *--p = '0' + v;
+    }
+    int len = tmp + sizeof(tmp) - p;
+    memcpy(buf, p, len);
+    return len;
+}
+
+int format_hex(char* buf, unsigned long long v){
+    static const char hex[] = "0123456789abcdef";
+    int len = 1;
+    while(len < 16 && (v >> (len * 4))){
+        len++;
+    }
+    for(int i = len - 1; i >= 0; i--){
+        buf[i] = hex[v & 15];
+        v >>= 4;
+    }
+    return len;
+}
+
+// 每个线程各自缓存，不需要加锁；一秒内的响应共用同一个字符串
+struct date_cache
+{
+    time_t m_second;
+    int m_len;
+    char m_header[6 + HTTP_DATE_SIZE + 2];
+};
+
+static __thread date_cache thread_date = { -1, 0, { 0 } };
+
+const char* date_header(int& len){
+    time_t now = time(NULL);
+    if(now != thread_date.m_second){
+        memcpy(thread_date.m_header, "Date: ", 6);
+        int n = 6 + format_http_date(thread_date.m_header + 6, now);
+        thread_date.m_header[n++] = '\r';
+        thread_date.m_header[n++] = '\n';
+        thread_date.m_len = n;
+        thread_date.m_second = now;
+    }
+    len = thread_date.m_len;
+    return thread_date.m_header;
+}
+
+struct mime_entry
+{
+    const char* m_ext;
+    const char* m_type;
+    bool m_compressible;
+};
+
+static const mime_entry mime_types[] = {
+    { "html", "text/html", true },
+    { "htm",  "text/html", true },
+    { "css",  "text/css", true },
+    { "js",   "application/javascript", true },
+    { "json", "application/json", true },
+    { "txt",  "text/plain", true },
+    { "xml",  "application/xml", true },
+    { "svg",  "image/svg+xml", true },
+    { "png",  "image/png", false },
+    { "jpg",  "image/jpeg", false },
+    { "jpeg", "image/jpeg", false },
+    { "gif",  "image/gif", false },
+    { "ico",  "image/x-icon", false },
+    { "pdf",  "application/pdf", false },
+    { "mp4",  "video/mp4", false },
+};
+
+#define MIME_SLOTS 64       //2的幂，比扩展名的个数大得多，冲突时向后找
+#define MAX_EXT 8           //更长的扩展名不可能在表里
+
+// 扩展名的哈希，不区分大小写
+static inline unsigned ext_hash(const char* ext, int len){
+    unsigned h = 2166136261u;
+    for(int i = 0; i < len; i++){
+        h = (h ^ ((unsigned char)ext[i] | 0x20)) * 16777619u;
+    }
+    return h & (MIME_SLOTS - 1);
+}
+
+// 开放定址的哈希表，在main()之前建好，之后只读
+struct mime_table
+{
+    const mime_entry* m_slots[MIME_SLOTS];
+    mime_table(){
+        memset(m_slots, 0, sizeof(m_slots));
+        for(size_t i = 0; i < sizeof(mime_types) / sizeof(mime_types[0]); i++){
+            unsigned h = ext_hash(mime_types[i].m_ext, strlen(mime_types[i].m_ext));
+            while(m_slots[h]){
+                h = (h + 1) & (MIME_SLOTS - 1);
+            }
+            m_slots[h] = &mime_types[i];
+        }
+    }
+};
+
+static const mime_table mime_lookup;
+
+const char* mime_type(const char* url, bool& compressible){
+    compressible = false;
+    const char* dot = strrchr(url, '.');
+    if(!dot || strchr(dot, '/')){
+        return "text/html";
+    }
+    const char* ext = dot + 1;
+    int len = strlen(ext);
+    if(len == 0 || len > MAX_EXT){
+        return "text/html";
+    }
+    for(unsigned h = ext_hash(ext, len); mime_lookup.m_slots[h]; h = (h + 1) & (MIME_SLOTS - 1)){
+        const mime_entry* entry = mime_lookup.m_slots[h];
+        if(strncasecmp(entry->m_ext, ext, len) == 0 && entry->m_ext[len] == '\0'){
+            compressible = entry->m_compressible;
+            return entry->m_type;
+        }
+    }
+    return "text/html";
+}
@@ -0,0 +1,50 @@
+#ifndef HTTP_RESPONSE_H
+#define HTTP_RESPONSE_H
+
+/*
+    生成响应时用到的预先准备好的数据，拼响应头时只做memcpy和整数转换，不调用printf，不分配内存。
+    状态行和错误页面的内容在编译期就是完整的字符串，长度也是编译期常量；
+    Date头部每个线程每秒最多格式化一次；Content-Type按扩展名查哈希表。
+*/
+
+// 用到的状态码，是status_table的下标
+enum HTTP_STATUS
+{
+    STATUS_200 = 0,
+    STATUS_206,
+    STATUS_304,
+    STATUS_400,
+    STATUS_403,
+    STATUS_404,
+    STATUS_416,
+    STATUS_500,
+    STATUS_COUNT
+};
+
+struct status_entry
+{
+    const char* m_line;     // 完整的状态行，包括"\r\n"
+    int m_line_len;
+    const char* m_body;     // 错误页面的内容，成功的状态没有
+    int m_body_len;
+};
+
+extern const status_entry status_table[STATUS_COUNT];
+
+// 过载时的响应是固定的，直接发送
+extern const char error_503_response[];
+extern const int error_503_len;
+
+// 把v写成十进制，返回长度，buf至少要有20个字节
+int format_decimal(char* buf, unsigned long long v);
+
+// 把v写成小写十六进制，返回长度，buf至少要有16个字节
+int format_hex(char* buf, unsigned long long v);
+
+// "Date: Sun, 06 Nov 1994 08:49:37 GMT\r\n"，当前线程每秒刷新一次，下一秒之前一直有效
+const char* date_header(int& len);
+
+// 按扩展名决定Content-Type，文本类型的内容值得压缩。不认识的扩展名仍然按text/html发送，但不压缩
+const char* mime_type(const char* url, bool& compressible);
+
+#endif
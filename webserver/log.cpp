@@ -0,0 +1,253 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include "log.h"
+
+int logger::m_level = LOG_LEVEL_INFO;
+std::atomic<log_ring*> logger::m_rings[logger::MAX_THREADS];
+std::atomic<int> logger::m_ring_count(0);
+int logger::m_fd = STDOUT_FILENO;
+pthread_t logger::m_thread;
+std::atomic<bool> logger::m_running(false);
+
+#define FLUSH_BUF_SIZE 65536
+#define LINE_SIZE 1024
+#define IDLE_SLEEP_MS 10
+
+static const char* level_names[] = { "DEBUG", "INFO ", "WARN ", "ERROR" };
+
+// 只在刷新线程里使用
+static char flush_buf[FLUSH_BUF_SIZE];
+static int flush_len = 0;
+static time_t prefix_second = -1;
+static char prefix_time[32];
+
+static void write_all(int fd, const char* data, int len){
+    while(len > 0){
+        int n = ::write(fd, data, len);
+        if(n < 0){
+            if(errno == EINTR){
+                continue;
+            }
+            return;
+        }
+        data += n;
+        len -= n;
+    }
+}
+
+log_ring* logger::local_ring(){
+    //每个线程第一次写日志时创建自己的环形缓冲区，线程数超过MAX_THREADS以后的日志都丢掉
+    static __thread log_ring* ring = NULL;
+    static __thread bool failed = false;
+    if(ring || failed){
+        return ring;
+    }
+    int id = m_ring_count.fetch_add(1);
+    if(id >= MAX_THREADS){
+        failed = true;
+        return NULL;
+    }
+    log_ring* r = new log_ring();
+    r->m_id = id;
+    m_rings[id].store(r, std::memory_order_release);
+    ring = r;
+    return ring;
+}
+
+// 按记录中的参数类型重写每个转换说明的长度修饰，然后交给snprintf，类型不符的参数输出成"?"
+int logger::format(const log_record& r, int thread, char* out, int size){
+    if(r.m_time / 1000000000 != prefix_second){
+        prefix_second = r.m_time / 1000000000;
+        struct tm tm;
+        localtime_r(&prefix_second, &tm);
+        strftime(prefix_time, sizeof(prefix_time), "%Y-%m-%d %H:%M:%S", &tm);
+    }
+    int len = snprintf(out, size, "%s.%03d %s [%d] ", prefix_time, (int)(r.m_time % 1000000000 / 1000000),
+                       level_names[r.m_level & 3], thread);
+    int arg = 0;
+    int offset = 0;
+    const char* p = r.m_fmt;
+    while(*p && len < size - 1){
+        if(*p != '%'){
+            out[len++] = *p++;
+            continue;
+        }
+        if(p[1] == '%'){
+            out[len++] = '%';
+            p += 2;
+            continue;
+        }
+        //复制标志、宽度和精度，跳过原来的长度修饰
+        char spec[32];
+        int n = 0;
+        spec[n++] = *p++;
+        while(*p && strchr("-+ #0123456789.", *p) && n < 24){
+            spec[n++] = *p++;
+        }
+        while(*p && strchr("hlLqjzt", *p)){
+            ++p;
+        }
+        char conv = *p;
+        if(!conv){
+            break;
+        }
+        ++p;
+        int room = size - len;
+        if(arg >= r.m_argc){
+            len += snprintf(out + len, room, "?");
+        }else{
+            LOG_ARG type = (LOG_ARG)r.m_types[arg++];
+            const char* data = r.m_payload + offset;
+            switch(type){
+            case ARG_INT:
+            case ARG_UINT: {
+                long long v;
+                memcpy(&v, data, sizeof(v));
+                offset += sizeof(v);
+                if(strchr("diuxXoc", conv)){
+                    spec[n++] = 'l';
+                    spec[n++] = 'l';
+                    spec[n++] = conv == 'c' ? 'd' : conv;
+                    spec[n] = '\0';
+                    if(conv == 'c'){
+                        len += snprintf(out + len, room, "%c", (int)v);
+                    }else{
+                        len += snprintf(out + len, room, spec, v);
+                    }
+                }else{
+                    len += snprintf(out + len, room, "?");
+                }
+                break;
+            }
+            case ARG_DOUBLE: {
+                double v;
+                memcpy(&v, data, sizeof(v));
+                offset += sizeof(v);
+                if(strchr("fFeEgGaA", conv)){
+                    spec[n++] = conv;
+                    spec[n] = '\0';
+                    len += snprintf(out + len, room, spec, v);
+                }else{
+                    len += snprintf(out + len, room, "?");
+                }
+                break;
+            }
+            case ARG_PTR: {
+                const void* v;
+                memcpy(&v, data, sizeof(v));
+                offset += sizeof(v);
+                len += snprintf(out + len, room, "%p", v);
+                break;
+            }
+            case ARG_STR: {
+                int slen = (unsigned char)data[0];
+                offset += slen + 1;
+                if(conv == 's'){
+                    //记录里的字符串没有'\0'，复制出来再按原来的宽度和精度输出
+                    char tmp[256];
+                    memcpy(tmp, data + 1, slen);
+                    tmp[slen] = '\0';
+                    spec[n++] = 's';
+                    spec[n] = '\0';
+                    len += snprintf(out + len, room, spec, tmp);
+                }else{
+                    len += snprintf(out + len, room, "?");
+                }
+                break;
+            }
+            }
+        }
+        if(len > size - 1){
+            len = size - 1;
+        }
+    }
+    //格式串里的换行由这里统一加
+    while(len > 0 && out[len - 1] == '\n'){
+        --len;
+    }
+    out[len++] = '\n';
+    return len;
+}
+
+// 把所有环形缓冲区中的记录格式化以后成批写出去
+void logger::flush_all(){
+    int count = m_ring_count.load();
+    if(count > MAX_THREADS){
+        count = MAX_THREADS;
+    }
+    for(int i = 0; i < count; i++){
+        log_ring* ring = m_rings[i].load(std::memory_order_acquire);
+        if(!ring){
+            //编号已经分配但还没有登记完
+            continue;
+        }
+        unsigned tail = ring->m_tail.load(std::memory_order_relaxed);
+        unsigned head = ring->m_head.load(std::memory_order_acquire);
+        while(tail != head){
+            if(flush_len + LINE_SIZE > FLUSH_BUF_SIZE){
+                write_all(m_fd, flush_buf, flush_len);
+                flush_len = 0;
+            }
+            const log_record& r = ring->m_records[tail & (log_ring::SIZE - 1)];
+            flush_len += format(r, ring->m_id, flush_buf + flush_len, LINE_SIZE);
+            ++tail;
+            //格式化完成以后才把位置让给生产者
+            ring->m_tail.store(tail, std::memory_order_release);
+        }
+    }
+    if(flush_len > 0){
+        write_all(m_fd, flush_buf, flush_len);
+        flush_len = 0;
+    }
+}
+
+void* logger::flusher(void* arg){
+    while(m_running.load(std::memory_order_acquire)){
+        flush_all();
+        //空闲时定期醒来，不需要生产者通知，写日志的线程不做任何系统调用
+        struct timespec ts = { 0, IDLE_SLEEP_MS * 1000000 };
+        nanosleep(&ts, NULL);
+    }
+    return NULL;
+}
+
+bool logger::init(const char* path, int level){
+    m_level = level;
+    if(path){
+        int fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if(fd < 0){
+            return false;
+        }
+        m_fd = fd;
+    }
+    m_running.store(true);
+    if(pthread_create(&m_thread, NULL, flusher, NULL) != 0){
+        m_running.store(false);
+        return false;
+    }
+    return true;
+}
+
+void logger::shutdown(){
+    if(m_running.exchange(false)){
+        pthread_join(m_thread, NULL);
+    }
+    flush_all();
+    int count = m_ring_count.load();
+    for(int i = 0; i < count && i < MAX_THREADS; i++){
+        log_ring* ring = m_rings[i].load();
+        unsigned long long dropped = ring ? ring->m_dropped.load() : 0;
+        if(dropped){
+            char line[128];
+            int n = snprintf(line, sizeof(line), "logger: thread %d dropped %llu records\n", i, dropped);
+            write_all(m_fd, line, n);
+        }
+    }
+    if(m_fd != STDOUT_FILENO){
+        close(m_fd);
+        m_fd = STDOUT_FILENO;
+    }
+}
@@ -0,0 +1,173 @@
+#ifndef LOG_H
+#define LOG_H
+
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <atomic>
+#include <type_traits>
+
+/*
+    异步日志。调用LOG_*的线程只把格式串的指针和参数的值复制到自己的环形缓冲区里，不格式化、不加锁、不做系统调用；
+    后台的刷新线程从所有线程的环形缓冲区中取出记录，格式化以后成批写到标准输出(或者日志文件)。
+    格式串必须是字符串常量，它的指针要在刷新时仍然有效；字符串参数会被复制，可以是临时的。
+    参数只能是整数、浮点数、指针和字符串，最多LOG_MAX_ARGS个。环形缓冲区满时丢弃新记录并计数，不会阻塞调用者。
+
+    级别低于编译期的LOG_MIN_LEVEL的日志整个语句都会被编译器去掉，连参数都不求值。
+    默认只保留INFO及以上，调试时编译加上 -DLOG_MIN_LEVEL=0 打开DEBUG日志。
+*/
+
+#define LOG_LEVEL_DEBUG 0
+#define LOG_LEVEL_INFO 1
+#define LOG_LEVEL_WARN 2
+#define LOG_LEVEL_ERROR 3
+
+#ifndef LOG_MIN_LEVEL
+#define LOG_MIN_LEVEL LOG_LEVEL_INFO
+#endif
+
+#define LOG_MAX_ARGS 8
+#define LOG_PAYLOAD 96          //参数占用的字节数，一条记录正好128字节
+
+// 参数的类型
+enum LOG_ARG { ARG_INT = 0, ARG_UINT, ARG_DOUBLE, ARG_PTR, ARG_STR };
+
+struct log_record
+{
+    int64_t m_time;             // 纳秒
+    const char* m_fmt;
+    uint8_t m_level;
+    uint8_t m_argc;
+    uint8_t m_types[LOG_MAX_ARGS];
+    uint16_t m_used;            // m_payload中已经使用的字节数
+    char m_payload[LOG_PAYLOAD];
+};
+
+// 单生产者(所属线程)单消费者(刷新线程)的环形缓冲区
+struct log_ring
+{
+    static const unsigned SIZE = 1024;  //2的幂
+    std::atomic<unsigned> m_head;       //生产者写入的位置
+    std::atomic<unsigned> m_tail;       //消费者读取的位置
+    std::atomic<unsigned long long> m_dropped;
+    int m_id;                           //线程的编号，输出时用来区分线程
+    log_record m_records[SIZE];
+};
+
+class logger
+{
+public:
+    //启动刷新线程，path为NULL时写到标准输出，打不开文件时返回false。level是运行时的最低级别
+    static bool init(const char* path, int level);
+
+    //停止刷新线程，把剩下的记录都写出去
+    static void shutdown();
+
+    static int m_level;     //运行时的最低级别，只能在init()之前修改
+
+    template<typename... Args>
+    static void write(int level, const char* fmt, const Args&... args){
+        if(level < m_level){
+            return;
+        }
+        log_ring* ring = local_ring();
+        if(!ring){
+            return;
+        }
+        unsigned head = ring->m_head.load(std::memory_order_relaxed);
+        if(head - ring->m_tail.load(std::memory_order_acquire) >= log_ring::SIZE){
+            ring->m_dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        log_record& r = ring->m_records[head & (log_ring::SIZE - 1)];
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME_COARSE, &ts);
+        r.m_time = (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+        r.m_fmt = fmt;
+        r.m_level = level;
+        r.m_argc = 0;
+        r.m_used = 0;
+        int unused[] = { 0, (encode(r, args), 0)... };
+        (void)unused;
+        //发布这条记录，刷新线程看到新的m_head时记录的内容已经写好
+        ring->m_head.store(head + 1, std::memory_order_release);
+    }
+
+private:
+    static log_ring* local_ring();
+    static void* flusher(void* arg);
+    static void flush_all();
+    static int format(const log_record& r, int thread, char* out, int size);
+
+    static void put(log_record& r, LOG_ARG type, const void* data, int len){
+        if(r.m_argc >= LOG_MAX_ARGS || r.m_used + len > LOG_PAYLOAD){
+            return;
+        }
+        r.m_types[r.m_argc++] = type;
+        memcpy(r.m_payload + r.m_used, data, len);
+        r.m_used += len;
+    }
+
+    template<typename T>
+    static typename std::enable_if<std::is_integral<T>::value || std::is_enum<T>::value>::type encode(log_record& r, const T& v){
+        if(std::is_signed<T>::value){
+            long long x = (long long)v;
+            put(r, ARG_INT, &x, sizeof(x));
+        }else{
+            unsigned long long x = (unsigned long long)v;
+            put(r, ARG_UINT, &x, sizeof(x));
+        }
+    }
+
+    template<typename T>
+    static typename std::enable_if<std::is_floating_point<T>::value>::type encode(log_record& r, const T& v){
+        double x = v;
+        put(r, ARG_DOUBLE, &x, sizeof(x));
+    }
+
+    //字符串复制到记录里(前面是一个字节的长度)，放不下的部分截掉
+    static void encode(log_record& r, const char* s){
+        if(!s){
+            s = "(null)";
+        }
+        int room = LOG_PAYLOAD - r.m_used - 1;
+        if(r.m_argc >= LOG_MAX_ARGS || room < 0){
+            return;
+        }
+        int len = strnlen(s, room < 255 ? room : 255);
+        r.m_types[r.m_argc++] = ARG_STR;
+        r.m_payload[r.m_used] = (char)len;
+        memcpy(r.m_payload + r.m_used + 1, s, len);
+        r.m_used += len + 1;
+    }
+
+    static void encode(log_record& r, char* s){
+        encode(r, (const char*)s);
+    }
+
+    static void encode(log_record& r, const void* p){
+        put(r, ARG_PTR, &p, sizeof(p));
+    }
+
+private:
+    static const int MAX_THREADS = 256;
+    static std::atomic<log_ring*> m_rings[MAX_THREADS];    //所有线程的环形缓冲区，只增加不删除
+    static std::atomic<int> m_ring_count;
+    static int m_fd;
+    static pthread_t m_thread;
+    static std::atomic<bool> m_running;
+};
+
+#define LOG(level, ...) do { \
+        if((level) >= LOG_MIN_LEVEL){ \
+            logger::write((level), __VA_ARGS__); \
+        } \
+    } while(0)
+
+#define LOG_DEBUG(...) LOG(LOG_LEVEL_DEBUG, __VA_ARGS__)
+#define LOG_INFO(...) LOG(LOG_LEVEL_INFO, __VA_ARGS__)
+#define LOG_WARN(...) LOG(LOG_LEVEL_WARN, __VA_ARGS__)
+#define LOG_ERROR(...) LOG(LOG_LEVEL_ERROR, __VA_ARGS__)
+
+#endif
@@ -3,10 +3,21 @@
 
 #include <stdio.h>
 #include <time.h>
+#include <limits.h>
 #include <arpa/inet.h>
+#include "log.h"
 
 #define BUFFER_SIZE 64 // 读缓冲的大小
 class util_timer; //前向声明
+class http_conn;
+class reactor;
+
+// 获取单调时钟的当前时间(毫秒)，定时器的超时时间都以它为准，不受系统时间被修改的影响
+static inline long long get_ms_time(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
 
 // 用户数据结构
 struct client_data
@@ -15,13 +26,15 @@ struct client_data
     int sockfd;          //socket文件描述符
     char buf[BUFFER_SIZE]; //读缓冲
     util_timer* timer;     //定时器
+    http_conn* conn;       //对应的HTTP连接
+    reactor* owner;        //连接所属的reactor，定时器到期时由它关闭连接并回收连接对象
 };
 
 //定时器类
 class util_timer
 {
 public:
-    time_t expire;   //任务超时时间
+    long long expire;   //任务超时时间，get_ms_time()意义下的绝对时间(毫秒)
     void (*cb_func)(client_data*); //任务回调函数，回调函数处理的客户数据，由定时器的执行者传递给回调函数
     client_data* user_date;
     util_timer* prev;  //指向前一个定时器
@@ -30,164 +43,250 @@ public:
     util_timer(): prev(NULL), next(NULL){}
 };
 
-// 定时器链表，它是一个升序、双向链表，且带有头结点和尾结点
-class sort_timer_lst
+/*
+    分层时间轮，参考Linux内核的定时器实现。第0层有256个槽，每个槽对应一个时间单位；
+    第1~3层各有64个槽，每个槽对应上一层转一圈的时间。每个槽是一个带哨兵节点的循环双向链表，
+    所以添加、调整、删除定时器都只需要常数时间，不再需要像升序链表那样遍历查找插入位置。
+    tick() 每推进一个时间单位就把第0层当前槽里的定时器整批取出执行，
+    第0层转完一圈时再把上一层对应槽中的定时器重新分散(cascade)到下层。
+*/
+#define TW_ROOT_BITS 8
+#define TW_LEVEL_BITS 6
+#define TW_LEVELS 4
+#define TW_ROOT_SIZE (1 << TW_ROOT_BITS)
+#define TW_LEVEL_SIZE (1 << TW_LEVEL_BITS)
+#define TW_ROOT_MASK (TW_ROOT_SIZE - 1)
+#define TW_LEVEL_MASK (TW_LEVEL_SIZE - 1)
+// 时间轮能表示的最大超时间隔，超过的按最大值处理
+#define TW_MAX_DELTA ((1LL << (TW_ROOT_BITS + (TW_LEVELS - 1) * TW_LEVEL_BITS)) - 1)
+
+class time_wheel
 {
 private:
-    util_timer* head; //头结点
-    util_timer* tail; //尾结点
+    util_timer m_root[TW_ROOT_SIZE];                    //第0层的槽(哨兵节点)
+    util_timer m_levels[TW_LEVELS - 1][TW_LEVEL_SIZE];  //第1~3层的槽(哨兵节点)
+    long long m_cur;   //下一个还没处理的时间点
+    int m_count;    //时间轮中定时器的数量
 private:
-    /*
-        一个重载的辅助函数，它被共有的add_timer 函数和 adjust_timer 函数调用
-        该函数表示将目标定时器 timer 添加到节点lst_head 之后的部分链表中
-    */
-    void add_timer( util_timer* timer, util_timer* lst_head){
-        util_timer* prev = lst_head;
-        util_timer* tmp = lst_head->next;
-        /*
-            遍历list_head 节点之后的部分链表，直到找到一个超过时间大于目标定时器的超时时间节点
-            并将目标定时器插入该节点之前    
-        */
-        while(tmp){
-            if( timer->expire < tmp->expire){
-                prev->next = timer;
-                timer->next = tmp;
-                tmp->prev = timer;
-                timer->prev = prev;
-                break;
-            }
-            prev = tmp;
-            tmp = tmp->next;
-        }
-        /*
-            如果遍历完lst_head节点之后的部分链表，仍未找到超时时间大于目标定时器的超时时间的节点，
-            则将目标定时器插入链表尾部，并把它设置为链表的心得尾结点。
-        */
-       if(!tmp){
-        prev->next = timer;
-        timer->prev = prev;
+    static void list_init(util_timer* head){
+        head->prev = head;
+        head->next = head;
+    }
+
+    //把定时器挂到槽链表的尾部
+    static void list_add(util_timer* head, util_timer* timer){
+        timer->prev = head->prev;
+        timer->next = head;
+        head->prev->next = timer;
+        head->prev = timer;
+    }
+
+    //把定时器从它所在的槽链表中摘下
+    static void list_del(util_timer* timer){
+        timer->prev->next = timer->next;
+        timer->next->prev = timer->prev;
+        timer->prev = NULL;
         timer->next = NULL;
-        tail = timer;
-       }
     }
-public:
-    sort_timer_lst():head(NULL), tail(NULL){}
-    
-    // 链表被销毁时，删除其中所有的定时器
-    ~sort_timer_lst(){
-        util_timer* tmp = head;
-        while(tmp){
-            head = tmp->next;
-            delete tmp;
-            tmp = head;
+
+    //根据超时时间与当前时间的差值，找到定时器应该放的槽
+    void internal_add(util_timer* timer){
+        long long expire = timer->expire;
+        if(expire < m_cur){
+            //已经超时的定时器放到当前槽，下一次tick就会被处理
+            expire = m_cur;
+        }
+        long long delta = expire - m_cur;
+        if(delta > TW_MAX_DELTA){
+            delta = TW_MAX_DELTA;
+            expire = m_cur + delta;
+        }
+        util_timer* head;
+        if(delta < TW_ROOT_SIZE){
+            head = &m_root[expire & TW_ROOT_MASK];
+        }else{
+            int level = 0;
+            while(delta >= (1LL << (TW_ROOT_BITS + (level + 1) * TW_LEVEL_BITS))){
+                level++;
+            }
+            int idx = (expire >> (TW_ROOT_BITS + level * TW_LEVEL_BITS)) & TW_LEVEL_MASK;
+            head = &m_levels[level][idx];
         }
+        list_add(head, timer);
     }
 
-    //将目标定时器timer添加到链表中
-    void add_timer( util_timer* timer){
-        if(!timer){
-            return;
+    //把上层某个槽中的定时器全部取出，按照新的当前时间重新放到下层，返回该槽的下标
+    int cascade(int level, int idx){
+        util_timer tmp;
+        util_timer* head = &m_levels[level][idx];
+        if(head->next == head){
+            return idx;
         }
-        if(!head){
-            head = tail = timer;
-            return;
+        //先把整个槽链表转移到临时哨兵上，再逐个重新插入
+        list_init(&tmp);
+        tmp.next = head->next;
+        tmp.prev = head->prev;
+        tmp.next->prev = &tmp;
+        tmp.prev->next = &tmp;
+        list_init(head);
+        while(tmp.next != &tmp){
+            util_timer* timer = tmp.next;
+            list_del(timer);
+            internal_add(timer);
         }
-        /* 如果目标定时器的超时时间小于当前链表中所有定时器的超时时间，则把该定时器插入链表头部,作为链表新的头节点，
-           否则就需要调用重载函数 add_timer(),把它插入链表中合适的位置，以保证链表的升序特性 */
-        if( timer->expire < head->expire){
-            timer->next = head;
-            head->prev = timer;
-            head = timer;
-            return;
+        return idx;
+    }
+
+    int level_index(int level) const{
+        return (m_cur >> (TW_ROOT_BITS + level * TW_LEVEL_BITS)) & TW_LEVEL_MASK;
+    }
+
+public:
+    time_wheel(): m_cur(get_ms_time()), m_count(0){
+        for(int i = 0; i < TW_ROOT_SIZE; i++){
+            list_init(&m_root[i]);
+        }
+        for(int i = 0; i < TW_LEVELS - 1; i++){
+            for(int j = 0; j < TW_LEVEL_SIZE; j++){
+                list_init(&m_levels[i][j]);
+            }
         }
-        add_timer(timer, head);
     }
 
-    /*
-        当某个定时任务发生变化时，调整对应的定时器在链表中的位置。这个函数只考虑被调整的定时器的
-        超时时间延长的情况，即该定时器需要往链表的尾部移动
-    */
-    void adjust_timer( util_timer* timer){
+    // 时间轮被销毁时，删除其中所有的定时器
+    ~time_wheel(){
+        for(int i = 0; i < TW_ROOT_SIZE; i++){
+            clear(&m_root[i]);
+        }
+        for(int i = 0; i < TW_LEVELS - 1; i++){
+            for(int j = 0; j < TW_LEVEL_SIZE; j++){
+                clear(&m_levels[i][j]);
+            }
+        }
+    }
+
+    //将目标定时器timer添加到时间轮中
+    void add_timer( util_timer* timer){
         if(!timer){
             return;
         }
-        util_timer* tmp = timer->next;
-        //如果被调整的目标定时器处在链表的尾部，或者该定时器新的超时时间值仍然小于其下一个定时器的超时时间则不用调整
-        if( !tmp || timer->expire < tmp->expire){
+        internal_add(timer);
+        m_count++;
+    }
+
+    //当某个定时任务的超时时间发生变化时，把定时器从原来的槽中摘下，按新的超时时间重新放入
+    void adjust_timer( util_timer* timer){
+        if(!timer || !timer->next){
             return;
         }
-        //如果目标定时器是链表的头节点，则将该定时器从链表中取出并重新插入链表
-        if(timer == head){
-            head = head->next;
-            head->prev = NULL;
-            timer->next = NULL;
-            add_timer(timer, head);
-        }else{
-            //如果目标定时器不是链表中的头节点，则将该定时器从链表中取出，然后插入其原来所在的位置后的部分链表中
-            timer->prev->next = timer->next;
-            timer->next->prev = timer->prev;
-            add_timer(timer, timer->next);
-        }
+        list_del(timer);
+        internal_add(timer);
     }
 
-    //将目标定时器timer 从链表中删除
+    //将目标定时器timer从时间轮中删除
     void del_timer( util_timer* timer){
         if(!timer){
             return;
         }
-        //如果只有一个定时器
-        if( timer == head || timer == tail){
-            delete timer;
-            head = NULL;
-            tail = NULL;
-            return;
-        }
-        /* 如果链表中至少有两个定时器，且目标定时器是链表的头节点，
-         则将链表的头节点重置为原头节点的下一个节点，然后删除目标定时器。 */
-        if( timer == head){
-            head = timer->next;
-            head->prev = NULL;
-            delete timer;
-            return ;
-        }
-        /* 如果链表中至少有两个定时器，且目标定时器是链表的尾节点，
-        则将链表的尾节点重置为原尾节点的前一个节点，然后删除目标定时器。*/
-        if( timer == tail){
-            tail = timer->prev;
-            tail->next = NULL;
-            delete timer;
-            return;
+        if(timer->next){
+            list_del(timer);
+            m_count--;
         }
-        // 如果目标定时器位于链表的中间，则把它前后的定时器串联起来，然后删除目标定时器
-        timer->prev->next = timer->next;
-        timer->next->prev = timer->prev;
         delete timer;
     }
 
-    // SIGALARM 信号每次被触发就在其信号处理函数中执行一次tick()函数，以处理链表上到期任务
+    /*
+        返回最早到期的定时器的超时时间，没有定时器时返回-1，主循环据此设置timerfd的下一次触发时间。
+        第0层在本轮内有定时器时结果是精确的(上层的定时器都在以后的轮次到期)；否则在第0层剩余的槽和每一层按分散顺序
+        找到的第一个非空槽中取最小值。每层都要检查：远处加进来的高层定时器可能比低层最早的定时器先到期。
+        同一层里后面的槽不会比第一个非空槽更早，所以最多检查每层一个槽内的链表。
+    */
+    long long next_expire(){
+        if(m_count == 0){
+            return -1;
+        }
+        int idx = m_cur & TW_ROOT_MASK;
+        long long base = m_cur - idx;
+        for(int i = idx; i < TW_ROOT_SIZE; i++){
+            if(m_root[i].next != &m_root[i]){
+                return base + i;
+            }
+        }
+        //本轮已经没有定时器了，剩下的都在下一轮及以后
+        long long best = LLONG_MAX;
+        for(int i = 0; i < idx; i++){
+            if(m_root[i].next != &m_root[i]){
+                best = base + TW_ROOT_SIZE + i;
+                break;
+            }
+        }
+        for(int level = 0; level < TW_LEVELS - 1; level++){
+            int cur = level_index(level);
+            for(int i = 1; i <= TW_LEVEL_SIZE; i++){
+                util_timer* head = &m_levels[level][(cur + i) & TW_LEVEL_MASK];
+                if(head->next == head){
+                    continue;
+                }
+                for(util_timer* tmp = head->next; tmp != head; tmp = tmp->next){
+                    if(tmp->expire < best){
+                        best = tmp->expire;
+                    }
+                }
+                break;
+            }
+        }
+        return best < m_cur ? m_cur : best;
+    }
+
+    // timerfd 每次触发就执行一次tick()函数，把时间轮推进到当前时间并处理到期任务
     void tick(){
-        if(!head){
+        long long cur = get_ms_time(); //获取当前的单调时间
+        if(m_count == 0){
+            //时间轮中没有定时器，直接把当前时间拨到现在
+            m_cur = cur + 1;
             return;
         }
-        printf("timer tick\n");
-        time_t cur = time(NULL); //获取当前系统的时间
-        util_timer* tmp = head;
-        //从头结点开始依次处理每个定时器，直到遇到一个尚未到期的定时器
-        while(tmp){
-            /* 因为每个定时器都使用绝对时间作为超时值，所以可以把定时器的超时值和系统当前时间，
-            比较以判断定时器是否到期*/
-            if(cur < tmp->expire){
-                return;
+        LOG_DEBUG("timer tick, %d timers", m_count);
+        util_timer expired;
+        list_init(&expired);
+        while(m_cur <= cur){
+            int idx = m_cur & TW_ROOT_MASK;
+            //第0层转完一圈，依次把上层对应的槽分散下来
+            if(idx == 0){
+                for(int level = 0; level < TW_LEVELS - 1; level++){
+                    if(cascade(level, level_index(level)) != 0){
+                        break;
+                    }
+                }
             }
+            //把当前槽的整条链表拼接到到期链表的尾部
+            util_timer* head = &m_root[idx];
+            if(head->next != head){
+                head->next->prev = expired.prev;
+                expired.prev->next = head->next;
+                head->prev->next = &expired;
+                expired.prev = head->prev;
+                list_init(head);
+            }
+            m_cur++;
+        }
+        //批量执行到期定时器的回调函数。回调中删除其他到期定时器也是安全的，因为摘链只依赖前后节点
+        while(expired.next != &expired){
+            util_timer* tmp = expired.next;
+            list_del(tmp);
+            m_count--;
             //调用定时器的回调函数，以执行定时任务
             tmp->cb_func(tmp->user_date);
-            //执行完定时器中的定时任务之后，就将它从链表中删除，并重置链表头节点
-            head = tmp->next;
-            if(head){
-                head->prev = NULL;
-            }
             delete tmp;
-            tmp = head;
+        }
+    }
+
+private:
+    void clear(util_timer* head){
+        while(head->next != head){
+            util_timer* tmp = head->next;
+            list_del(tmp);
+            delete tmp;
         }
     }
 
@@ -1,5 +1,6 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <limits.h>
 #include <string.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
@@ -9,36 +10,25 @@
 #include <fcntl.h>
 #include <sys/epoll.h>
 #include <signal.h>
+#include <sys/signalfd.h>
+#include <poll.h>
 #include "locker.h"
 #include "threadpool.h"
 #include "http_conn.h"
 #include <assert.h>
-#include "lst_timer.h"
+#include "reactor.h"
+#include "tokenizer.h"
+#include "log.h"
+#include "upgrade.h"
 
-#define MAX_FD  65535 // 文件描述符的最大个数
-#define MAX_EVENT_NUMBER 10000 //一次监听的最大的数量
+#define DEFAULT_THREAD_NUMBER 8 //单reactor模式下线程池默认的线程数
+#define DEFAULT_OBJECT_CACHE (64LL * 1024 * 1024) //热点响应缓存默认的大小
+#define DEFAULT_COMPRESS_CACHE (16LL * 1024 * 1024) //动态压缩结果缓存默认的大小
+#define DEFAULT_DRAIN_SECONDS 30 //热升级后旧进程等待连接关闭的最长时间(秒)
+#define DRAIN_POLL_MS 100 //等待连接关闭时检查连接数的间隔(毫秒)
 
-#define FD_LIMIT 65535
-#define TIMESLOT 5
-
-static int pipefd[5];
-static sort_timer_lst timer_lst;
-static int epollfd = 0;
-
-void sig_handler(int sig){
-    int save_errno = errno;
-    int msg = sig;
-    send( pipefd[1], (char *)&msg, 1, 0);
-    errno = save_errno;
-}
-
-void addsig(int sig ){
-    struct sigaction sa;
-    memset(&sa, '\0', sizeof(sa));
-    sa.sa_handler = sig_handler;
-    sigfillset( &sa.sa_mask);
-    assert( sigaction(sig, &sa, NULL) != -1);
-}
+//网站的根目录，定义在http_conn.cpp中
+extern const char* doc_root;
 
 //添加信号捕捉
 void addsig(int sig, void(handler)(int)){
@@ -55,210 +45,261 @@ void addsig(int sig, void(handler)(int)){
     assert( sigaction( sig, &sa, NULL ) != -1 );
 }
 
-void timer_handler(){
-    //定时处理任务，实际上就是调用tick()函数
-    timer_lst.tick();
-    //因为一次alarm调用只会引起一次SIGALARM信号，所以我们要重新定时，以不断地出发SIGALARM信号。
-    alarm(TIMESLOT);
-}
-
-//定时器回调函数，它删除非活动连接socket上的注册事件，并关闭之
-void cb_func(client_data* user_data){
-    epoll_ctl(epollfd, EPOLL_CTL_DEL, user_data->sockfd, 0);
-    assert( user_data);
-    close( user_data->sockfd);
-    printf( "close fd %d\n", user_data->sockfd);
-}
-
-
-
-//添加文件描述符到epoll中
-extern void addfd(int epollfd, int fd, bool one_shot);
-//从epoll中删除文件描述符
-extern void removefd(int epollfd, int fd);
-//修改epoll中的文件描述符
-extern void modfd(int epollfd, int fd, int ev);
-extern int setnonblocking(int fd);
 //arg表示参数的个数，argv[]是参数
 int main(int argc, char * argv[]){
 
-    if(argc <= 1){
-        printf("按照如下格式运行： %s port_number\n", basename(argv[0])); //basename是获取基础的名字
+    //-r 指定reactor(事件循环线程)的数量，-t 指定线程池的线程数，0表示不使用线程池，在reactor线程中直接解析请求
+    //-o 指定请求队列满时的策略：reject 回复503，pause 暂停读取该连接(默认)，block 阻塞reactor直到队列有空位
+    int reactor_number = 1;
+    int thread_number = -1;
+    OVERFLOW_POLICY policy = OVERFLOW_PAUSE;
+    //-b 选择I/O后端：epoll(默认) 或 uring
+    IO_BACKEND backend = BACKEND_EPOLL;
+    int opt;
+    //-e 使用边沿触发模式注册监听socket和连接
+    //-s 指定用sendfile发送的最小文件大小(字节)，-1表示总是mmap后writev
+    //-c 指定热点响应缓存的大小(字节)，0表示不使用
+    //-z 指定动态压缩结果缓存的大小(字节)，0表示不做动态压缩(预先压缩好的.gz/.br文件仍然会发送)
+    //-k 指定一个连接最多处理的请求数，0表示不限制
+    //-w 生成弱ETag(不含inode，几台服务器上相同的文件ETag相同)
+    //-m 按URL前缀指定Cache-Control的max-age，格式是"前缀=秒数"，可以指定多次，匹配最长的前缀
+    //-l 指定日志的最低级别：debug、info(默认)、warn 或 error，debug日志还要求编译时定义LOG_MIN_LEVEL=0
+    //-g 把日志写到指定的文件(追加)，默认写到标准输出
+    //-n 指定连接总数的上限，达到后新连接直接回复503
+    //-q 指定请求排队延迟的目标(毫秒)，排队延迟持续超过它时按CoDel算法丢弃请求并回复503，默认0表示不丢弃
+    //-d 指定热升级(SIGUSR2)后旧进程等待已有连接关闭的最长时间(秒)
+    long long object_cache_bytes = DEFAULT_OBJECT_CACHE;
+    long long compress_cache_bytes = DEFAULT_COMPRESS_CACHE;
+    int log_level = LOG_LEVEL_INFO;
+    const char* log_path = NULL;
+    long long shed_target = 0;
+    int drain_seconds = DEFAULT_DRAIN_SECONDS;
+    while((opt = getopt(argc, argv, "r:t:o:b:s:c:z:k:m:l:g:n:q:d:we")) != -1){
+        switch(opt){
+            case 'd':
+                drain_seconds = atoi(optarg);
+                break;
+            case 'n':
+                reactor::m_max_conns = atoi(optarg);
+                break;
+            case 'q':
+                shed_target = atoll(optarg) * 1000000LL;
+                break;
+            case 'l':
+                if(strcmp(optarg, "debug") == 0){
+                    log_level = LOG_LEVEL_DEBUG;
+                }else if(strcmp(optarg, "warn") == 0){
+                    log_level = LOG_LEVEL_WARN;
+                }else if(strcmp(optarg, "error") == 0){
+                    log_level = LOG_LEVEL_ERROR;
+                }else{
+                    log_level = LOG_LEVEL_INFO;
+                }
+                break;
+            case 'g':
+                log_path = optarg;
+                break;
+            case 'w':
+                http_conn::m_weak_etag = true;
+                break;
+            case 'm':
+                if(!add_cache_rule(optarg)){
+                    printf("无效的Cache-Control规则：%s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'k':
+                http_conn::m_max_requests = atoi(optarg);
+                break;
+            case 'z':
+                compress_cache_bytes = atoll(optarg);
+                break;
+            case 'c':
+                object_cache_bytes = atoll(optarg);
+                break;
+            case 's':
+                file_cache::m_map_limit = atoll(optarg);
+                break;
+            case 'b':
+                backend = (strcmp(optarg, "uring") == 0) ? BACKEND_URING : BACKEND_EPOLL;
+                break;
+            case 'e':
+                http_conn::m_edge_trigger = true;
+                break;
+            case 'r':
+                reactor_number = atoi(optarg);
+                break;
+            case 't':
+                thread_number = atoi(optarg);
+                break;
+            case 'o':
+                if(strcmp(optarg, "reject") == 0){
+                    policy = OVERFLOW_REJECT;
+                }else if(strcmp(optarg, "block") == 0){
+                    policy = OVERFLOW_BLOCK;
+                }else{
+                    policy = OVERFLOW_PAUSE;
+                }
+                break;
+            default:
+                break;
+        }
     }
 
-    //获取端口号 argv[0]是程序名， argv[1]是端口号
-    int port = atoi(argv[1]);
-
-    //网络中一段断开连接，而另一端还在写数据，可能导致SIGPIPE信号
-    //对SIGPIPE信号进行处理,SIG_IGN是一个函数，表示忽略它
-    //addsig(SIGPIPE, SIG_IGN);
-
-    //创建线程池,http_conn是一个任务类
-    threadpool<http_conn> * pool = NULL;
-    try{
-        pool = new threadpool<http_conn>;
-    }   
-    catch(...)
-    {
+    if(optind >= argc || reactor_number <= 0){
+        printf("按照如下格式运行： %s [-r reactor_number] [-t thread_number] [-o reject|pause|block] [-b epoll|uring] [-s sendfile_threshold] [-c object_cache_bytes] [-z compress_cache_bytes] [-k max_requests] [-m prefix=max_age] [-l debug|info|warn|error] [-g log_file] [-n max_connections] [-q queue_target_ms] [-d drain_seconds] [-w] [-e] port_number\n", basename(argv[0])); //basename是获取基础的名字
         return 1;
     }
 
-    //创建一个数组，用于保存所有的客户端信息
-    http_conn * users = new http_conn[ MAX_FD ];
-    client_data* users2 = new client_data[FD_LIMIT];
-
-    //下面就是TCP连接到基本步骤
-    int listenfd = socket(PF_INET, SOCK_STREAM, 0);
-
-    //设置端口复用
-    int reuse = 1;
-    setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
-
-    //绑定
-    struct sockaddr_in address;
-    address.sin_family = AF_INET;
-    address.sin_port = htons(port);
-    address.sin_addr.s_addr = INADDR_ANY;
-    bind(listenfd, (struct sockaddr *)&address, sizeof(address));
-
+    //获取端口号
+    int port = atoi(argv[optind]);
+
+    //热升级时执行的是启动时这个路径上的文件，部署时替换了它，新进程就是新版本。
+    //运行中的可执行文件只能通过rename替换，之后/proc/self/exe会变成"<路径> (deleted)"，所以优先用argv[0]得到的路径，
+    //argv[0]中没有'/'(从PATH中找到的)时才用/proc/self/exe，并去掉可能的" (deleted)"后缀
+    char exe[PATH_MAX];
+    if(!strchr(argv[0], '/') || !realpath(argv[0], exe)){
+        ssize_t exe_len = readlink("/proc/self/exe", exe, sizeof(exe) - 1);
+        exe[exe_len > 0 ? exe_len : 0] = '\0';
+        const char deleted[] = " (deleted)";
+        size_t len = strlen(exe);
+        if(len >= sizeof(deleted) - 1 && strcmp(exe + len - (sizeof(deleted) - 1), deleted) == 0){
+            exe[len - (sizeof(deleted) - 1)] = '\0';
+        }
+    }
 
-    //监听
-    listen(listenfd, 5);
+    //默认情况下，单reactor时由线程池解析请求；多reactor时每个reactor自己解析，连接不会离开所在的线程
+    if(thread_number < 0){
+        thread_number = (reactor_number == 1) ? DEFAULT_THREAD_NUMBER : 0;
+    }
+    //io_uring后端在reactor线程中解析请求，收发都由它提交，不使用线程池。
+    //它用sendmsg发出整个iovec，所以文件总是映射到内存中，不走sendfile
+    if(backend == BACKEND_URING){
+        thread_number = 0;
+        file_cache::m_map_limit = -1;
+    }
 
-    //创建epoll对象，事件数组，添加
-    epoll_event events[ MAX_EVENT_NUMBER ];
-    int epollfd = epoll_create(5);
+    //网络中一段断开连接，而另一端还在写数据，可能导致SIGPIPE信号
+    //对SIGPIPE信号进行处理,SIG_IGN是一个函数，表示忽略它
+    addsig(SIGPIPE, SIG_IGN);
+
+    //SIGTERM(退出)和SIGUSR2(热升级)改由主线程通过signalfd读取。必须在创建其他线程之前屏蔽，新线程会继承这个信号掩码，
+    //否则信号可能被投递给某个工作线程并执行默认动作
+    sigset_t sigmask;
+    sigemptyset(&sigmask);
+    sigaddset(&sigmask, SIGTERM);
+    sigaddset(&sigmask, SIGUSR2);
+    pthread_sigmask(SIG_BLOCK, &sigmask, NULL);
+
+    //日志的刷新线程最先创建，其他线程从一开始就可以写日志
+    if(!logger::init(log_path, log_level)){
+        printf("无法打开日志文件：%s\n", log_path);
+        return 1;
+    }
 
-    //将监听的文件描述符添加到epoll中
-    addfd(epollfd, listenfd, false);
-    http_conn::m_epollfd = epollfd;
+    //文件缓存的监视线程也要在屏蔽SIGTERM之后创建。inotify不可用时不使用缓存，每次请求都查找文件
+    http_conn::m_file_cache.init(doc_root);
+    http_conn::m_object_cache.init(object_cache_bytes);
+    http_conn::m_compressor.init(compress_cache_bytes);
 
-     //创建管道
-    int ret = socketpair(PF_UNIX, SOCK_STREAM, 0, pipefd);
-    assert( ret != -1);
-    setnonblocking( pipefd[1]);
-    addfd( epollfd, pipefd[0], false);
+    //创建线程池,http_conn是一个任务类
+    threadpool<http_conn> * pool = NULL;
+    if(thread_number > 0){
+        try{
+            pool = new threadpool<http_conn>(thread_number, 10000, policy, shed_target);
+        }
+        catch(...)
+        {
+            return 1;
+        }
+    }
 
+    //热升级启动时，监听socket从旧进程继承，不重新绑定
+    int inherited[MAX_LISTEN_FDS];
+    int inherited_count = hot_upgrade::inherit(port, inherited, MAX_LISTEN_FDS);
+    if(inherited_count > reactor_number){
+        //旧进程的reactor更多。关闭多出来的监听socket会重置它积压队列中的连接，内核也还在往它上面分配新连接，
+        //所以每个继承来的socket都要有一个reactor接受连接
+        LOG_WARN("upgrade: inherited %d listening sockets, running %d reactors instead of %d", inherited_count, inherited_count, reactor_number);
+        reactor_number = inherited_count;
+    }
 
-    //设置信号处理函数,捕捉到相应的信号了就会运行相应处理函数
-    addsig( SIGALRM );
-    addsig( SIGTERM );
+    //创建reactor，每个reactor都有自己的监听socket、epoll对象、连接表和时间轮
+    reactor** reactors = new reactor*[reactor_number];
+    pthread_t* threads = new pthread_t[reactor_number];
+    for(int i = 0; i < reactor_number; i++){
+        reactors[i] = new reactor(i, port, pool, backend, i < inherited_count ? inherited[i] : -1);
+        if(!reactors[i]->init()){
+            return 1;
+        }
+    }
 
-    bool stop_server = false;
-    bool timeout = false;
+    LOG_INFO("server started on port %d, %d reactors, %d workers, request tokenizer: %s",
+             port, reactor_number, thread_number, scan_line_impl());
+    for(int i = 0; i < reactor_number; i++){
+        if( pthread_create(threads + i, NULL, reactor::worker, reactors[i]) != 0){
+            return 1;
+        }
+    }
 
-    printf("ssssssssssssssssssssss\n");
-    alarm(TIMESLOT); //定时，5秒后产生SIGALARM信号
+    //所有reactor都在监听了，旧进程可以停止接受连接
+    hot_upgrade::ready();
 
-    while(!stop_server){
-        int number = epoll_wait(epollfd, events, MAX_EVENT_NUMBER, -1);
-        if( (number < 0) && (errno != EINTR)){
-            printf("epoll failure\n");
+    //主线程只负责等待信号：SIGTERM通知所有reactor退出；SIGUSR2启动新进程，把监听socket交给它
+    int sigfd = signalfd(-1, &sigmask, SFD_CLOEXEC);
+    assert( sigfd != -1);
+    struct signalfd_siginfo si;
+    bool upgraded = false;
+    while( read(sigfd, &si, sizeof(si)) == sizeof(si) ){
+        if(si.ssi_signo == SIGTERM){
             break;
         }
-
-        //循环遍历事件数组
-        for(int i = 0; i < number; i++){
-
-            int sockfd = events[i].data.fd;
-
-            if(sockfd == listenfd){
-                printf("1\n");
-                //有客户端链接进来
-                struct sockaddr_in client_address;
-                socklen_t client_addrlength = sizeof(client_address);
-                int connfd = accept(listenfd, (struct sockaddr*)&client_address, &client_addrlength);
-
-                if(connfd < 0){
-                    printf( "errno is: %d\n", errno);
-                    continue;
-                }
-
-                if(http_conn::m_user_count >= MAX_FD){
-                    //目前连接数满了
-                    //给客户端写一个信息：服务器内部正忙。
-                    close(connfd);
-                    continue;
-                }
-                //将新的客户的数据初始化，放到数组当中
-                users[connfd].init(connfd, client_address);
-
-                users2[connfd].address = client_address;
-                users2[connfd].sockfd = connfd;
-                // 创建定时器，设置其回调函数与超时时间，然后绑定定时器与用户数据，最后将定时器添加到链表timer_lst中
-                util_timer* timer = new util_timer;
-                timer->user_date = &users2[connfd];
-                timer->cb_func = cb_func;
-                time_t cur = time(NULL);
-                //设置超时时间为当前时间+15s
-                timer->expire = cur + 3 * TIMESLOT; 
-                users2[connfd].timer = timer;
-                //添加定时器到链表
-                timer_lst.add_timer(timer);
-
-            }else if( (sockfd == pipefd[0] ) && ( events[i].events & EPOLLIN) ){
-                printf("2\n");
-                //处理信号
-                int sig;
-                char signals[1024];
-                int ret = recv( pipefd[0], signals, sizeof( signals ), 0);
-                if(ret == -1){
-                    continue;
-                }else if(ret == 0){
-                    continue;
-                }else{
-                    for(int i = 0; i < ret; i++){
-                        switch(signals[i]){
-                            case SIGALRM:{
-                                //用timeout变量标记有定时任务需要处理，但不立即处理定时任务
-                                //这是因为定时任务的优先级不是很高，我们优先处理其他更重要的任务。
-                                timeout = true;
-                                break;
-                            }
-                            case SIGTERM:
-                            {
-                                stop_server = true;
-                            }
-                        }
-                    }
-                }
-            }else if(events[i].events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)){
-                printf("3\n");
-                //对方异常断开或者错误等事件
-                users[sockfd].close_conn();
-
-            }else if(events[i].events & EPOLLIN){
-                printf("4\n");
-                if( users[sockfd].read(users2, sockfd, timer_lst, cb_func, TIMESLOT) ){         //一次性把所有的数据都读完
-                    //交给线程去处理
-                    pool->append(&users[sockfd]);
-                }else {
-                    users[sockfd].close_conn();
-                }
-
-            }else if(events[i].events & EPOLLOUT){
-                printf("5\n");
-                //如果写失败了
-                if(!users[sockfd].write()){ //一次性写完所有的数据
-                    users[sockfd].close_conn();
-                }
+        if(si.ssi_signo == SIGUSR2){
+            int fds[MAX_LISTEN_FDS];
+            int count = reactor_number < MAX_LISTEN_FDS ? reactor_number : MAX_LISTEN_FDS;
+            for(int i = 0; i < count; i++){
+                fds[i] = reactors[i]->get_listenfd();
             }
-        }
-        //最后处理定时事件，因为I/O事件有更高的优先级。当然，这样做将导致定时任务不能精准的按照预定的时间执行。
-        if(timeout){
-            timer_handler();
-            timeout = false;
+            LOG_INFO("upgrade: starting %s", exe);
+            if(hot_upgrade::spawn(exe, argv, fds, count)){
+                upgraded = true;
+                break;
+            }
+            LOG_WARN("upgrade failed, keep serving");
         }
     }
 
-    close( listenfd );
-    close( pipefd[1] );
-    close( pipefd[0]);
-    delete []users2;
+    if(upgraded){
+        //新进程已经在接受连接。停止接受新连接，之后的响应都带Connection: close，
+        //空闲的keep-alive连接由定时器关闭，连接都关闭或者超过期限(期间再收到SIGTERM)就退出
+        http_conn::m_draining = true;
+        for(int i = 0; i < reactor_number; i++){
+            reactors[i]->stop_accept();
+        }
+        long long deadline = get_ms_time() + drain_seconds * 1000LL;
+        struct pollfd pfd;
+        pfd.fd = sigfd;
+        pfd.events = POLLIN;
+        while(http_conn::m_user_count > 0 && get_ms_time() < deadline){
+            if(poll(&pfd, 1, DRAIN_POLL_MS) == 1 && read(sigfd, &si, sizeof(si)) == sizeof(si) && si.ssi_signo == SIGTERM){
+                break;
+            }
+        }
+        LOG_INFO("upgrade: old process exits, %d connections left", (int)http_conn::m_user_count.load());
+    }
+    close( sigfd );
 
-    close(epollfd);
-    close(listenfd);
-    delete []users;
+    for(int i = 0; i < reactor_number; i++){
+        reactors[i]->stop();
+    }
+    for(int i = 0; i < reactor_number; i++){
+        pthread_join(threads[i], NULL);
+        delete reactors[i];
+    }
+    delete []threads;
+    delete []reactors;
     delete pool;
+    //所有写日志的线程都已经退出，写出剩下的日志
+    logger::shutdown();
     return 0;
-}
\ No newline at end of file
+}
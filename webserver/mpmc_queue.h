@@ -0,0 +1,140 @@
+#ifndef MPMC_QUEUE_H
+#define MPMC_QUEUE_H
+
+#include <atomic>
+
+/*
+    有界的无锁多生产者多消费者环形队列(Dmitry Vyukov 的算法)。
+    每个槽带一个序号：序号等于入队位置说明槽是空的，可以写入；等于入队位置+1说明数据已经写好，可以取出。
+    生产者和消费者各自用CAS抢占位置，抢到之后只操作自己的槽，所以不需要锁。
+    入队位置和出队位置分别占用一个缓存行，避免生产者和消费者之间伪共享。
+    push_batch()/pop_batch() 一次CAS抢占连续的多个槽，批量入队和出队时原子操作的次数与批量大小无关。
+*/
+template <typename T>
+class mpmc_queue
+{
+private:
+    struct cell
+    {
+        std::atomic<unsigned> m_seq;
+        T m_data;
+    };
+
+    static const int CACHE_LINE = 64;
+
+    alignas(CACHE_LINE) cell* m_cells;
+    unsigned m_mask;    //容量-1，容量是2的幂
+    alignas(CACHE_LINE) std::atomic<unsigned> m_enqueue_pos;
+    alignas(CACHE_LINE) std::atomic<unsigned> m_dequeue_pos;
+    char m_pad[CACHE_LINE - sizeof(std::atomic<unsigned>)];
+
+public:
+    //capacity会被向上取整为2的幂
+    explicit mpmc_queue(unsigned capacity): m_enqueue_pos(0), m_dequeue_pos(0){
+        unsigned size = 2;
+        while(size < capacity){
+            size <<= 1;
+        }
+        m_cells = new cell[size];
+        m_mask = size - 1;
+        for(unsigned i = 0; i < size; i++){
+            m_cells[i].m_seq.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    ~mpmc_queue(){
+        delete []m_cells;
+    }
+
+    unsigned capacity() const{
+        return m_mask + 1;
+    }
+
+    //近似的元素个数，只用于统计和判断是否值得去窃取
+    unsigned size() const{
+        unsigned tail = m_enqueue_pos.load(std::memory_order_relaxed);
+        unsigned head = m_dequeue_pos.load(std::memory_order_relaxed);
+        return (int)(tail - head) > 0 ? tail - head : 0;
+    }
+
+    bool empty() const{
+        return size() == 0;
+    }
+
+    bool push(const T& data){
+        return push_batch(&data, 1) == 1;
+    }
+
+    bool pop(T& data){
+        return pop_batch(&data, 1) == 1;
+    }
+
+    //把items中的前n个元素入队，返回成功入队的个数，队列满时可能只入队一部分
+    int push_batch(const T* items, int n){
+        unsigned pos = m_enqueue_pos.load(std::memory_order_relaxed);
+        for(;;){
+            //从pos开始数出连续的空槽
+            int k = 0;
+            while(k < n){
+                cell* c = &m_cells[(pos + k) & m_mask];
+                if(c->m_seq.load(std::memory_order_acquire) != pos + k){
+                    break;
+                }
+                k++;
+            }
+            if(k == 0){
+                int diff = (int)(m_cells[pos & m_mask].m_seq.load(std::memory_order_acquire) - pos);
+                if(diff < 0){
+                    //队列满了
+                    return 0;
+                }
+                //其他生产者已经占用了这个位置，重新读取入队位置
+                pos = m_enqueue_pos.load(std::memory_order_relaxed);
+                continue;
+            }
+            if(m_enqueue_pos.compare_exchange_weak(pos, pos + k, std::memory_order_relaxed)){
+                for(int i = 0; i < k; i++){
+                    cell* c = &m_cells[(pos + i) & m_mask];
+                    c->m_data = items[i];
+                    c->m_seq.store(pos + i + 1, std::memory_order_release);
+                }
+                return k;
+            }
+            //CAS失败时pos已经被更新为最新的入队位置
+        }
+    }
+
+    //最多取出n个元素放到items中，返回取出的个数
+    int pop_batch(T* items, int n){
+        unsigned pos = m_dequeue_pos.load(std::memory_order_relaxed);
+        for(;;){
+            int k = 0;
+            while(k < n){
+                cell* c = &m_cells[(pos + k) & m_mask];
+                if(c->m_seq.load(std::memory_order_acquire) != pos + k + 1){
+                    break;
+                }
+                k++;
+            }
+            if(k == 0){
+                int diff = (int)(m_cells[pos & m_mask].m_seq.load(std::memory_order_acquire) - (pos + 1));
+                if(diff < 0){
+                    //队列空了
+                    return 0;
+                }
+                pos = m_dequeue_pos.load(std::memory_order_relaxed);
+                continue;
+            }
+            if(m_dequeue_pos.compare_exchange_weak(pos, pos + k, std::memory_order_relaxed)){
+                for(int i = 0; i < k; i++){
+                    cell* c = &m_cells[(pos + i) & m_mask];
+                    items[i] = c->m_data;
+                    c->m_seq.store(pos + i + m_mask + 1, std::memory_order_release);
+                }
+                return k;
+            }
+        }
+    }
+};
+
+#endif
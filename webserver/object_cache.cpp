@@ -0,0 +1,265 @@
+#include <stdlib.h>
+#include <string.h>
+#include <new>
+#include "object_cache.h"
+
+#define WINDOW_PERCENT 1       //窗口占分片预算的比例
+#define PROTECTED_PERCENT 80   //保护段占主缓存预算的比例
+#define AVERAGE_OBJECT 4096    //估计的平均对象大小，用来决定草图的宽度
+
+object_cache::object_cache(): m_enabled(false){
+    for(int i = 0; i < SHARDS; i++){
+        m_shards[i].m_sketch = NULL;
+    }
+}
+
+object_cache::~object_cache(){
+    for(int i = 0; i < SHARDS; i++){
+        shard& s = m_shards[i];
+        for(std::unordered_map<std::string, object_entry*>::iterator it = s.m_entries.begin(); it != s.m_entries.end(); ++it){
+            release(it->second);
+        }
+        delete []s.m_sketch;
+    }
+}
+
+void object_cache::init(long long budget){
+    if(budget <= 0){
+        return;
+    }
+    long long per_shard = budget / SHARDS;
+    for(int i = 0; i < SHARDS; i++){
+        shard& s = m_shards[i];
+        //窗口至少要放得下一个最大的对象，否则大一些的对象永远进不了缓存
+        s.m_window_cap = per_shard * WINDOW_PERCENT / 100;
+        if(s.m_window_cap < MAX_OBJECT_SIZE){
+            s.m_window_cap = MAX_OBJECT_SIZE;
+        }
+        s.m_main_cap = per_shard - s.m_window_cap;
+        if(s.m_main_cap < 0){
+            s.m_main_cap = 0;
+        }
+        s.m_protected_cap = s.m_main_cap * PROTECTED_PERCENT / 100;
+
+        //草图的宽度大约是分片能容纳的对象数(至少1024，太窄时冷门URL的计数会互相叠加成假的热点)，计数次数达到宽度的10倍时衰减
+        s.m_width = 1024;
+        while(s.m_width < per_shard / AVERAGE_OBJECT){
+            s.m_width <<= 1;
+        }
+        s.m_sketch = new uint8_t[SKETCH_DEPTH * s.m_width];
+        memset(s.m_sketch, 0, SKETCH_DEPTH * s.m_width);
+        s.m_additions = 0;
+        s.m_sample = s.m_width * 10;
+    }
+    m_enabled = true;
+}
+
+//草图的第i行使用的下标，用不同的乘数从同一个哈希值派生出几个独立的下标
+static inline unsigned sketch_index(size_t hash, int row, unsigned width){
+    static const uint64_t SEEDS[4] = { 0xc3a5c85c97cb3127ULL, 0xb492b66fbe98f273ULL, 0x9ae16a3b2f90404fULL, 0xcbf29ce484222325ULL };
+    uint64_t h = (hash + SEEDS[row]) * SEEDS[(row + 1) & 3];
+    return (unsigned)(h >> 32) & (width - 1);
+}
+
+void object_cache::record(shard& s, size_t hash){
+    for(int i = 0; i < SKETCH_DEPTH; i++){
+        uint8_t& counter = s.m_sketch[i * s.m_width + sketch_index(hash, i, s.m_width)];
+        if(counter < 15){
+            counter++;
+        }
+    }
+    if(++s.m_additions >= s.m_sample){
+        //衰减：所有计数减半，过去的热点如果不再被访问会逐渐被新的热点取代
+        for(unsigned i = 0; i < SKETCH_DEPTH * s.m_width; i++){
+            s.m_sketch[i] >>= 1;
+        }
+        s.m_additions /= 2;
+    }
+}
+
+int object_cache::frequency(shard& s, size_t hash){
+    int freq = 15;
+    for(int i = 0; i < SKETCH_DEPTH; i++){
+        int counter = s.m_sketch[i * s.m_width + sketch_index(hash, i, s.m_width)];
+        if(counter < freq){
+            freq = counter;
+        }
+    }
+    return freq;
+}
+
+void object_cache::list_push(lru_list& list, object_entry* entry, OBJECT_SEGMENT seg){
+    entry->m_segment = seg;
+    entry->m_prev = NULL;
+    entry->m_next = list.m_head;
+    if(list.m_head){
+        list.m_head->m_prev = entry;
+    }else{
+        list.m_tail = entry;
+    }
+    list.m_head = entry;
+    list.m_bytes += entry->m_len;
+}
+
+void object_cache::list_unlink(lru_list& list, object_entry* entry){
+    if(entry->m_prev){
+        entry->m_prev->m_next = entry->m_next;
+    }else{
+        list.m_head = entry->m_next;
+    }
+    if(entry->m_next){
+        entry->m_next->m_prev = entry->m_prev;
+    }else{
+        list.m_tail = entry->m_prev;
+    }
+    entry->m_prev = entry->m_next = NULL;
+    entry->m_segment = SEG_NONE;
+    list.m_bytes -= entry->m_len;
+}
+
+void object_cache::remove(shard& s, object_entry* entry){
+    if(entry->m_segment != SEG_NONE){
+        list_unlink(s.m_lists[entry->m_segment], entry);
+    }
+    s.m_entries.erase(entry->m_key);
+    release(entry);
+}
+
+object_entry* object_cache::acquire(const char* url){
+    if(!m_enabled){
+        return NULL;
+    }
+    std::string key(url);
+    size_t hash = std::hash<std::string>()(key);
+    shard& s = shard_of(hash);
+
+    s.m_lock.lock();
+    record(s, hash);
+    std::unordered_map<std::string, object_entry*>::iterator it = s.m_entries.find(key);
+    if(it == s.m_entries.end()){
+        s.m_lock.unlock();
+        return NULL;
+    }
+    object_entry* entry = it->second;
+    if(!entry->m_file->m_valid){
+        //文件已经变了
+        remove(s, entry);
+        s.m_lock.unlock();
+        return NULL;
+    }
+    switch(entry->m_segment){
+        case SEG_WINDOW:
+            list_unlink(s.m_lists[SEG_WINDOW], entry);
+            list_push(s.m_lists[SEG_WINDOW], entry, SEG_WINDOW);
+            break;
+        case SEG_PROBATION:
+            //试用段中再次命中，升入保护段，保护段超出预算时把最久没用的降回试用段
+            list_unlink(s.m_lists[SEG_PROBATION], entry);
+            list_push(s.m_lists[SEG_PROTECTED], entry, SEG_PROTECTED);
+            while(s.m_lists[SEG_PROTECTED].m_bytes > s.m_protected_cap && s.m_lists[SEG_PROTECTED].m_tail != entry){
+                object_entry* demoted = s.m_lists[SEG_PROTECTED].m_tail;
+                list_unlink(s.m_lists[SEG_PROTECTED], demoted);
+                list_push(s.m_lists[SEG_PROBATION], demoted, SEG_PROBATION);
+            }
+            break;
+        case SEG_PROTECTED:
+            list_unlink(s.m_lists[SEG_PROTECTED], entry);
+            list_push(s.m_lists[SEG_PROTECTED], entry, SEG_PROTECTED);
+            break;
+        default:
+            break;
+    }
+    entry->m_ref++;
+    s.m_lock.unlock();
+    return entry;
+}
+
+void object_cache::admit(shard& s, object_entry* candidate){
+    //从试用段(再到保护段)的末尾数出要腾出的空间需要淘汰哪些对象，
+    //候选者的频率必须比它们每一个都高才被接纳，否则直接丢弃候选者，主缓存保持不变
+    long long need = s.m_lists[SEG_PROBATION].m_bytes + s.m_lists[SEG_PROTECTED].m_bytes + candidate->m_len - s.m_main_cap;
+    int cand_freq = frequency(s, candidate->m_hash);
+    object_entry* victim = s.m_lists[SEG_PROBATION].m_tail;
+    OBJECT_SEGMENT seg = SEG_PROBATION;
+    long long freed = 0;
+    while(freed < need){
+        if(!victim){
+            if(seg == SEG_PROBATION){
+                seg = SEG_PROTECTED;
+                victim = s.m_lists[SEG_PROTECTED].m_tail;
+                continue;
+            }
+            //整个主缓存都放不下它
+            remove(s, candidate);
+            return;
+        }
+        if(frequency(s, victim->m_hash) >= cand_freq){
+            remove(s, candidate);
+            return;
+        }
+        freed += victim->m_len;
+        victim = victim->m_prev;
+    }
+    //竞争胜出，淘汰前面数出的那些对象
+    while(need > 0){
+        object_entry* tail = s.m_lists[SEG_PROBATION].m_tail ? s.m_lists[SEG_PROBATION].m_tail : s.m_lists[SEG_PROTECTED].m_tail;
+        need -= tail->m_len;
+        remove(s, tail);
+    }
+    list_push(s.m_lists[SEG_PROBATION], candidate, SEG_PROBATION);
+}
+
+void object_cache::insert(const char* url, file_entry* file, const char* header, int header_len){
+    long long body_len = file->m_stat.st_size;
+    if(!m_enabled || !file->m_valid || (body_len > 0 && !file->m_addr) || header_len + body_len > MAX_OBJECT_SIZE){
+        return;
+    }
+    object_entry* entry = new (std::nothrow) object_entry;
+    if(!entry){
+        return;
+    }
+    entry->m_data = (char*)malloc(header_len + body_len);
+    if(!entry->m_data){
+        delete entry;
+        return;
+    }
+    //在锁外拼好完整的响应
+    memcpy(entry->m_data, header, header_len);
+    memcpy(entry->m_data + header_len, file->m_addr, body_len);
+    entry->m_ref = 1;
+    entry->m_key = url;
+    entry->m_hash = std::hash<std::string>()(entry->m_key);
+    entry->m_file = file;
+    file->m_ref++;
+    entry->m_len = header_len + body_len;
+    entry->m_header_len = header_len;
+    entry->m_segment = SEG_NONE;
+    entry->m_prev = entry->m_next = NULL;
+
+    shard& s = shard_of(entry->m_hash);
+    s.m_lock.lock();
+    if(s.m_entries.count(entry->m_key)){
+        //其他线程已经放进去了
+        s.m_lock.unlock();
+        release(entry);
+        return;
+    }
+    s.m_entries[entry->m_key] = entry;
+    list_push(s.m_lists[SEG_WINDOW], entry, SEG_WINDOW);
+    //窗口满了，把最久没用的对象交给准入策略决定去留
+    while(s.m_lists[SEG_WINDOW].m_bytes > s.m_window_cap){
+        object_entry* candidate = s.m_lists[SEG_WINDOW].m_tail;
+        list_unlink(s.m_lists[SEG_WINDOW], candidate);
+        admit(s, candidate);
+    }
+    s.m_lock.unlock();
+}
+
+void object_cache::release(object_entry* entry){
+    if(!entry || --entry->m_ref > 0){
+        return;
+    }
+    file_cache::release(entry->m_file);
+    free(entry->m_data);
+    delete entry;
+}
@@ -0,0 +1,101 @@
+#ifndef OBJECT_CACHE_H
+#define OBJECT_CACHE_H
+
+#include <stdint.h>
+#include <atomic>
+#include <string>
+#include <unordered_map>
+#include "locker.h"
+#include "file_cache.h"
+
+// 缓存对象所在的段：新对象先进入窗口，被接纳后进入主缓存的试用段，再次命中后升入保护段
+enum OBJECT_SEGMENT { SEG_WINDOW = 0, SEG_PROBATION, SEG_PROTECTED, SEG_NONE };
+
+/*
+    一个已经序列化好的响应：响应头(保持连接的版本)和文件内容放在一块连续的内存中，
+    状态行和Date每次都会变，不在里面，命中时它们和这块内存一起用一次writev发出。带引用计数，被淘汰时正在发送它的响应不受影响。
+    它引用生成它的文件缓存条目，条目失效(文件被修改或删除)后这个对象也就作废了。
+*/
+struct object_entry
+{
+    std::atomic<int> m_ref;
+    std::string m_key;
+    size_t m_hash;          //m_key的哈希，淘汰时用来查草图
+    file_entry* m_file;
+    char* m_data;
+    int m_len;              //整个响应的长度
+    int m_header_len;       //响应头的长度，m_data + m_header_len 就是文件内容
+    OBJECT_SEGMENT m_segment;
+    object_entry* m_prev;
+    object_entry* m_next;
+};
+
+/*
+    热点小文件的响应缓存，按字节数限制大小，使用W-TinyLFU决定接纳和淘汰：
+    每次访问都记录到一个计数最小草图(count-min sketch)中，草图定期把所有计数减半，让过去的热度逐渐衰减；
+    新对象先进入占预算1%的LRU窗口，被挤出窗口时和主缓存中将被淘汰的对象比较访问频率，频率更高才能进入主缓存。
+    主缓存是分段LRU：试用段(20%)和保护段(80%)，在试用段中再次命中的对象升入保护段。
+    这样一次扫描大量冷门URL只会冲刷窗口，不会把热点对象挤出去。
+    按URL的哈希分成几个分片，每个分片有自己的锁、草图和预算。
+*/
+class object_cache
+{
+public:
+    object_cache();
+    ~object_cache();
+
+    //设置总预算(字节)，0表示不使用缓存
+    void init(long long budget);
+
+    //查找url，命中时返回加了一个引用的对象，用完后调用release()。不管是否命中都会记录一次访问
+    object_entry* acquire(const char* url);
+
+    //把未命中的响应放入缓存：header是保持连接版本的响应头(不含状态行和Date)，文件内容来自file的映射
+    void insert(const char* url, file_entry* file, const char* header, int header_len);
+
+    static void release(object_entry* entry);
+
+    static const int MAX_OBJECT_SIZE = 64 * 1024;   //超过这个大小的文件不缓存
+
+private:
+    static const int SHARDS = 4;
+    static const int SKETCH_DEPTH = 4;
+
+    struct lru_list
+    {
+        object_entry* m_head;   //最近使用的一端
+        object_entry* m_tail;
+        long long m_bytes;
+        lru_list(): m_head(NULL), m_tail(NULL), m_bytes(0){}
+    };
+
+    struct shard
+    {
+        locker m_lock;
+        std::unordered_map<std::string, object_entry*> m_entries;
+        lru_list m_lists[SEG_NONE];
+        long long m_window_cap;
+        long long m_protected_cap;
+        long long m_main_cap;       //试用段和保护段的总预算
+
+        uint8_t* m_sketch;          //SKETCH_DEPTH行，每行m_width个计数器，计数到15为止
+        unsigned m_width;           //2的幂
+        unsigned m_additions;       //自上次衰减以来的计数次数
+        unsigned m_sample;          //计数次数达到这个值时所有计数减半
+    };
+
+    shard& shard_of(size_t hash){ return m_shards[hash % SHARDS]; }
+    void record(shard& s, size_t hash);             //在草图中给这个键计数
+    int frequency(shard& s, size_t hash);           //估计这个键的访问频率
+    void admit(shard& s, object_entry* candidate);  //被挤出窗口的对象和主缓存的淘汰对象竞争
+    void remove(shard& s, object_entry* entry);     //从缓存中删除并释放缓存持有的引用
+
+    static void list_push(lru_list& list, object_entry* entry, OBJECT_SEGMENT seg);
+    static void list_unlink(lru_list& list, object_entry* entry);
+
+private:
+    bool m_enabled;
+    shard m_shards[SHARDS];
+};
+
+#endif
@@ -0,0 +1,821 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <errno.h>
+#include <assert.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/eventfd.h>
+#include <poll.h>
+#include <fcntl.h>
+#include "reactor.h"
+#include "log.h"
+
+//添加文件描述符到epoll中
+extern void addfd(int epollfd, int fd, bool one_shot, bool et);
+//从epoll中删除文件描述符
+extern void removefd(int epollfd, int fd);
+//修改epoll中的文件描述符
+extern void modfd(int epollfd, int fd, int ev);
+
+int reactor::m_max_conns = MAX_FD;
+
+reactor::reactor(int id, int port, threadpool<http_conn>* pool, IO_BACKEND backend, int listenfd):
+    m_id(id), m_port(port), m_listenfd(listenfd), m_epollfd(-1), m_timerfd(-1), m_eventfd(-1), m_reserve_fd(-1), m_fd_exhausted(false), m_accept_retry(-1),
+    m_stop(false), m_stop_accept(false), m_backend(backend), m_send_msgs(NULL), m_pool(pool), m_ready(NULL), m_ready_count(0), m_paused(NULL), m_paused_count(0), m_armed(-1),
+    m_stats(NULL){
+
+    if(m_pool){
+        m_ready = new http_conn*[MAX_EVENT_NUMBER];
+        m_paused = new http_conn*[MAX_FD];
+    }
+
+    m_users = new http_conn*[MAX_FD];
+    memset(m_users, 0, sizeof(http_conn*) * MAX_FD);
+    m_users_timer = new client_data[MAX_FD];
+}
+
+reactor::~reactor(){
+    if(m_listenfd != -1){
+        close(m_listenfd);
+    }
+    if(m_timerfd != -1){
+        close(m_timerfd);
+    }
+    if(m_eventfd != -1){
+        close(m_eventfd);
+    }
+    if(m_reserve_fd != -1){
+        close(m_reserve_fd);
+    }
+    if(m_epollfd != -1){
+        close(m_epollfd);
+    }
+    for(int i = 0; i < MAX_FD; i++){
+        m_conns.free(m_users[i]);
+    }
+    delete []m_users;
+    delete []m_users_timer;
+    delete []m_ready;
+    delete []m_paused;
+    delete []m_send_msgs;
+}
+
+bool reactor::init(){
+    if(m_listenfd != -1){
+        //从旧进程继承的socket已经在监听，积压队列中的连接由这个reactor接着接受
+        LOG_INFO("reactor %d: using inherited listening socket %d", m_id, m_listenfd);
+    }else{
+        //下面就是TCP连接到基本步骤
+        m_listenfd = socket(PF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if(m_listenfd < 0){
+            return false;
+        }
+
+        //设置端口复用。SO_REUSEPORT让每个reactor都能绑定同一个端口，由内核在它们之间分配新连接
+        int reuse = 1;
+        setsockopt(m_listenfd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+        setsockopt(m_listenfd, SOL_SOCKET, SO_REUSEPORT, &reuse, sizeof(reuse));
+
+        //绑定
+        struct sockaddr_in address;
+        memset(&address, 0, sizeof(address));
+        address.sin_family = AF_INET;
+        address.sin_port = htons(m_port);
+        address.sin_addr.s_addr = INADDR_ANY;
+        if(bind(m_listenfd, (struct sockaddr *)&address, sizeof(address)) < 0){
+            LOG_ERROR("reactor %d bind failed, errno is: %d", m_id, errno);
+            return false;
+        }
+
+        //监听。连接风暴时积压队列太短会直接丢弃SYN，所以使用系统允许的最大值
+        if(listen(m_listenfd, SOMAXCONN) < 0){
+            return false;
+        }
+    }
+
+    m_eventfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if(m_eventfd < 0){
+        return false;
+    }
+    m_reserve_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+
+    if(m_backend == BACKEND_URING){
+        //io_uring后端不需要epoll和timerfd：定时器的到期时间直接作为io_uring_enter的等待超时
+        if(m_ring.init(URING_ENTRIES) && probe_multishot_accept() && m_ring.setup_buffers(0, URING_BUFFERS, http_conn::READ_BUFFER_SIZE)){
+            m_send_msgs = new struct msghdr[MAX_FD];
+            return true;
+        }
+        LOG_WARN("reactor %d: io_uring is not available, errno is: %d, fall back to epoll", m_id, errno);
+        //初始化到一半的io_uring实例、映射和接收缓冲区在epoll后端中用不到，不要一直占着
+        m_ring.destroy();
+        m_backend = BACKEND_EPOLL;
+    }
+
+    //创建epoll对象，将监听的文件描述符添加到epoll中
+    m_epollfd = epoll_create1(EPOLL_CLOEXEC);
+    if(m_epollfd < 0){
+        return false;
+    }
+    addfd(m_epollfd, m_listenfd, false, http_conn::m_edge_trigger);
+
+    //定时器以文件描述符的形式注册到epoll中
+    m_timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if(m_timerfd != -1){
+        addfd(m_epollfd, m_timerfd, false, false);
+    }
+    addfd(m_epollfd, m_eventfd, false, false);
+    return true;
+}
+
+bool reactor::probe_multishot_accept(){
+    /*
+        多次触发的accept要5.19以后的内核，没有对应的特性标志。旧内核上它以-EINVAL完成并且不带IORING_CQE_F_MORE，
+        按正常流程处理就会不停地重新提交。所以在一个临时的监听socket上试一次：提交accept，紧接着取消它，
+        支持时accept以-ECANCELED结束，不支持时是-EINVAL
+    */
+    int fd = socket(PF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if(fd < 0 || bind(fd, (struct sockaddr*)&address, sizeof(address)) < 0 || listen(fd, 1) < 0){
+        if(fd >= 0){
+            close(fd);
+        }
+        return false;
+    }
+    struct io_uring_sqe* sqe = get_sqe(OP_ACCEPT, fd);
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = fd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_CLOEXEC;
+    unsigned long long accept_data = sqe->user_data;
+    sqe = get_sqe(OP_CANCEL, -1);
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->addr = accept_data;
+
+    int accept_res = -EINVAL;
+    int pending = 2;
+    long long deadline = get_ms_time() + 1000;
+    while(pending > 0 && get_ms_time() < deadline){
+        m_ring.submit_and_wait(1, 100);
+        struct io_uring_cqe* cqe;
+        while((cqe = m_ring.peek_cqe()) != NULL){
+            if(cqe->user_data == accept_data){
+                accept_res = cqe->res;
+                if(cqe->res >= 0){
+                    //不会有人连接这个临时端口，万一接受到了也直接关闭
+                    close(cqe->res);
+                }
+                if(!(cqe->flags & IORING_CQE_F_MORE)){
+                    pending--;
+                }
+            }else{
+                pending--;
+            }
+            m_ring.cqe_seen();
+        }
+    }
+    close(fd);
+    if(pending > 0 || accept_res == -EINVAL){
+        errno = EOPNOTSUPP;
+        return false;
+    }
+    return true;
+}
+
+void* reactor::worker(void* arg){
+    reactor* r = (reactor*)arg;
+    r->run();
+    return r;
+}
+
+void reactor::stop(){
+    m_stop = true;
+    uint64_t one = 1;
+    ::write(m_eventfd, &one, sizeof(one));
+}
+
+void reactor::stop_accept(){
+    m_stop_accept = true;
+    uint64_t one = 1;
+    ::write(m_eventfd, &one, sizeof(one));
+}
+
+void reactor::close_listener(){
+    if(m_backend == BACKEND_URING){
+        //关闭文件描述符不会结束已经提交的accept，它持有socket的引用，会继续抢走交给新进程的连接，必须取消
+        struct io_uring_sqe* sqe = get_sqe(OP_CANCEL, -1);
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->addr = ((unsigned long long)OP_ACCEPT << 56) | (unsigned)m_listenfd;
+        m_accept_retry = -1;
+    }else{
+        epoll_ctl(m_epollfd, EPOLL_CTL_DEL, m_listenfd, 0);
+    }
+    close(m_listenfd);
+    m_listenfd = -1;
+    LOG_INFO("reactor %d: stopped accepting, %d connections left", m_id, (int)http_conn::m_user_count.load());
+}
+
+//把timerfd设置为在绝对时间expire(毫秒)触发，expire为-1表示停止计时
+void reactor::set_timerfd(long long expire){
+    struct itimerspec its;
+    memset(&its, 0, sizeof(its));
+    if(expire >= 0){
+        its.it_value.tv_sec = expire / 1000;
+        its.it_value.tv_nsec = (expire % 1000) * 1000000;
+        if(its.it_value.tv_sec == 0 && its.it_value.tv_nsec == 0){
+            //全0表示停止计时，所以至少要设置1纳秒
+            its.it_value.tv_nsec = 1;
+        }
+    }
+    timerfd_settime(m_timerfd, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
+//定时器回调函数，它删除非活动连接socket上的注册事件，并关闭之
+void reactor::cb_func(client_data* user_data){
+    assert( user_data);
+    //定时器由时间轮负责释放
+    user_data->timer = NULL;
+    if(user_data->conn->is_busy()){
+        //请求还在线程池中等待或正在处理，连接对象不能回收，重新计时
+        user_data->owner->add_timer(user_data->sockfd);
+        return;
+    }
+    LOG_DEBUG("close idle fd %d", user_data->sockfd);
+    stats::local()->add(COUNTER_TIMER_EXPIRED);
+    user_data->owner->close_conn(user_data->sockfd);
+}
+
+void reactor::close_conn(int sockfd){
+    http_conn* conn = m_users[sockfd];
+    if(!conn){
+        return;
+    }
+    util_timer* timer = m_users_timer[sockfd].timer;
+    if(timer){
+        m_timer_lst.del_timer(timer);
+        m_users_timer[sockfd].timer = NULL;
+    }
+    conn->close_conn();
+    //连接对象还给slab，io_uring中这个连接迟到的完成项会因为找不到连接而被丢弃
+    m_users[sockfd] = NULL;
+    m_conns.free(conn);
+}
+
+void reactor::deal_accept(){
+    /*
+        一次把积压队列中的连接都接受完，直到EAGAIN。边沿触发模式下必须这样做，否则剩下的连接不会再有通知；
+        水平触发模式下这样做也能避免epoll_wait一次又一次地只因为监听socket返回。
+        accept4直接把新连接设置为非阻塞，不需要再调用fcntl
+    */
+    while(true){
+        struct sockaddr_in client_address;
+        socklen_t client_addrlength = sizeof(client_address);
+        int connfd = accept4(m_listenfd, (struct sockaddr*)&client_address, &client_addrlength, SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+        if(connfd < 0){
+            if(errno == EAGAIN || errno == EWOULDBLOCK){
+                //积压队列已经空了
+                return;
+            }
+            if(errno == EINTR || errno == ECONNABORTED){
+                //连接在被接受之前就被对方重置了，继续接受下一个
+                continue;
+            }
+            if(errno == EMFILE || errno == ENFILE){
+                //文件描述符用完了，积压的连接不接受走的话监听socket一直可读，事件循环会空转
+                if(shed_accept()){
+                    continue;
+                }
+                return;
+            }
+            LOG_WARN("reactor %d accept failed, errno is: %d", m_id, errno);
+            return;
+        }
+        m_fd_exhausted = false;
+        m_stats->add(COUNTER_ACCEPTS);
+        add_conn(connfd, client_address);
+    }
+}
+
+void reactor::refuse(int connfd){
+    m_stats->add(COUNTER_REJECTED);
+    //先读掉已经到达的请求，socket中有没读的数据时close()会发送RST，客户端可能收不到503
+    char buf[1024];
+    recv(connfd, buf, sizeof(buf), MSG_DONTWAIT);
+    send(connfd, error_503_response, error_503_len, MSG_NOSIGNAL | MSG_DONTWAIT);
+    close(connfd);
+}
+
+bool reactor::shed_accept(){
+    if(!m_fd_exhausted){
+        LOG_WARN("reactor %d: out of file descriptors, refusing new connections", m_id);
+        m_fd_exhausted = true;
+    }
+    if(m_reserve_fd == -1){
+        m_reserve_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+        return false;
+    }
+    //关闭预留的描述符腾出一个位置，接受一个连接并拒绝它，再把预留的描述符拿回来。
+    //其他线程可能抢先用掉腾出的位置，这时accept仍然失败，等下一次事件再试
+    close(m_reserve_fd);
+    int connfd = accept4(m_listenfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if(connfd >= 0){
+        refuse(connfd);
+    }
+    m_reserve_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    return connfd >= 0;
+}
+
+bool reactor::add_conn(int connfd, const sockaddr_in& addr){
+    if(connfd >= MAX_FD || http_conn::m_user_count >= m_max_conns){
+        //连接数满了，告诉客户端服务器正忙，稍后再试
+        refuse(connfd);
+        return false;
+    }
+    //将新的客户的数据初始化，放到连接表当中。连接对象从slab中分配，读写缓冲区等到有请求时才分配
+    http_conn* conn = m_conns.alloc();
+    if(!conn){
+        refuse(connfd);
+        return false;
+    }
+    m_users[connfd] = conn;
+    conn->init(connfd, addr, m_epollfd);
+
+    if(m_backend == BACKEND_URING){
+        //发送期间定时器不会关闭连接(见submit_send)，对方一直不确认数据(包括零窗口)时由内核在同样的时间后断开连接，
+        //sendmsg随之失败，连接在它的完成项中关闭
+        unsigned timeout = 3 * TIMESLOT;
+        setsockopt(connfd, IPPROTO_TCP, TCP_USER_TIMEOUT, &timeout, sizeof(timeout));
+    }
+
+    client_data* data = &m_users_timer[connfd];
+    data->address = addr;
+    data->sockfd = connfd;
+    data->conn = conn;
+    data->owner = this;
+    add_timer(connfd);
+    return true;
+}
+
+void reactor::add_timer(int sockfd){
+    client_data* data = &m_users_timer[sockfd];
+    // 创建定时器，设置其回调函数与超时时间，然后绑定定时器与用户数据，最后将定时器添加到时间轮中
+    util_timer* timer = new util_timer;
+    timer->user_date = data;
+    timer->cb_func = cb_func;
+    //设置超时时间为当前时间+15s
+    timer->expire = get_ms_time() + 3 * TIMESLOT;
+    data->timer = timer;
+    //添加定时器到时间轮
+    m_timer_lst.add_timer(timer);
+}
+
+void reactor::refresh_timer(int sockfd){
+    util_timer* timer = m_users_timer[sockfd].timer;
+    if(timer){
+        timer->expire = get_ms_time() + 3 * TIMESLOT;
+        m_timer_lst.adjust_timer(timer);
+    }
+}
+
+void reactor::queue_ready(http_conn* conn){
+    //从这时起到工作线程处理完，连接可能在m_ready、m_paused或者线程池的队列中，
+    //它的定时器随时可能被重新创建，所以现在就标记为忙，定时器到期时不能回收这个连接对象
+    conn->set_busy(true);
+    m_ready[m_ready_count++] = conn;
+}
+
+void reactor::dispatch(){
+    //先重试之前暂停的连接，它们比本轮新读到的请求更早
+    if(m_paused_count > 0){
+        int queued = 0;
+        m_pool->append_batch(m_paused, m_paused_count, queued);
+        for(int i = 0; i < queued; i++){
+            //恢复处理的连接重新开始计算空闲时间
+            add_timer(m_paused[i]->get_sockfd());
+        }
+        memmove(m_paused, m_paused + queued, sizeof(http_conn*) * (m_paused_count - queued));
+        m_paused_count -= queued;
+        if(m_paused_count > 0){
+            //还有连接在等待，新请求也排到它们后面
+            for(int i = 0; i < m_ready_count; i++){
+                util_timer* timer = m_users_timer[m_ready[i]->get_sockfd()].timer;
+                m_timer_lst.del_timer(timer);
+                m_users_timer[m_ready[i]->get_sockfd()].timer = NULL;
+                m_paused[m_paused_count++] = m_ready[i];
+            }
+            m_ready_count = 0;
+            return;
+        }
+    }
+    if(m_ready_count == 0){
+        return;
+    }
+
+    //交给线程去处理
+    int queued = 0;
+    APPEND_RESULT ret = m_pool->append_batch(m_ready, m_ready_count, queued);
+    for(int i = queued; i < m_ready_count; i++){
+        int sockfd = m_ready[i]->get_sockfd();
+        if(ret == APPEND_PAUSED){
+            /*
+                暂停读取：连接注册的是EPOLLONESHOT，这次读事件之后EPOLLIN已经失效，只要不重新注册，
+                新数据就会留在内核缓冲区，客户端会因为TCP窗口被填满而放慢发送。
+                暂停期间不是客户端空闲，所以先取消定时器，恢复时再重新计时
+            */
+            util_timer* timer = m_users_timer[sockfd].timer;
+            m_timer_lst.del_timer(timer);
+            m_users_timer[sockfd].timer = NULL;
+            m_paused[m_paused_count++] = m_ready[i];
+        }else{
+            //拒绝：直接回复503，然后关闭连接
+            m_ready[i]->reject();
+            close_conn(sockfd);
+        }
+    }
+    m_ready_count = 0;
+}
+
+void reactor::deal_read(int sockfd){
+    LOG_DEBUG("reactor %d: fd %d readable", m_id, sockfd);
+    http_conn* conn = m_users[sockfd];
+    if( !conn->read(m_users_timer, sockfd, m_timer_lst, TIMESLOT) ){
+        close_conn(sockfd);
+        return;
+    }
+    if(m_pool){
+        //先收集起来，本轮事件处理完后由dispatch()批量交给线程池
+        queue_ready(conn);
+        return;
+    }
+    //没有线程池时直接在本线程解析，连接始终只由这个reactor处理
+    conn->process();
+}
+
+void reactor::deal_write(int sockfd){
+    LOG_DEBUG("reactor %d: fd %d writable", m_id, sockfd);
+    http_conn* conn = m_users[sockfd];
+    long long pending = conn->get_bytes_to_send();
+    //如果写失败了
+    if(!conn->write()){ //一次性写完所有的数据
+        close_conn(sockfd);
+        return;
+    }
+    if(conn->get_bytes_to_send() != pending){
+        //发出了数据，对方还在接收，延迟该连接被关闭的时间。大文件发送得再久，只要一直有进展就不会被当作空闲连接关闭
+        refresh_timer(sockfd);
+    }
+    if(conn->has_pipelined() && conn->get_iov_count() == 0){
+        //响应都发完了，读缓冲区里还有流水线上的请求，不等新数据到来，按读到了数据处理
+        if(m_pool){
+            queue_ready(conn);
+            return;
+        }
+        conn->process();
+    }
+}
+
+void reactor::run(){
+    m_stats = stats::local();
+    if(m_backend == BACKEND_URING){
+        run_uring();
+    }else{
+        run_epoll();
+    }
+    report();
+}
+
+void reactor::run_epoll(){
+    epoll_event* events = new epoll_event[MAX_EVENT_NUMBER];
+    bool timeout = false;
+
+    while(!m_stop){
+        if(m_stop_accept && m_listenfd != -1){
+            close_listener();
+        }
+        /*
+            让timerfd在最早到期的定时器的时间触发。只有最早到期时间提前了才需要重新设置，
+            推迟了就让timerfd按原来的时间先触发一次，tick()之后再重新设置，这样大部分循环不需要额外的系统调用。
+            timerfd创建失败时退化为用epoll_wait的超时时间来等待下一个到期的定时器
+        */
+        long long next = m_timer_lst.next_expire();
+        int wait_ms = -1;
+        if(m_timerfd != -1){
+            if(next != -1 && (m_armed == -1 || next < m_armed)){
+                set_timerfd(next);
+                m_armed = next;
+            }
+        }else if(next != -1){
+            long long delta = next - get_ms_time();
+            wait_ms = delta > 0 ? (int)delta : 0;
+        }
+        if(m_paused_count > 0 && (wait_ms == -1 || wait_ms > PAUSE_RETRY_MS)){
+            wait_ms = PAUSE_RETRY_MS;
+        }
+
+        int number = epoll_wait(m_epollfd, events, MAX_EVENT_NUMBER, wait_ms);
+        if( (number < 0) && (errno != EINTR)){
+            LOG_ERROR("reactor %d: epoll failure, errno is: %d", m_id, errno);
+            break;
+        }
+        if(number > 0){
+            m_stats->add(COUNTER_WAKEUPS);
+            m_stats->add(COUNTER_EVENTS, number);
+            m_stats->m_batch.record(number);
+        }
+
+        //循环遍历事件数组
+        for(int i = 0; i < number; i++){
+
+            int sockfd = events[i].data.fd;
+
+            if(sockfd == m_listenfd){
+                deal_accept();
+            }else if( sockfd == m_timerfd ){
+                //读出到期次数，清除timerfd的可读状态
+                uint64_t expirations;
+                ::read(m_timerfd, &expirations, sizeof(expirations));
+                //用timeout变量标记有定时任务需要处理，但不立即处理定时任务
+                //这是因为定时任务的优先级不是很高，我们优先处理其他更重要的任务。
+                timeout = true;
+                m_armed = -1;
+            }else if( sockfd == m_eventfd ){
+                uint64_t value;
+                ::read(m_eventfd, &value, sizeof(value));
+            }else if(events[i].events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)){
+                LOG_DEBUG("reactor %d: fd %d hung up", m_id, sockfd);
+                //对方异常断开或者错误等事件
+                close_conn(sockfd);
+            }else if(events[i].events & EPOLLIN){
+                deal_read(sockfd);
+            }else if(events[i].events & EPOLLOUT){
+                deal_write(sockfd);
+            }
+        }
+        if(m_pool){
+            dispatch();
+        }
+        //最后处理定时事件，因为I/O事件有更高的优先级。当然，这样做将导致定时任务不能精准的按照预定的时间执行。
+        if(timeout || (m_timerfd == -1 && next != -1 && get_ms_time() >= next)){
+            //定时处理任务，实际上就是调用tick()函数
+            m_timer_lst.tick();
+            timeout = false;
+        }
+    }
+    delete []events;
+}
+
+struct io_uring_sqe* reactor::get_sqe(int op, int fd){
+    struct io_uring_sqe* sqe = m_ring.get_sqe();
+    while(!sqe){
+        //提交队列满了，先把已经填好的提交给内核
+        m_ring.submit();
+        sqe = m_ring.get_sqe();
+    }
+    unsigned gen = (fd >= 0 && m_users[fd]) ? m_users[fd]->get_generation() : 0;
+    sqe->user_data = ((unsigned long long)op << 56) | ((unsigned long long)(gen & 0xffffff) << 32) | (unsigned)fd;
+    return sqe;
+}
+
+void reactor::submit_accept(){
+    //一次提交，每接受一个连接产生一个完成项，直到完成项中没有IORING_CQE_F_MORE标志才需要重新提交。
+    //多次触发的accept拿不到对方地址，连接的地址保持为0
+    struct io_uring_sqe* sqe = get_sqe(OP_ACCEPT, m_listenfd);
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = m_listenfd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_CLOEXEC;
+}
+
+//提交一个recv，数据放在内核从缓冲区组0中挑选的缓冲区里，等待数据期间连接不占用缓冲区
+void reactor::submit_recv(int fd){
+    struct io_uring_sqe* sqe = get_sqe(OP_RECV, fd);
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = fd;
+    sqe->len = m_ring.buf_size();
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = 0;
+}
+
+//流水线上攒下的所有响应用一个sendmsg发出，相当于writev。响应头和文件内容在同一次调用中交给内核，
+//不会先单独发出一个小的响应头报文，再因为Nagle算法等待对方的延迟确认。
+//MSG_WAITALL让内核在socket缓冲区满时等待，直到全部发出才完成，一个完成项就说明整批响应发完了
+void reactor::submit_send(int fd){
+    http_conn* conn = m_users[fd];
+    //msghdr在请求完成之前都要有效，每个连接一个，用文件描述符索引
+    struct msghdr* msg = &m_send_msgs[fd];
+    memset(msg, 0, sizeof(*msg));
+    msg->msg_iov = (struct iovec*)conn->get_iov();
+    msg->msg_iovlen = conn->get_iov_count();
+    //内核直接从写缓冲区和缓存文件的映射中发送，发完之前这些内存不能释放，
+    //所以标记为忙，定时器到期时只重新计时，连接等sendmsg的完成项到了再关闭
+    conn->set_busy(true);
+    struct io_uring_sqe* sqe = get_sqe(OP_SEND, fd);
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = fd;
+    sqe->addr = (unsigned long)msg;
+    sqe->len = 1;
+    sqe->msg_flags = MSG_WAITALL | MSG_NOSIGNAL;
+    if(conn->is_linger() && !conn->has_pipelined()){
+        //保持连接时，下一个请求的recv直接链接在响应后面，不需要再等一轮事件循环。
+        //读缓冲区里还有请求时不提交recv，等响应发完后先处理它们
+        sqe->flags = IOSQE_IO_LINK;
+        submit_recv(fd);
+    }
+}
+
+void reactor::submit_event_poll(){
+    struct io_uring_sqe* sqe = get_sqe(OP_EVENT, -1);
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = m_eventfd;
+    sqe->poll32_events = POLLIN;
+}
+
+void reactor::handle_cqe(struct io_uring_cqe* cqe){
+    if(cqe->user_data == 0){
+        //归还缓冲区失败，这个缓冲区就不再使用了
+        return;
+    }
+    int op = cqe->user_data >> 56;
+    unsigned gen = (cqe->user_data >> 32) & 0xffffff;
+    int fd = (int)(cqe->user_data & 0xffffffff);
+    int res = cqe->res;
+
+    if(op == OP_ACCEPT){
+        if(res == -EMFILE || res == -ENFILE){
+            //文件描述符用完时多次触发的accept会结束。先拒绝掉积压的连接；io_uring的accept先分配描述符再等待连接，
+            //描述符没有空出来之前重新提交会立即再次失败，所以过一段时间再提交
+            while(shed_accept()){
+            }
+            if(m_listenfd != -1){
+                m_accept_retry = get_ms_time() + ACCEPT_RETRY_MS;
+            }
+            return;
+        }
+        if(res >= 0){
+            m_fd_exhausted = false;
+            m_stats->add(COUNTER_ACCEPTS);
+            struct sockaddr_in client_address;
+            memset(&client_address, 0, sizeof(client_address));
+            if(add_conn(res, client_address)){
+                submit_recv(res);
+            }
+        }
+        if(res == -EINVAL){
+            //init()中已经确认内核支持多次触发的accept，这里不应该出现。立即重新提交只会空转，不再接受连接
+            LOG_ERROR("reactor %d: io_uring accept is not supported, stop accepting", m_id);
+            return;
+        }
+        if(!(cqe->flags & IORING_CQE_F_MORE) && m_listenfd != -1){
+            //多次触发的accept结束了(出错或被取消)，重新提交。已经停止接受连接时是被取消的，不再提交
+            submit_accept();
+        }
+        return;
+    }
+    if(op == OP_CANCEL){
+        return;
+    }
+    if(op == OP_EVENT){
+        uint64_t value;
+        ::read(m_eventfd, &value, sizeof(value));
+        submit_event_poll();
+        return;
+    }
+
+    //内核选中的缓冲区无论完成项是否过期都要还回去
+    int bid = -1;
+    if(cqe->flags & IORING_CQE_F_BUFFER){
+        bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+    }
+    //连接已经关闭，或者这个文件描述符已经被新连接复用了，丢弃旧连接的完成项
+    http_conn* conn = m_users[fd];
+    if(!conn || conn->get_sockfd() != fd || (conn->get_generation() & 0xffffff) != gen){
+        if(bid != -1){
+            m_ring.recycle_buf(bid);
+        }
+        return;
+    }
+
+    if(op == OP_RECV){
+        if(res == -ENOBUFS){
+            //提供的缓冲区暂时用完了，重新提交，等其他连接把缓冲区还回来
+            submit_recv(fd);
+            return;
+        }
+        if(res <= 0){
+            //对方关闭连接或者出错
+            close_conn(fd);
+            return;
+        }
+        bool ok = conn->feed(m_ring.buf_addr(bid), res);
+        m_ring.recycle_buf(bid);
+        if(!ok){
+            //请求太大，读缓冲区放不下
+            close_conn(fd);
+            return;
+        }
+        //有数据可读，延迟该连接被关闭的时间
+        refresh_timer(fd);
+        if(conn->process()){
+            submit_send(fd);
+        }else{
+            //请求还不完整，继续读
+            submit_recv(fd);
+        }
+        return;
+    }
+
+    //sendmsg失败时链接在它后面的recv以-ECANCELED完成，连接已经关闭，那个完成项会被丢弃
+    conn->set_busy(false);
+    if(res < 0){
+        close_conn(fd);
+        return;
+    }
+    const struct iovec* iv = conn->get_iov();
+    size_t total = 0;
+    for(int i = 0; i < conn->get_iov_count(); i++){
+        total += iv[i].iov_len;
+    }
+    if((size_t)res < total || !conn->finish_write()){
+        //没有发完，或者不保持连接
+        close_conn(fd);
+        return;
+    }
+    //响应发完了，从现在开始计算空闲时间
+    refresh_timer(fd);
+    if(conn->has_pipelined()){
+        //处理流水线上已经收到的请求
+        if(conn->process()){
+            submit_send(fd);
+        }else{
+            submit_recv(fd);
+        }
+    }
+}
+
+void reactor::run_uring(){
+    submit_accept();
+    submit_event_poll();
+
+    while(!m_stop){
+        if(m_stop_accept && m_listenfd != -1){
+            close_listener();
+        }
+        //最早到期的定时器决定这次最多等多久，不需要timerfd
+        long long next = m_timer_lst.next_expire();
+        if(m_accept_retry != -1 && (next == -1 || m_accept_retry < next)){
+            next = m_accept_retry;
+        }
+        int wait_ms = -1;
+        if(next != -1){
+            long long delta = next - get_ms_time();
+            wait_ms = delta > 0 ? (int)delta : 0;
+        }
+
+        //提交本轮积累的所有请求并等待完成，整个循环只有这一次系统调用
+        int ret = m_ring.submit_and_wait(wait_ms == 0 ? 0 : 1, wait_ms);
+        if(ret < 0 && errno != ETIME && errno != EINTR && errno != EBUSY){
+            LOG_ERROR("reactor %d: io_uring_enter failure, errno is: %d", m_id, errno);
+            break;
+        }
+        m_stats->add(COUNTER_WAKEUPS);
+
+        struct io_uring_cqe* cqe;
+        int events = 0;
+        while((cqe = m_ring.peek_cqe()) != NULL){
+            //先复制再标记已读，处理时提交新请求不会覆盖它
+            struct io_uring_cqe copy = *cqe;
+            m_ring.cqe_seen();
+            events++;
+            handle_cqe(&copy);
+        }
+        m_stats->add(COUNTER_EVENTS, events);
+        m_stats->m_batch.record(events);
+
+        long long now = get_ms_time();
+        if(m_accept_retry != -1 && now >= m_accept_retry){
+            m_accept_retry = -1;
+            submit_accept();
+        }
+        if(next != -1 && now >= next){
+            m_timer_lst.tick();
+        }
+    }
+}
+
+//打印每次唤醒平均处理的事件数，用来比较边沿触发和水平触发模式。reactor线程只运行这一个事件循环，线程的计数就是它的计数
+void reactor::report(){
+    unsigned long long wakeups = m_stats->m_counters[COUNTER_WAKEUPS].load(std::memory_order_relaxed);
+    unsigned long long events = m_stats->m_counters[COUNTER_EVENTS].load(std::memory_order_relaxed);
+    LOG_INFO("reactor %d: %llu wakeups, %llu events, %.2f events/wakeup, %llu accepts",
+        m_id, wakeups, events, wakeups ? (double)events / wakeups : 0.0,
+        (unsigned long long)m_stats->m_counters[COUNTER_ACCEPTS].load(std::memory_order_relaxed));
+}
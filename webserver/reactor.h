@@ -0,0 +1,116 @@
+#ifndef REACTOR_H
+#define REACTOR_H
+
+#include <pthread.h>
+#include <netinet/in.h>
+#include "threadpool.h"
+#include "http_conn.h"
+#include "lst_timer.h"
+#include "uring.h"
+#include "slab_pool.h"
+#include "stats.h"
+
+#define MAX_FD  65535 // 文件描述符的最大个数
+#define MAX_EVENT_NUMBER 10000 //一次监听的最大的数量
+#define TIMESLOT 5000 //定时器的基本时间单位(毫秒)，非活动连接在 3*TIMESLOT 后被关闭
+#define PAUSE_RETRY_MS 1 //有连接因为请求队列满而暂停时，事件循环重试入队的间隔(毫秒)
+#define ACCEPT_RETRY_MS 100 //io_uring后端文件描述符用完时，隔这么久再重新提交accept(毫秒)
+#define URING_ENTRIES 4096 //io_uring提交队列的大小
+#define URING_BUFFERS 1024 //提供给内核的接收缓冲区个数
+
+// 事件循环使用的I/O后端，启动时选择
+enum IO_BACKEND { BACKEND_EPOLL = 0, BACKEND_URING };
+
+/*
+    一个reactor就是一个独立的事件循环：它有自己的epoll对象、监听socket、连接表和时间轮。
+    多个reactor通过SO_REUSEPORT监听同一个端口，由内核把新连接分给各个监听socket，
+    连接在整个生命周期内都只由接收它的那个reactor处理，reactor之间不共享任何连接状态。
+    pool为NULL时，请求的解析也在reactor线程中完成；否则交给线程池处理。
+    io_uring后端用多次触发(multishot)的accept接受连接，recv从内核提供的缓冲区组中取缓冲区，
+    流水线上的所有响应用一个sendmsg发出，keep-alive连接的下一次recv用IOSQE_IO_LINK链接在它后面，
+    一轮事件循环只需要一次io_uring_enter。这个后端总是在reactor线程中解析请求，不使用线程池。
+    热升级时，监听socket由旧进程传过来，listenfd不为-1，init()不再创建和绑定。
+*/
+class reactor
+{
+public:
+    reactor(int id, int port, threadpool<http_conn>* pool, IO_BACKEND backend = BACKEND_EPOLL, int listenfd = -1);
+    ~reactor();
+
+    bool init();    //创建监听socket、epoll对象(或io_uring实例)、timerfd和用于唤醒的eventfd
+    void run();     //事件循环，直到stop()被调用
+    void stop();    //可以在其他线程中调用，通知事件循环退出
+    void stop_accept();     //可以在其他线程中调用，让事件循环关闭监听socket，已有的连接继续处理
+    int get_listenfd() const { return m_listenfd; }
+
+    //线程入口函数，参数是reactor对象
+    static void* worker(void* arg);
+
+    //所有reactor的连接总数的上限，达到后新连接直接回复503，启动时设置
+    static int m_max_conns;
+
+private:
+    //io_uring请求的user_data：低32位是文件描述符，中间24位是连接的代数，最高8位是操作类型
+    enum URING_OP { OP_ACCEPT = 1, OP_RECV, OP_SEND, OP_EVENT, OP_CANCEL };
+
+    void run_epoll();
+    void run_uring();
+    bool add_conn(int connfd, const sockaddr_in& addr);    //初始化新连接并创建定时器，连接数满了返回false
+    void deal_accept();
+    void refuse(int connfd);        //过载时回复503并关闭刚接受的连接
+    bool shed_accept();             //文件描述符用完时，用预留的描述符接受一个连接并拒绝它，返回是否拒绝了一个连接
+    void close_listener();          //停止接受连接：从epoll中删除(或取消io_uring的accept)并关闭监听socket
+    void deal_read(int sockfd);
+    void deal_write(int sockfd);
+    void close_conn(int sockfd);    //删除连接的定时器并关闭连接
+    void add_timer(int sockfd);     //给连接创建定时器，超时时间为当前时间+3*TIMESLOT
+    void refresh_timer(int sockfd); //连接有进展(收到数据或者发出了数据)，超时时间推迟到当前时间+3*TIMESLOT
+    void queue_ready(http_conn* conn);  //标记为忙并放入m_ready，等dispatch()交给线程池
+    void dispatch();                //把本轮读到完整数据的连接批量交给线程池，队列满时按线程池的策略施加背压
+    void set_timerfd(long long expire);
+    void report();                  //打印事件循环的统计信息
+
+    bool probe_multishot_accept();  //内核是否支持多次触发的accept，不支持时init()退回epoll
+    struct io_uring_sqe* get_sqe(int op, int fd);   //取一个提交项并填好user_data，SQ满了先提交
+    void submit_accept();
+    void submit_recv(int fd);
+    void submit_send(int fd);
+    void submit_event_poll();
+    void handle_cqe(struct io_uring_cqe* cqe);
+
+    //定时器回调函数，它关闭非活动的连接
+    static void cb_func(client_data* user_data);
+
+private:
+    int m_id;
+    int m_port;
+    int m_listenfd;
+    int m_epollfd;
+    int m_timerfd;
+    int m_eventfd;      //其他线程通过它唤醒事件循环
+    int m_reserve_fd;   //预留的文件描述符，文件描述符用完时关闭它来接受并拒绝积压的连接
+    bool m_fd_exhausted;    //文件描述符已经用完，只在刚用完时打印一次日志
+    long long m_accept_retry;   //io_uring后端重新提交accept的时间，-1表示accept正在进行
+    volatile bool m_stop;
+    volatile bool m_stop_accept;
+    IO_BACKEND m_backend;
+    io_ring m_ring;
+    struct msghdr* m_send_msgs;  //io_uring后端正在进行的sendmsg使用的msghdr，用文件描述符索引
+
+    threadpool<http_conn>* m_pool;
+
+    http_conn** m_ready;         //本轮事件循环中等待交给线程池的连接
+    int m_ready_count;
+    http_conn** m_paused;        //因为请求队列满而暂停读取的连接，它们的EPOLLIN没有重新注册，定时器也暂时取消
+    int m_paused_count;
+
+    http_conn** m_users;         //连接表，用文件描述符索引，没有连接的位置是NULL
+    slab_pool<http_conn> m_conns;   //连接对象在接受连接时从这里分配，关闭时归还，只在本reactor线程中使用
+    client_data* m_users_timer;  //定时器使用的用户数据，同样用文件描述符索引
+    time_wheel m_timer_lst;
+    long long m_armed;           //timerfd当前设置的触发时间
+
+    thread_stats* m_stats;       //reactor线程的统计数据：唤醒次数、事件数、接受的连接数等
+};
+
+#endif
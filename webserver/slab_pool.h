@@ -0,0 +1,80 @@
+#ifndef SLAB_POOL_H
+#define SLAB_POOL_H
+
+#include <stdlib.h>
+#include <new>
+#include <vector>
+
+/*
+    定长对象的slab分配器。一次向系统申请能放下若干个对象的一大块内存(slab)，切成槽位串在空闲链表上，
+    分配和释放只是从链表头取下或放回一个槽位。空闲槽位的开头用来存放链表指针，不需要额外的内存。
+    slab只在分配器销毁时才归还，所以占用的内存取决于同时存在的对象数的峰值，而不是预先设定的上限。
+    不加锁，只能在一个线程中使用。
+*/
+template <typename T>
+class slab_pool
+{
+private:
+    union slot
+    {
+        slot* m_next;
+        alignas(T) char m_storage[sizeof(T)];
+    };
+
+public:
+    //per_slab是每次向系统申请时一块slab中的对象数
+    explicit slab_pool(int per_slab = 64): m_per_slab(per_slab), m_free(NULL), m_live(0){}
+
+    //还在使用中的对象由调用者在这之前释放
+    ~slab_pool(){
+        for(size_t i = 0; i < m_slabs.size(); i++){
+            ::free(m_slabs[i]);
+        }
+    }
+
+    //取一个槽位并调用T的默认构造函数，内存不足时返回NULL
+    T* alloc(){
+        if(!m_free && !grow()){
+            return NULL;
+        }
+        slot* s = m_free;
+        m_free = s->m_next;
+        m_live++;
+        return new (s->m_storage) T();
+    }
+
+    void free(T* obj){
+        if(!obj){
+            return;
+        }
+        obj->~T();
+        slot* s = (slot*)obj;
+        s->m_next = m_free;
+        m_free = s;
+        m_live--;
+    }
+
+    int live() const { return m_live; }
+
+private:
+    bool grow(){
+        slot* slab = (slot*)malloc(sizeof(slot) * m_per_slab);
+        if(!slab){
+            return false;
+        }
+        m_slabs.push_back(slab);
+        for(int i = m_per_slab - 1; i >= 0; i--){
+            slab[i].m_next = m_free;
+            m_free = &slab[i];
+        }
+        return true;
+    }
+
+private:
+    int m_per_slab;
+    slot* m_free;                   //空闲槽位的链表
+    int m_live;                     //已经分配出去的对象数
+    std::vector<slot*> m_slabs;
+};
+
+#endif
@@ -0,0 +1,197 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdarg.h>
+#include "stats.h"
+
+std::atomic<thread_stats*> stats::m_threads[stats::MAX_THREADS];
+std::atomic<int> stats::m_thread_count(0);
+__thread thread_stats* stats::m_local = NULL;
+
+// 线程太多时多出来的线程写这里，不输出
+static thread_stats overflow_stats;
+
+static const char* stage_names[STAGE_COUNT] = { "accept_to_first_byte", "recv", "queue_wait", "parse", "file", "write" };
+static const int status_codes[STATUS_COUNT] = { 200, 206, 304, 400, 403, 404, 416, 500 };
+
+// Prometheus直方图的上界(秒)，1-2.5-5序列
+static const double stage_bounds[] = { 1e-6, 2.5e-6, 5e-6, 1e-5, 2.5e-5, 5e-5, 1e-4, 2.5e-4, 5e-4, 1e-3,
+    2.5e-3, 5e-3, 1e-2, 2.5e-2, 5e-2, 0.1, 0.25, 0.5, 1, 2.5, 5, 10 };
+static const double batch_bounds[] = { 1, 2, 4, 8, 16, 32, 64, 128, 256, 512, 1024 };
+static const double quantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+
+// 所有线程合并以后的直方图
+struct histogram_snapshot
+{
+    uint64_t m_counts[histogram::BUCKETS];
+    uint64_t m_sum;
+    uint64_t m_count;
+
+    void merge(const histogram& h){
+        for(int i = 0; i < histogram::BUCKETS; i++){
+            m_counts[i] += h.m_counts[i].load(std::memory_order_relaxed);
+        }
+        m_sum += h.m_sum.load(std::memory_order_relaxed);
+        m_count += h.m_count.load(std::memory_order_relaxed);
+    }
+
+    // 不超过bound的值的个数，桶的中点不超过bound就算在内
+    uint64_t below(double bound) const{
+        uint64_t n = 0;
+        for(int i = 0; i < histogram::BUCKETS; i++){
+            if(histogram::lower(i) + (histogram::width(i) - 1) / 2.0 > bound){
+                break;
+            }
+            n += m_counts[i];
+        }
+        return n;
+    }
+
+    // 第q分位数所在的桶的中点
+    double quantile(double q) const{
+        uint64_t total = 0;
+        for(int i = 0; i < histogram::BUCKETS; i++){
+            total += m_counts[i];
+        }
+        if(total == 0){
+            return 0;
+        }
+        uint64_t rank = (uint64_t)(q * total);
+        if(rank >= total){
+            rank = total - 1;
+        }
+        uint64_t seen = 0;
+        for(int i = 0; i < histogram::BUCKETS; i++){
+            seen += m_counts[i];
+            if(seen > rank){
+                return histogram::lower(i) + (histogram::width(i) - 1) / 2.0;
+            }
+        }
+        return 0;
+    }
+};
+
+struct stats_snapshot
+{
+    histogram_snapshot m_stages[STAGE_COUNT];
+    histogram_snapshot m_batch;
+    uint64_t m_counters[COUNTER_COUNT];
+    uint64_t m_status[STATUS_COUNT];
+};
+
+// 往固定大小的缓冲区里追加格式化的文本，放不下时继续计算需要的长度
+struct text_writer
+{
+    char* m_buf;
+    int m_size;
+    int m_len;
+
+    void print(const char* fmt, ...){
+        va_list ap;
+        va_start(ap, fmt);
+        int room = m_len < m_size ? m_size - m_len : 0;
+        int n = vsnprintf(room ? m_buf + m_len : NULL, room, fmt, ap);
+        va_end(ap);
+        if(n > 0){
+            m_len += n;
+        }
+    }
+};
+
+thread_stats* stats::create(){
+    int id = m_thread_count.fetch_add(1);
+    if(id >= MAX_THREADS){
+        return &overflow_stats;
+    }
+    thread_stats* s = new thread_stats();
+    m_threads[id].store(s, std::memory_order_release);
+    return s;
+}
+
+// scale把直方图的单位换算成输出的单位(纳秒到秒)
+static void write_histogram(text_writer& out, const char* name, const char* label, const histogram_snapshot& h,
+                            const double* bounds, int bound_count, double scale){
+    const char* sep = label[0] ? "," : "";
+    for(int i = 0; i < bound_count; i++){
+        out.print("%s_bucket{%s%sle=\"%g\"} %llu\n", name, label, sep, bounds[i], (unsigned long long)h.below(bounds[i] / scale));
+    }
+    out.print("%s_bucket{%s%sle=\"+Inf\"} %llu\n", name, label, sep, (unsigned long long)h.m_count);
+    if(label[0]){
+        out.print("%s_sum{%s} %g\n%s_count{%s} %llu\n", name, label, h.m_sum * scale, name, label, (unsigned long long)h.m_count);
+    }else{
+        out.print("%s_sum %g\n%s_count %llu\n", name, h.m_sum * scale, name, (unsigned long long)h.m_count);
+    }
+}
+
+int stats::render(char* buf, int size, int connections){
+    //合并的结果有几十KB，不放在栈上
+    stats_snapshot* snap = new stats_snapshot();
+    int count = m_thread_count.load();
+    for(int t = 0; t < count && t < MAX_THREADS; t++){
+        thread_stats* s = m_threads[t].load(std::memory_order_acquire);
+        if(!s){
+            continue;
+        }
+        for(int i = 0; i < STAGE_COUNT; i++){
+            snap->m_stages[i].merge(s->m_stages[i]);
+        }
+        snap->m_batch.merge(s->m_batch);
+        for(int i = 0; i < COUNTER_COUNT; i++){
+            snap->m_counters[i] += s->m_counters[i].load(std::memory_order_relaxed);
+        }
+        for(int i = 0; i < STATUS_COUNT; i++){
+            snap->m_status[i] += s->m_status[i].load(std::memory_order_relaxed);
+        }
+    }
+
+    text_writer out = { buf, size, 0 };
+    out.print("# HELP webserver_connections Open client connections.\n# TYPE webserver_connections gauge\n");
+    out.print("webserver_connections %d\n", connections);
+
+    out.print("# HELP webserver_responses_total Responses by status code.\n# TYPE webserver_responses_total counter\n");
+    for(int i = 0; i < STATUS_COUNT; i++){
+        out.print("webserver_responses_total{code=\"%d\"} %llu\n", status_codes[i], (unsigned long long)snap->m_status[i]);
+    }
+    out.print("webserver_responses_total{code=\"503\"} %llu\n",
+              (unsigned long long)(snap->m_counters[COUNTER_REJECTED] + snap->m_counters[COUNTER_SHED]));
+
+    static const struct { STAT_COUNTER m_id; const char* m_name; const char* m_help; } counters[] = {
+        { COUNTER_BYTES_IN, "webserver_received_bytes_total", "Bytes received from clients." },
+        { COUNTER_BYTES_OUT, "webserver_sent_bytes_total", "Response bytes sent to clients." },
+        { COUNTER_REJECTED, "webserver_rejected_total", "Connections refused with 503 because a queue, connection or fd limit was hit." },
+        { COUNTER_SHED, "webserver_shed_total", "Requests dropped with 503 because they waited in the queue too long." },
+        { COUNTER_TIMER_EXPIRED, "webserver_timer_expirations_total", "Connections closed by the idle timer." },
+        { COUNTER_WAKEUPS, "webserver_wakeups_total", "Event loop wakeups." },
+        { COUNTER_EVENTS, "webserver_events_total", "Events handled by the event loops." },
+        { COUNTER_ACCEPTS, "webserver_accepts_total", "Accepted connections." },
+    };
+    for(size_t i = 0; i < sizeof(counters) / sizeof(counters[0]); i++){
+        out.print("# HELP %s %s\n# TYPE %s counter\n%s %llu\n", counters[i].m_name, counters[i].m_help,
+                  counters[i].m_name, counters[i].m_name, (unsigned long long)snap->m_counters[counters[i].m_id]);
+    }
+
+    out.print("# HELP webserver_events_per_wakeup Events handled per event loop wakeup.\n# TYPE webserver_events_per_wakeup histogram\n");
+    write_histogram(out, "webserver_events_per_wakeup", "", snap->m_batch, batch_bounds, sizeof(batch_bounds) / sizeof(batch_bounds[0]), 1);
+
+    out.print("# HELP webserver_stage_seconds Time spent in each request stage.\n# TYPE webserver_stage_seconds histogram\n");
+    for(int i = 0; i < STAGE_COUNT; i++){
+        char label[64];
+        snprintf(label, sizeof(label), "stage=\"%s\"", stage_names[i]);
+        write_histogram(out, "webserver_stage_seconds", label, snap->m_stages[i], stage_bounds,
+                        sizeof(stage_bounds) / sizeof(stage_bounds[0]), 1e-9);
+    }
+
+    //直方图本身的精度比Prometheus的分桶高得多，分位数直接在这里算好
+    out.print("# HELP webserver_stage_quantile_seconds Stage latency quantiles.\n# TYPE webserver_stage_quantile_seconds gauge\n");
+    for(int i = 0; i < STAGE_COUNT; i++){
+        for(size_t q = 0; q < sizeof(quantiles) / sizeof(quantiles[0]); q++){
+            out.print("webserver_stage_quantile_seconds{stage=\"%s\",quantile=\"%g\"} %g\n", stage_names[i], quantiles[q],
+                      snap->m_stages[i].quantile(quantiles[q]) * 1e-9);
+        }
+    }
+
+    delete snap;
+    if(out.m_len < size){
+        buf[out.m_len] = '\0';
+    }
+    return out.m_len;
+}
@@ -0,0 +1,145 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdint.h>
+#include <time.h>
+#include <atomic>
+#include "http_response.h"
+
+/*
+    运行时的统计信息：每个阶段的延迟直方图和一些计数器。
+    每个线程只写自己的一份(thread_stats)，记录时没有锁，也没有原子的读-改-写操作，只是普通的加法和存储；
+    访问/__stats时才把所有线程的数据加在一起，按Prometheus的文本格式输出，这个请求不经过文件缓存，也不访问文件系统。
+    直方图采用HDR的对数-线性分桶：每个2的幂区间再平均分成16份，任何大小的值相对误差都不超过1/16，
+    记录只需要几条位运算，桶的个数和记录的次数无关。
+*/
+
+#define STATS_URL "/__stats"
+
+// 被计时的阶段
+enum STAT_STAGE
+{
+    STAGE_FIRST_BYTE = 0,   // 接受连接到第一个响应开始发送
+    STAGE_RECV,             // 一次可读事件中读socket用的时间
+    STAGE_QUEUE,            // 请求在线程池队列中等待的时间
+    STAGE_PARSE,            // 解析请求行和头部字段
+    STAGE_FILE,             // do_request()：查缓存、stat、打开和映射文件
+    STAGE_WRITE,            // 响应生成以后到全部发送完
+    STAGE_COUNT
+};
+
+enum STAT_COUNTER
+{
+    COUNTER_BYTES_IN = 0,   // 收到的字节数
+    COUNTER_BYTES_OUT,      // 发出的响应字节数
+    COUNTER_REJECTED,       // 过载时回复的503：请求队列满、连接数达到上限或文件描述符用完
+    COUNTER_SHED,           // 排队太久被CoDel丢弃、回复了503的请求
+    COUNTER_TIMER_EXPIRED,  // 因为超时被关闭的连接
+    COUNTER_WAKEUPS,        // epoll_wait(或io_uring_enter)返回的次数
+    COUNTER_EVENTS,         // 返回的事件(或完成项)总数
+    COUNTER_ACCEPTS,        // 接受的连接数
+    COUNTER_COUNT
+};
+
+// 单个线程写、任意线程读的直方图，值的单位由使用者决定(阶段延迟是纳秒)
+class histogram
+{
+public:
+    static const int SUB_BITS = 4;
+    static const int SUB_COUNT = 1 << SUB_BITS;
+    static const int MAX_BITS = 40;     //更大的值按2^40-1记录，纳秒的话大约18分钟
+    static const int BUCKETS = (MAX_BITS - SUB_BITS + 1) * SUB_COUNT;
+
+    void record(uint64_t v){
+        if(v >= (1ULL << MAX_BITS)){
+            v = (1ULL << MAX_BITS) - 1;
+        }
+        bump(m_counts[index(v)], 1);
+        bump(m_sum, v);
+        bump(m_count, 1);
+    }
+
+    static int index(uint64_t v){
+        if(v < SUB_COUNT){
+            return v;
+        }
+        int e = 63 - __builtin_clzll(v);
+        return (e - SUB_BITS + 1) * SUB_COUNT + ((v >> (e - SUB_BITS)) & (SUB_COUNT - 1));
+    }
+
+    // 第i个桶中最小的值和桶的宽度
+    static uint64_t lower(int i){
+        if(i < SUB_COUNT){
+            return i;
+        }
+        int e = i / SUB_COUNT + SUB_BITS - 1;
+        return (uint64_t)(SUB_COUNT + i % SUB_COUNT) << (e - SUB_BITS);
+    }
+
+    static uint64_t width(int i){
+        return i < SUB_COUNT ? 1 : 1ULL << (i / SUB_COUNT - 1);
+    }
+
+    std::atomic<uint64_t> m_counts[BUCKETS];
+    std::atomic<uint64_t> m_sum;
+    std::atomic<uint64_t> m_count;
+
+private:
+    //只有所属线程写，不需要原子的加法，relaxed的读和写在x86上就是普通的mov
+    static void bump(std::atomic<uint64_t>& c, uint64_t n){
+        c.store(c.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+};
+
+struct thread_stats
+{
+    histogram m_stages[STAGE_COUNT];
+    histogram m_batch;                          // 每次唤醒处理的事件数
+    std::atomic<uint64_t> m_counters[COUNTER_COUNT];
+    std::atomic<uint64_t> m_status[STATUS_COUNT];  // 按状态码统计的响应数
+
+    void record(STAT_STAGE stage, long long ns){
+        m_stages[stage].record(ns > 0 ? ns : 0);
+    }
+
+    void add(STAT_COUNTER counter, uint64_t n = 1){
+        m_counters[counter].store(m_counters[counter].load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    void count_status(HTTP_STATUS status){
+        m_status[status].store(m_status[status].load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+};
+
+// 单调时钟的纳秒数，各阶段的起止时间都用它
+static inline long long get_ns_time(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+class stats
+{
+public:
+    // 当前线程的统计数据，第一次调用时创建并登记。线程数超过上限以后的线程共用一份不输出的数据
+    static thread_stats* local(){
+        if(!m_local){
+            m_local = create();
+        }
+        return m_local;
+    }
+
+    // 把所有线程的数据加在一起，按Prometheus的文本格式写到buf中。
+    // 返回完整输出需要的长度(不含'\0')，和snprintf一样，大于等于size时说明输出被截断了
+    static int render(char* buf, int size, int connections);
+
+private:
+    static thread_stats* create();
+
+    static const int MAX_THREADS = 256;
+    static std::atomic<thread_stats*> m_threads[MAX_THREADS];
+    static std::atomic<int> m_thread_count;
+    static __thread thread_stats* m_local;
+};
+
+#endif
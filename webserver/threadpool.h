@@ -2,27 +2,75 @@
 #define THREADPOOL_H
 
 #include <pthread.h>
-#include <list>
+#include <sched.h>
+#include <atomic>
 #include "locker.h"
+#include "mpmc_queue.h"
+#include "log.h"
+#include "stats.h"
+#include "codel.h"
 #include <cstdio>
 #include <exception>
 using namespace std;
 
-//线程池，定义为模板类是为了代码的复用
+// 请求队列满时的处理策略：拒绝(由调用者返回503)、暂停(调用者暂停读取该连接，稍后重试)、阻塞调用者直到有空位
+enum OVERFLOW_POLICY { OVERFLOW_REJECT = 0, OVERFLOW_PAUSE, OVERFLOW_BLOCK };
+
+// append() 的结果：已加入队列、队列满被拒绝、队列满需要暂停后重试
+enum APPEND_RESULT { APPEND_OK = 0, APPEND_REJECTED, APPEND_PAUSED };
+
+#define CODEL_INTERVAL (100 * 1000000LL)   //CoDel判断排队延迟是否持续超标的时间窗口(纳秒)
+
+/*
+    线程池，定义为模板类是为了代码的复用。
+    采用工作窃取(work stealing)的调度方式：每个工作线程有自己的任务队列，append() 轮流把任务放到各个队列中，
+    工作线程优先从自己的队列批量取任务；自己的队列空了就从随机选中的其他线程的队列中窃取任务；
+    所有队列都空时线程休眠，直到有新任务到来。
+    任务入队时记下时间，工作线程取出时把排队的时间记到自己的统计数据中。
+    指定了排队延迟的目标时，每个工作线程按CoDel算法丢弃排队太久的请求，调用请求的shed()让它回复503，
+    这样过载时队列延迟保持在目标附近，而不是等队列满了才拒绝。
+    每个队列都是有界的无锁环形队列，append()、取任务和窃取都不需要加锁，也不需要分配内存。
+    队列满时不再抛出异常，而是按照构造时指定的策略把结果返回给调用者，由调用者施加背压。
+*/
 template <typename T>
 class threadpool
 {
 
 public:
-    /*thread_number是线程池中线程的数量，max_requests是请求队列中最多允许的、等待处理的请求的数量*/
-    threadpool(int thread_number = 8, int max_requests = 10000);
+    /*thread_number是线程池中线程的数量，max_requests是请求队列中最多允许的、等待处理的请求的数量，
+      shed_target是CoDel的排队延迟目标(纳秒)，0表示不按排队延迟丢弃请求*/
+    threadpool(int thread_number = 8, int max_requests = 10000, OVERFLOW_POLICY policy = OVERFLOW_PAUSE, long long shed_target = 0);
     ~threadpool();
     //添加任务的方法
-    bool append(T* request);
+    APPEND_RESULT append(T* request);
+    //批量添加任务，queued返回成功加入的个数，没加入的请求(requests[queued]以后)按返回值处理
+    APPEND_RESULT append_batch(T** requests, int n, int& queued);
+    OVERFLOW_POLICY policy() const { return m_policy; }
 private:
+    //一个工作线程一次最多从自己的队列中取出的任务数
+    static const int WORKER_BATCH = 8;
+
+    //队列中的一项：请求和它入队的时间
+    struct task
+    {
+        T* m_request;
+        long long m_queued;
+    };
+
+    //传给工作线程的参数
+    struct worker_arg
+    {
+        threadpool* m_pool;
+        int m_id;
+    };
+
     /*工作线程运行的函数，它不断从工作队列中取出任务并执行之*/
-    static void * worker(void * arg); 
-    void run();
+    static void * worker(void * arg);
+    void run(int id);
+    int take(int id, unsigned& seed, task* tasks);    //先从自己的队列取任务，没有的话再去其他队列窃取
+    int push(T** requests, int n);      //从下一个队列开始尝试入队，返回入队的个数
+    bool claim_idle();                  //把空闲线程数减1，成功说明认领到了一个空闲线程
+    void wake_one();
 
 private:
     //线程的数量
@@ -34,48 +82,74 @@ private:
     //请求队列中最多允许的等待处理的请求数量
     int m_max_requests;
 
-    //请求队列
-    list< T*> m_workqueue;
+    //队列满时的处理策略
+    OVERFLOW_POLICY m_policy;
+
+    //每个线程的请求队列
+    mpmc_queue<task> ** m_queues;
+    worker_arg * m_args;
 
-    //保护请求队列的互斥锁
-    locker m_queuelocker;
+    //每个工作线程的CoDel状态，只由对应的线程使用
+    codel * m_codels;
 
-    //信号量用来判断是否有任务需要处理；
-    sem m_queuestat;
+    //下一个接收新任务的队列
+    std::atomic<unsigned> m_next;
+
+    //正在休眠或准备休眠、还没有人负责唤醒的线程数量，以及用来唤醒它们的信号量
+    std::atomic<int> m_idle;
+    sem m_parking;
 
     //是否结束线程
-    bool m_stop;
+    std::atomic<bool> m_stop;
 
 
 };
 
 template<typename T>
-threadpool<T>::threadpool(int thread_number, int max_requests):
-    m_thread_number(thread_number), m_max_requests(max_requests), 
-    m_stop(false), m_threads(NULL){
+threadpool<T>::threadpool(int thread_number, int max_requests, OVERFLOW_POLICY policy, long long shed_target):
+    m_thread_number(thread_number), m_threads(NULL), m_max_requests(max_requests), m_policy(policy),
+    m_queues(NULL), m_args(NULL), m_codels(NULL), m_next(0), m_idle(0), m_stop(false){
 
     if(m_thread_number <= 0 || m_max_requests <= 0){
         throw exception();
     }
-    
+
+    //每个队列分到平均份额的容量
+    m_queues = new mpmc_queue<task>*[m_thread_number];
+    for(int i = 0; i < m_thread_number; i++){
+        m_queues[i] = new mpmc_queue<task>(m_max_requests / m_thread_number + 1);
+    }
+    m_args = new worker_arg[m_thread_number];
+    m_codels = new codel[m_thread_number];
+    for(int i = 0; i < m_thread_number; i++){
+        m_codels[i].init(shed_target, CODEL_INTERVAL);
+    }
+
     //创建线程
     m_threads = new pthread_t[m_thread_number];
-    if(!m_threads){
-        throw exception();
-    }
 
-    //创建thread_number个线程，并将他们设置为线程脱离
+    //创建thread_number个线程，析构时等待它们退出
     for(int i = 0; i < thread_number; i++){
 
-        printf("create the %dth request\n", i);
+        LOG_DEBUG("create worker thread %d", i);
 
-        if( pthread_create(m_threads + i, NULL, worker, this) != 0){
-            delete [] m_threads;
-            throw exception();
-        }
-        //功能：分离所有创建的线程。被分离的线程在终止的时候，会自动释放资源返回给系统。
-        if( pthread_detach(m_threads[i]) ){
+        m_args[i].m_pool = this;
+        m_args[i].m_id = i;
+        if( pthread_create(m_threads + i, NULL, worker, m_args + i) != 0){
+            m_stop = true;
+            for(int j = 0; j < i; j++){
+                m_parking.post();
+            }
+            for(int j = 0; j < i; j++){
+                pthread_join(m_threads[j], NULL);
+            }
+            for(int j = 0; j < m_thread_number; j++){
+                delete m_queues[j];
+            }
             delete [] m_threads;
+            delete [] m_args;
+            delete [] m_codels;
+            delete [] m_queues;
             throw exception();
         }
     }
@@ -84,63 +158,176 @@ threadpool<T>::threadpool(int thread_number, int max_requests):
 
 template<typename T>
 threadpool<T>::~threadpool(){
-    delete[] m_threads;
     m_stop = true;
+    for(int i = 0; i < m_thread_number; i++){
+        m_parking.post();
+    }
+    for(int i = 0; i < m_thread_number; i++){
+        pthread_join(m_threads[i], NULL);
+    }
+    for(int i = 0; i < m_thread_number; i++){
+        delete m_queues[i];
+    }
+    delete[] m_threads;
+    delete[] m_args;
+    delete[] m_codels;
+    delete[] m_queues;
+}
+
+template<typename T>
+int threadpool<T>::push(T** requests, int n){
+    unsigned start = m_next.fetch_add(1, std::memory_order_relaxed);
+    long long now = get_ns_time();
+    int queued = 0;
+    //一批请求共用一个入队时间，分几段放进队列，目标队列放不下就依次放到后面的队列
+    task tasks[WORKER_BATCH * 4];
+    int batch = sizeof(tasks) / sizeof(tasks[0]);
+    int queue = 0;
+    while(queued < n && queue < m_thread_number){
+        int count = n - queued < batch ? n - queued : batch;
+        for(int i = 0; i < count; i++){
+            tasks[i].m_request = requests[queued + i];
+            tasks[i].m_queued = now;
+        }
+        int pushed = 0;
+        while(pushed < count && queue < m_thread_number){
+            pushed += m_queues[(start + queue) % m_thread_number]->push_batch(tasks + pushed, count - pushed);
+            if(pushed < count){
+                queue++;
+            }
+        }
+        queued += pushed;
+    }
+    if(queued > 0){
+        //如果有空闲线程，就认领其中一个并让信号量+1，每次只唤醒一个，避免所有休眠的线程一起醒来抢任务。
+        //屏障保证先放入任务再读取空闲线程数，和run()中先登记空闲再检查队列配对
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        for(int i = 0; i < queued && m_idle.load() > 0; i += WORKER_BATCH){
+            wake_one();
+        }
+    }
+    return queued;
 }
 
-//append函数是向请求队列添加请求，所以没执行一次就需要信号量加1
+//append函数轮流向各个线程的请求队列添加请求，如果有线程在休眠就唤醒一个
 template<typename T>
-bool threadpool<T>::append(T* request){
+APPEND_RESULT threadpool<T>::append(T* request){
+    int queued;
+    return append_batch(&request, 1, queued);
+}
 
-    // 上锁，因为它被所有线程共享。
-    m_queuelocker.lock();
-    if(m_workqueue.size() > m_max_requests){
-        m_queuelocker.unlock();
-        throw exception();
+template<typename T>
+APPEND_RESULT threadpool<T>::append_batch(T** requests, int n, int& queued){
+    queued = push(requests, n);
+    if(queued == n){
+        return APPEND_OK;
+    }
+    switch(m_policy){
+        case OVERFLOW_BLOCK:
+            //阻塞调用者，直到工作线程腾出空位
+            while(queued < n && !m_stop){
+                sched_yield();
+                queued += push(requests + queued, n - queued);
+            }
+            return APPEND_OK;
+        case OVERFLOW_PAUSE:
+            return APPEND_PAUSED;
+        default:
+            return APPEND_REJECTED;
     }
-    //向用户队列中添加用户
-    m_workqueue.push_back(request);
-    //信号量+1，run()函数中线程发现有用户来了，就开始进行处理。
-    m_queuestat.post();
-    m_queuelocker.unlock();
-    
-    return true;
+}
 
+template<typename T>
+bool threadpool<T>::claim_idle(){
+    int idle = m_idle.load();
+    while(idle > 0){
+        if(m_idle.compare_exchange_weak(idle, idle - 1)){
+            return true;
+        }
+    }
+    return false;
+}
+
+template<typename T>
+void threadpool<T>::wake_one(){
+    if(claim_idle()){
+        m_parking.post();
+    }
 }
 
 template<typename T>
 void * threadpool<T>::worker(void * arg){
-    threadpool * pool = (threadpool *)arg;
-    pool->run();
-    return pool;
+    worker_arg * warg = (worker_arg *)arg;
+    warg->m_pool->run(warg->m_id);
+    return warg->m_pool;
 }
 
-//run()函数就是处理操作，所以循环一次就需要信号量减1
 template<typename T>
-void threadpool<T>::run(){
-    //当m_stop为false,说明线程在运行，这点很重要，只要线程未结束，就会不停的检测
-    while(!m_stop){
-        //如果-1后信号量为0，就会阻塞在这里，等待用户请求使信号量+1 才会被激活
-        m_queuestat.wait();
-        //信号量被激活，需要对请求进行处理，处理之前需要先上锁
-        m_queuelocker.lock();
-        //如果没有用户
-        if(m_workqueue.empty()){ 
-            m_queuelocker.unlock(); 
+int threadpool<T>::take(int id, unsigned& seed, task* tasks){
+    int n = m_queues[id]->pop_batch(tasks, WORKER_BATCH);
+    if(n > 0 || m_thread_number == 1){
+        return n;
+    }
+    //从随机选中的线程开始，依次尝试窃取其他每个线程的任务
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    int victim = seed % m_thread_number;
+    for(int i = 0; i < m_thread_number; i++, victim = (victim + 1) % m_thread_number){
+        if(victim == id || m_queues[victim]->empty()){
             continue;
         }
-        T* request = m_workqueue.front();
-        m_workqueue.pop_front();
-        m_queuelocker.unlock();
+        //只偷一个，剩下的留给队列的主人，避免任务在线程之间来回搬运
+        n = m_queues[victim]->pop_batch(tasks, 1);
+        if(n > 0){
+            return n;
+        }
+    }
+    return 0;
+}
 
-        if(!request){
-            continue;
+//run()函数就是处理操作，取不到任务时线程休眠
+template<typename T>
+void threadpool<T>::run(int id){
+    unsigned seed = 2463534242u + id * 2654435761u;
+    task tasks[WORKER_BATCH];
+    thread_stats* st = stats::local();
+    codel& shedder = m_codels[id];
+    //当m_stop为false,说明线程在运行，这点很重要，只要线程未结束，就会不停的检测
+    while(!m_stop){
+        int n = take(id, seed, tasks);
+        if(n == 0){
+            //先登记为空闲再检查一次队列，这样append()要么看到有空闲线程并唤醒它，要么任务在这次检查中被取到，不会错过唤醒
+            m_idle.fetch_add(1);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            n = take(id, seed, tasks);
+            if(n == 0){
+                //如果信号量为0，就会阻塞在这里，等待用户请求使信号量+1 才会被激活。空闲计数已经由唤醒者减掉了
+                m_parking.wait();
+                continue;
+            }
+            //取到了任务，撤销空闲登记。如果登记已经被append()认领，它发出的那次唤醒会让另一个线程多检查一次队列
+            claim_idle();
         }
 
-        request->process();
+        long long now = get_ns_time();
+        for(int i = 0; i < n; i++){
+            st->record(STAGE_QUEUE, now - tasks[i].m_queued);
+        }
+        for(int i = 0; i < n; i++){
+            if(!tasks[i].m_request){
+                continue;
+            }
+            //过载时丢弃排队太久的请求，它后面还有请求在排队时才丢弃
+            if(shedder.enabled() && shedder.should_drop(now, now - tasks[i].m_queued, i + 1 < n || !m_queues[id]->empty())){
+                tasks[i].m_request->shed();
+                continue;
+            }
+            tasks[i].m_request->process();
+        }
     }
 
 }
 
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,149 @@
+#include "tokenizer.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define TOKENIZER_X86
+#endif
+
+// 字符的类别：0是普通字符
+enum { CH_OTHER = 0, CH_EOL, CH_SPACE, CH_COLON };
+
+struct char_table
+{
+    unsigned char m_class[256];
+    char_table(){
+        for(int i = 0; i < 256; i++){
+            m_class[i] = CH_OTHER;
+        }
+        m_class[(unsigned char)'\r'] = CH_EOL;
+        m_class[(unsigned char)'\n'] = CH_EOL;
+        m_class[(unsigned char)' '] = CH_SPACE;
+        m_class[(unsigned char)'\t'] = CH_SPACE;
+        m_class[(unsigned char)':'] = CH_COLON;
+    }
+};
+
+static const char_table table;
+
+// 分隔符都找齐以后，剩下的部分只需要找行尾
+static inline bool tokens_full(const line_tokens& tokens){
+    return tokens.m_space[1] != -1 && tokens.m_colon != -1;
+}
+
+static inline void record(line_tokens& tokens, int cls, int pos){
+    if(cls == CH_SPACE){
+        if(tokens.m_space[0] == -1){
+            tokens.m_space[0] = pos;
+        }else if(tokens.m_space[1] == -1){
+            tokens.m_space[1] = pos;
+        }
+    }else if(cls == CH_COLON && tokens.m_colon == -1){
+        tokens.m_colon = pos;
+    }
+}
+
+static int scan_scalar(const char* buf, int from, int end, line_tokens& tokens){
+    for(int i = from; i < end; i++){
+        int cls = table.m_class[(unsigned char)buf[i]];
+        if(cls == CH_EOL){
+            return i;
+        }
+        if(cls != CH_OTHER){
+            record(tokens, cls, i);
+        }
+    }
+    return end;
+}
+
+#ifdef TOKENIZER_X86
+
+__attribute__((target("sse4.2")))
+static int scan_sse42(const char* buf, int from, int end, line_tokens& tokens){
+    //PCMPESTRI的"等于其中任意一个"模式：返回16个字节中第一个属于字符集的位置，没有时返回16
+    const __m128i all = _mm_setr_epi8('\r', '\n', ' ', '\t', ':', 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+    const __m128i eol = _mm_setr_epi8('\r', '\n', 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+    int i = from;
+    while(i + 16 <= end){
+        __m128i chunk = _mm_loadu_si128((const __m128i*)(buf + i));
+        bool full = tokens_full(tokens);
+        int idx = full ? _mm_cmpestri(eol, 2, chunk, 16, _SIDD_UBYTE_OPS | _SIDD_CMP_EQUAL_ANY)
+                       : _mm_cmpestri(all, 5, chunk, 16, _SIDD_UBYTE_OPS | _SIDD_CMP_EQUAL_ANY);
+        if(idx == 16){
+            i += 16;
+            continue;
+        }
+        int cls = table.m_class[(unsigned char)buf[i + idx]];
+        if(cls == CH_EOL){
+            return i + idx;
+        }
+        record(tokens, cls, i + idx);
+        i += idx + 1;
+    }
+    return scan_scalar(buf, i, end, tokens);
+}
+
+__attribute__((target("avx2")))
+static int scan_avx2(const char* buf, int from, int end, line_tokens& tokens){
+    const __m256i cr = _mm256_set1_epi8('\r');
+    const __m256i lf = _mm256_set1_epi8('\n');
+    const __m256i sp = _mm256_set1_epi8(' ');
+    const __m256i tab = _mm256_set1_epi8('\t');
+    const __m256i colon = _mm256_set1_epi8(':');
+    int i = from;
+    for(; i + 32 <= end; i += 32){
+        __m256i chunk = _mm256_loadu_si256((const __m256i*)(buf + i));
+        unsigned eol = (unsigned)_mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(chunk, cr), _mm256_cmpeq_epi8(chunk, lf)));
+        if(!tokens_full(tokens)){
+            unsigned delim = (unsigned)_mm256_movemask_epi8(_mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(chunk, sp),
+                _mm256_cmpeq_epi8(chunk, tab)), _mm256_cmpeq_epi8(chunk, colon)));
+            if(eol){
+                //只看行尾之前的分隔符
+                delim &= (eol & -eol) - 1;
+            }
+            while(delim && !tokens_full(tokens)){
+                int pos = i + __builtin_ctz(delim);
+                record(tokens, table.m_class[(unsigned char)buf[pos]], pos);
+                delim &= delim - 1;
+            }
+        }
+        if(eol){
+            return i + __builtin_ctz(eol);
+        }
+    }
+    return scan_scalar(buf, i, end, tokens);
+}
+
+#endif
+
+typedef int (*scan_fn)(const char*, int, int, line_tokens&);
+
+struct scan_impl
+{
+    scan_fn m_fn;
+    const char* m_name;
+    scan_impl(){
+        m_fn = scan_scalar;
+        m_name = "scalar";
+#ifdef TOKENIZER_X86
+        __builtin_cpu_init();
+        if(__builtin_cpu_supports("avx2")){
+            m_fn = scan_avx2;
+            m_name = "avx2";
+        }else if(__builtin_cpu_supports("sse4.2")){
+            m_fn = scan_sse42;
+            m_name = "sse4.2";
+        }
+#endif
+    }
+};
+
+//在main()之前按CPU选好实现，之后每次调用只是一次间接调用
+static const scan_impl impl;
+
+int scan_line(const char* buf, int from, int end, line_tokens& tokens){
+    return impl.m_fn(buf, from, end, tokens);
+}
+
+const char* scan_line_impl(){
+    return impl.m_name;
+}
@@ -0,0 +1,30 @@
+#ifndef TOKENIZER_H
+#define TOKENIZER_H
+
+/*
+    请求行和请求头的分词。一次扫描同时找出行尾('\r'或'\n')和行内的分隔符：
+    前两个空格(或制表符)用来切分请求行的方法、URL和版本，第一个冒号用来切分请求头的名字和值。
+    启动时按CPU支持的指令集选择实现：AVX2每次比较32个字节，SSE4.2用PCMPESTRI每次在16个字节中查找，
+    都不支持(或者不是x86)时逐字节查表。三种实现的结果完全相同。
+    扫描可以分几次进行：数据不完整时调用者记下扫描到的位置，收到更多数据后从那里继续，已经找到的分隔符保留在tokens中。
+*/
+
+// 当前行中已经找到的分隔符，都是相对于缓冲区开头的偏移，-1表示还没找到
+struct line_tokens
+{
+    int m_space[2];
+    int m_colon;
+};
+
+static inline void reset_tokens(line_tokens& tokens){
+    tokens.m_space[0] = tokens.m_space[1] = -1;
+    tokens.m_colon = -1;
+}
+
+// 从buf[from]扫描到buf[end - 1]，把途中遇到的分隔符记到tokens中，返回第一个'\r'或'\n'的偏移，没有时返回end
+int scan_line(const char* buf, int from, int end, line_tokens& tokens);
+
+// 当前使用的实现："avx2"、"sse4.2"或"scalar"
+const char* scan_line_impl();
+
+#endif
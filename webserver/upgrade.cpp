@@ -0,0 +1,155 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include "upgrade.h"
+#include "log.h"
+
+extern char** environ;
+
+int hot_upgrade::m_channel = -1;
+
+bool hot_upgrade::spawn(const char* exe, char* const argv[], const int* fds, int count){
+    if(count <= 0 || count > MAX_LISTEN_FDS){
+        LOG_ERROR("upgrade: cannot hand over %d listening sockets", count);
+        return false;
+    }
+    //旧进程一端在exec时关闭，新进程一端要留给新进程
+    int sv[2];
+    if(socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) == -1){
+        LOG_ERROR("upgrade: socketpair failed, errno is: %d", errno);
+        return false;
+    }
+    fcntl(sv[1], F_SETFD, 0);
+
+    //多线程进程fork以后的子进程里只能调用异步信号安全的函数，环境变量在fork之前准备好
+    int n = 0;
+    while(environ[n]){
+        n++;
+    }
+    char** envp = new char*[n + 2];
+    int m = 0;
+    for(int i = 0; i < n; i++){
+        if(strncmp(environ[i], UPGRADE_ENV "=", sizeof(UPGRADE_ENV)) != 0){
+            envp[m++] = environ[i];
+        }
+    }
+    char var[64];
+    snprintf(var, sizeof(var), UPGRADE_ENV "=%d", sv[1]);
+    envp[m++] = var;
+    envp[m] = NULL;
+
+    pid_t pid = fork();
+    if(pid == 0){
+        execve(exe, argv, envp);
+        _exit(127);
+    }
+    close(sv[1]);
+    delete []envp;
+    if(pid < 0){
+        LOG_ERROR("upgrade: fork failed, errno is: %d", errno);
+        close(sv[0]);
+        return false;
+    }
+
+    //一条消息带上全部监听socket，数据部分是socket的个数
+    char control[CMSG_SPACE(sizeof(int) * MAX_LISTEN_FDS)];
+    memset(control, 0, sizeof(control));
+    struct iovec iov;
+    iov.iov_base = &count;
+    iov.iov_len = sizeof(count);
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = CMSG_SPACE(sizeof(int) * count);
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int) * count);
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * count);
+
+    bool ok = sendmsg(sv[0], &msg, MSG_NOSIGNAL) == (ssize_t)sizeof(count);
+    if(ok){
+        //新进程退出时socket被关闭，poll返回可读，read得到0
+        struct pollfd pfd;
+        pfd.fd = sv[0];
+        pfd.events = POLLIN;
+        char reply = 0;
+        ok = poll(&pfd, 1, UPGRADE_TIMEOUT_MS) == 1 && read(sv[0], &reply, 1) == 1 && reply == 'R';
+    }
+    close(sv[0]);
+    if(!ok){
+        LOG_ERROR("upgrade: new process %d did not become ready", pid);
+        kill(pid, SIGKILL);
+        waitpid(pid, NULL, 0);
+        return false;
+    }
+    LOG_INFO("upgrade: new process %d is serving, %d listening sockets handed over", pid, count);
+    return true;
+}
+
+int hot_upgrade::inherit(int port, int* fds, int max){
+    const char* value = getenv(UPGRADE_ENV);
+    if(!value){
+        return 0;
+    }
+    m_channel = atoi(value);
+    unsetenv(UPGRADE_ENV);
+    fcntl(m_channel, F_SETFD, FD_CLOEXEC);
+
+    int count = 0;
+    char control[CMSG_SPACE(sizeof(int) * MAX_LISTEN_FDS)];
+    struct iovec iov;
+    iov.iov_base = &count;
+    iov.iov_len = sizeof(count);
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    if(recvmsg(m_channel, &msg, MSG_CMSG_CLOEXEC) != (ssize_t)sizeof(count)){
+        LOG_ERROR("upgrade: failed to receive listening sockets, errno is: %d", errno);
+        return 0;
+    }
+
+    int n = 0;
+    for(struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)){
+        if(cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS){
+            continue;
+        }
+        int received = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        int* data = (int*)CMSG_DATA(cmsg);
+        for(int i = 0; i < received; i++){
+            //启动参数里的端口变了，就不用旧的socket，由reactor重新绑定
+            struct sockaddr_in addr;
+            socklen_t len = sizeof(addr);
+            if(n < max && getsockname(data[i], (struct sockaddr*)&addr, &len) == 0 && ntohs(addr.sin_port) == port){
+                fds[n++] = data[i];
+            }else{
+                LOG_WARN("upgrade: inherited socket %d is not used", data[i]);
+                close(data[i]);
+            }
+        }
+    }
+    return n;
+}
+
+void hot_upgrade::ready(){
+    if(m_channel == -1){
+        return;
+    }
+    char reply = 'R';
+    write(m_channel, &reply, 1);
+    close(m_channel);
+    m_channel = -1;
+}
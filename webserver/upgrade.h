@@ -0,0 +1,34 @@
+#ifndef UPGRADE_H
+#define UPGRADE_H
+
+/*
+    不中断服务的升级：收到SIGUSR2后，旧进程fork并exec(通常已经被替换成新版本的)可执行文件，
+    通过一对Unix域socket用SCM_RIGHTS把所有监听socket传给新进程。新进程直接使用这些socket，不重新绑定端口，
+    积压队列中还没被接受的连接也一起交给了它。新进程的reactor都初始化好以后回复一个字节，
+    旧进程收到后停止接受新连接，剩下的请求都以Connection: close回复，等连接全部关闭或者超过期限后退出。
+    新进程没有按时回复(启动失败、可执行文件不存在等)时，旧进程结束它并继续正常服务。
+    新进程通过环境变量 UPGRADE_ENV 得知自己是被升级启动的，变量的值是和旧进程通信的socket。
+*/
+
+#define UPGRADE_ENV "WEBSERVER_UPGRADE_FD"
+#define UPGRADE_TIMEOUT_MS 10000    //等待新进程就绪的时间
+#define MAX_LISTEN_FDS 64           //一次最多传递的监听socket数
+
+class hot_upgrade
+{
+public:
+    //旧进程：启动exe，把count个监听socket传给它，等待它就绪。成功返回true，这之后新进程已经在接受连接
+    static bool spawn(const char* exe, char* const argv[], const int* fds, int count);
+
+    //新进程：如果是被升级启动的，从旧进程接收监听socket，返回个数，否则返回0。
+    //端口和port不同的socket不使用，直接关闭
+    static int inherit(int port, int* fds, int max);
+
+    //新进程：所有reactor都已经初始化好，通知旧进程停止接受连接
+    static void ready();
+
+private:
+    static int m_channel;   //新进程中和旧进程通信的socket
+};
+
+#endif
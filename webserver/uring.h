@@ -0,0 +1,241 @@
+#ifndef URING_H
+#define URING_H
+
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+
+/*
+    io_uring 的简单封装，直接使用系统调用，不依赖liburing。
+    提交队列(SQ)和完成队列(CQ)都映射到用户空间：get_sqe() 取一个空的提交项填写，submit_and_wait() 一次系统调用
+    提交所有填好的项并等待完成；peek_cqe()/cqe_seen() 逐个取出完成项。
+    setup_buffers() 提供一组缓冲区(provided buffers)，recv 时由内核从中挑选缓冲区，
+    这样等待数据的连接不需要各自占着一块缓冲区。用完的缓冲区通过 recycle_buf() 还给内核。
+    只在一个线程中使用，所以SQ尾指针和CQ头指针都不需要额外同步。
+*/
+class io_ring
+{
+public:
+    io_ring(): m_fd(-1), m_sq_ptr(NULL), m_cq_ptr(NULL), m_sqes(NULL), m_sqe_tail(0),
+        m_bufs(NULL), m_bgid(0), m_buf_size(0){
+        memset(&m_params, 0, sizeof(m_params));
+    }
+
+    ~io_ring(){
+        destroy();
+    }
+
+    //解除映射、关闭io_uring实例并释放提供的缓冲区，回到创建之前的状态。初始化到一半失败、改用其他后端时调用
+    void destroy(){
+        free(m_bufs);
+        m_bufs = NULL;
+        if(m_sqes){
+            munmap(m_sqes, m_params.sq_entries * sizeof(struct io_uring_sqe));
+            m_sqes = NULL;
+        }
+        if(m_cq_ptr && m_cq_ptr != m_sq_ptr){
+            munmap(m_cq_ptr, m_cq_size);
+        }
+        m_cq_ptr = NULL;
+        if(m_sq_ptr){
+            munmap(m_sq_ptr, m_sq_size);
+            m_sq_ptr = NULL;
+        }
+        if(m_fd != -1){
+            close(m_fd);
+            m_fd = -1;
+        }
+        memset(&m_params, 0, sizeof(m_params));
+        m_sqe_tail = 0;
+    }
+
+    //创建io_uring实例并映射SQ、CQ和提交项数组，失败返回false(比如内核不支持或被禁用)
+    bool init(unsigned entries){
+        m_fd = syscall(__NR_io_uring_setup, entries, &m_params);
+        if(m_fd < 0){
+            return false;
+        }
+        if(!(m_params.features & IORING_FEAT_EXT_ARG) || !(m_params.features & IORING_FEAT_CQE_SKIP)){
+            //内核太旧：5.11以前等待时无法指定超时，5.17以前不支持IOSQE_CQE_SKIP_SUCCESS(recycle_buf()要用)
+            errno = EOPNOTSUPP;
+            return false;
+        }
+        m_sq_size = m_params.sq_off.array + m_params.sq_entries * sizeof(unsigned);
+        m_cq_size = m_params.cq_off.cqes + m_params.cq_entries * sizeof(struct io_uring_cqe);
+        //新内核的SQ和CQ在同一块映射中
+        if(m_params.features & IORING_FEAT_SINGLE_MMAP){
+            if(m_cq_size > m_sq_size){
+                m_sq_size = m_cq_size;
+            }
+            m_cq_size = m_sq_size;
+        }
+        m_sq_ptr = mmap(0, m_sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQ_RING);
+        if(m_sq_ptr == MAP_FAILED){
+            m_sq_ptr = NULL;
+            return false;
+        }
+        if(m_params.features & IORING_FEAT_SINGLE_MMAP){
+            m_cq_ptr = m_sq_ptr;
+        }else{
+            m_cq_ptr = mmap(0, m_cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_CQ_RING);
+            if(m_cq_ptr == MAP_FAILED){
+                m_cq_ptr = NULL;
+                return false;
+            }
+        }
+        m_sqes = (struct io_uring_sqe*)mmap(0, m_params.sq_entries * sizeof(struct io_uring_sqe),
+            PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQES);
+        if(m_sqes == MAP_FAILED){
+            m_sqes = NULL;
+            return false;
+        }
+
+        char* sq = (char*)m_sq_ptr;
+        m_sq_head = (unsigned*)(sq + m_params.sq_off.head);
+        m_sq_tail = (unsigned*)(sq + m_params.sq_off.tail);
+        m_sq_mask = *(unsigned*)(sq + m_params.sq_off.ring_mask);
+        m_sq_array = (unsigned*)(sq + m_params.sq_off.array);
+        m_sqe_tail = *m_sq_tail;
+
+        char* cq = (char*)m_cq_ptr;
+        m_cq_head = (unsigned*)(cq + m_params.cq_off.head);
+        m_cq_tail = (unsigned*)(cq + m_params.cq_off.tail);
+        m_cq_mask = *(unsigned*)(cq + m_params.cq_off.ring_mask);
+        m_cqes = (struct io_uring_cqe*)(cq + m_params.cq_off.cqes);
+        return true;
+    }
+
+    //取一个空的提交项，SQ满了返回NULL，调用者应该先submit()
+    struct io_uring_sqe* get_sqe(){
+        unsigned head = __atomic_load_n(m_sq_head, __ATOMIC_ACQUIRE);
+        if(m_sqe_tail - head >= m_params.sq_entries){
+            return NULL;
+        }
+        struct io_uring_sqe* sqe = &m_sqes[m_sqe_tail & m_sq_mask];
+        m_sqe_tail++;
+        memset(sqe, 0, sizeof(*sqe));
+        return sqe;
+    }
+
+    //提交所有填好的提交项，并等待至少wait_nr个完成项，最多等待timeout_ms毫秒(-1表示一直等)。
+    //返回值和io_uring_enter相同，超时的时候失败并把errno设为ETIME
+    int submit_and_wait(unsigned wait_nr, int timeout_ms = -1){
+        unsigned tail = *m_sq_tail;
+        unsigned to_submit = m_sqe_tail - tail;
+        for(; tail != m_sqe_tail; tail++){
+            m_sq_array[tail & m_sq_mask] = tail & m_sq_mask;
+        }
+        __atomic_store_n(m_sq_tail, m_sqe_tail, __ATOMIC_RELEASE);
+        unsigned flags = wait_nr ? IORING_ENTER_GETEVENTS : 0;
+        if(wait_nr == 0 || timeout_ms < 0){
+            return syscall(__NR_io_uring_enter, m_fd, to_submit, wait_nr, flags, NULL, 0);
+        }
+        //超时时间通过扩展参数传给内核，不需要额外提交一个超时请求
+        struct __kernel_timespec ts;
+        ts.tv_sec = timeout_ms / 1000;
+        ts.tv_nsec = (timeout_ms % 1000) * 1000000LL;
+        struct io_uring_getevents_arg arg;
+        memset(&arg, 0, sizeof(arg));
+        arg.ts = (unsigned long)&ts;
+        return syscall(__NR_io_uring_enter, m_fd, to_submit, wait_nr, flags | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+    }
+
+    int submit(){
+        return submit_and_wait(0);
+    }
+
+    //返回下一个完成项，没有则返回NULL。处理完后调用cqe_seen()
+    struct io_uring_cqe* peek_cqe(){
+        unsigned head = *m_cq_head;
+        if(head == __atomic_load_n(m_cq_tail, __ATOMIC_ACQUIRE)){
+            return NULL;
+        }
+        return &m_cqes[head & m_cq_mask];
+    }
+
+    void cqe_seen(){
+        __atomic_store_n(m_cq_head, *m_cq_head + 1, __ATOMIC_RELEASE);
+    }
+
+    //把entries个大小为buf_size的缓冲区提供给内核，作为缓冲区组bgid。在提交任何recv之前调用
+    bool setup_buffers(unsigned short bgid, unsigned entries, unsigned buf_size){
+        m_bgid = bgid;
+        m_buf_size = buf_size;
+        m_bufs = (char*)malloc((size_t)entries * buf_size);
+        if(!m_bufs){
+            return false;
+        }
+        struct io_uring_sqe* sqe = get_sqe();
+        sqe->opcode = IORING_OP_PROVIDE_BUFFERS;
+        sqe->fd = entries;
+        sqe->addr = (unsigned long)m_bufs;
+        sqe->len = buf_size;
+        sqe->buf_group = bgid;
+        sqe->off = 0;
+        if(submit_and_wait(1) < 0){
+            return false;
+        }
+        struct io_uring_cqe* cqe = peek_cqe();
+        bool ok = cqe && cqe->res >= 0;
+        if(cqe){
+            cqe_seen();
+        }
+        return ok;
+    }
+
+    char* buf_addr(unsigned short bid){
+        return m_bufs + (size_t)bid * m_buf_size;
+    }
+
+    unsigned buf_size() const{
+        return m_buf_size;
+    }
+
+    //数据已经取走，把缓冲区还给内核。归还请求和其他请求一起在下次io_uring_enter时提交，
+    //成功时不产生完成项；失败时产生一个user_data为0的完成项，调用者忽略它即可
+    void recycle_buf(unsigned short bid){
+        struct io_uring_sqe* sqe = get_sqe();
+        while(!sqe){
+            submit();
+            sqe = get_sqe();
+        }
+        sqe->opcode = IORING_OP_PROVIDE_BUFFERS;
+        sqe->fd = 1;
+        sqe->addr = (unsigned long)buf_addr(bid);
+        sqe->len = m_buf_size;
+        sqe->buf_group = m_bgid;
+        sqe->off = bid;
+        sqe->flags = IOSQE_CQE_SKIP_SUCCESS;
+    }
+
+private:
+    int m_fd;
+    struct io_uring_params m_params;
+
+    void* m_sq_ptr;
+    size_t m_sq_size;
+    void* m_cq_ptr;
+    size_t m_cq_size;
+
+    unsigned* m_sq_head;
+    unsigned* m_sq_tail;
+    unsigned m_sq_mask;
+    unsigned* m_sq_array;
+    struct io_uring_sqe* m_sqes;
+    unsigned m_sqe_tail;    //已经取出但还没提交的提交项的尾部
+
+    unsigned* m_cq_head;
+    unsigned* m_cq_tail;
+    unsigned m_cq_mask;
+    struct io_uring_cqe* m_cqes;
+
+    char* m_bufs;           //提供给内核的缓冲区，按编号连续存放
+    unsigned short m_bgid;
+    unsigned m_buf_size;
+};
+
+#endif